@@ -27,6 +27,10 @@ enum bboxAxis getLongestAxis(const struct boundingBox *bbox) {
 	return x > y && x > z ? X : y > z ? Y : Z;
 }
 
+float vecAxis(struct vector v, enum bboxAxis axis) {
+	return axis == X ? v.x : axis == Y ? v.y : v.z;
+}
+
 /**
  Compute the bounding box for a given array of polygons
 
@@ -34,10 +38,9 @@ enum bboxAxis getLongestAxis(const struct boundingBox *bbox) {
  @param count Amount of polygons indices given
  @return Axis-aligned bounding box
  */
-struct boundingBox *computeBoundingBox(const int *polys, const int count) {
+struct boundingBox computeBoundingBox(const int *polys, const int count) {
 	ASSERT(polys);
 	ASSERT(count > 0);
-	struct boundingBox *bbox = calloc(1, sizeof(struct boundingBox));
 	struct vector minPoint = vecWithPos(FLT_MAX, FLT_MAX, FLT_MAX);
 	struct vector maxPoint = vecWithPos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 	
@@ -48,58 +51,27 @@ struct boundingBox *computeBoundingBox(const int *polys, const int count) {
 		}
 	}
 	struct vector center = vecWithPos(0.5 * (minPoint.x + maxPoint.x), 0.5 * (minPoint.y + maxPoint.y), 0.5 * (minPoint.z + maxPoint.z));
-	float maxDistance = 0.0;
-	for (int i = 0; i < count; ++i) {
-		for (int j = 0; j < 3; ++j) {
-			struct vector fromCenter = vecSub(vertexArray[polygonArray[polys[i]].vertexIndex[j]], center);
-			maxDistance = max(maxDistance, pow(vecLength(fromCenter), 2));
-		}
-	}
-	bbox->start = minPoint;
-	bbox->end = maxPoint;
-	bbox->midPoint = center;
-	return bbox;
+	return (struct boundingBox){minPoint, maxPoint, center};
 }
 
+struct boundingBox emptyBoundingBox() {
+	return (struct boundingBox){
+		.start = vecWithPos(FLT_MAX, FLT_MAX, FLT_MAX),
+		.end = vecWithPos(-FLT_MAX, -FLT_MAX, -FLT_MAX),
+		.midPoint = vecZero()
+	};
+}
 
-/**
- Check if a ray intersects with an axis-aligned bounding box
-
- @param box Given bounding box to check against
- @param ray Given light ray to intersect
- @param t Current max t value for the ray
- @return true if intersected, false otherwise
- */
-bool rayIntersectWithAABB(const struct boundingBox *box, const struct lightRay *ray, float *t) {
-	//If a mesh has no polygons, it won't have a root bbox either.
-	if (!box) return false;
-	
-	struct vector dirfrac = vecWithPos(1.0f / ray->direction.x, 1.0f / ray->direction.y, 1.0f / ray->direction.z);
+bool isEmptyBoundingBox(const struct boundingBox *bbox) {
+	return bbox->start.x > bbox->end.x || bbox->start.y > bbox->end.y || bbox->start.z > bbox->end.z;
+}
 
-	float t1 = (box->start.x - ray->start.x)*dirfrac.x;
-	float t2 = (box->  end.x - ray->start.x)*dirfrac.x;
-	float t3 = (box->start.y - ray->start.y)*dirfrac.y;
-	float t4 = (box->  end.y - ray->start.y)*dirfrac.y;
-	float t5 = (box->start.z - ray->start.z)*dirfrac.z;
-	float t6 = (box->  end.z - ray->start.z)*dirfrac.z;
-	
-	float tmin = max(max(min(t1, t2), min(t3, t4)), min(t5, t6));
-	float tmax = min(min(max(t1, t2), max(t3, t4)), max(t5, t6));
-	
-	// if tmax < 0, ray is intersecting AABB, but the whole AABB is behind us
-	if (tmax < 0) {
-		*t = tmax;
-		return false;
-	}
-	
-	// if tmin > tmax, ray doesn't intersect AABB
-	if (tmin > tmax) {
-		*t = tmax;
-		return false;
-	}
-	
-	*t = tmin;
-	return true;
+struct boundingBox combineBoundingBoxes(const struct boundingBox *a, const struct boundingBox *b) {
+	struct boundingBox bbox;
+	bbox.start = vecMin(a->start, b->start);
+	bbox.end = vecMax(a->end, b->end);
+	bbox.midPoint = vecScale(vecAdd(bbox.start, bbox.end), 0.5f);
+	return bbox;
 }
 
 float findSurfaceArea(const struct boundingBox *box) {
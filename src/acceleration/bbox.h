@@ -26,18 +26,29 @@ struct boundingBox {
 /// Computes a bounding box for a given array of polygons
 /// @param polys Array of polygons to process
 /// @param count Amount of polygons given
-struct boundingBox *computeBoundingBox(const int *polys, const int count);
+struct boundingBox computeBoundingBox(const int *polys, const int count);
+
+/// Returns an empty, inverted bounding box that can be grown with combineBoundingBoxes()
+struct boundingBox emptyBoundingBox(void);
+
+/// Check if a bounding box is inverted on any axis, like the one from emptyBoundingBox()
+/// @param bbox Bounding box to check
+bool isEmptyBoundingBox(const struct boundingBox *bbox);
+
+/// Compute a bounding box that encloses both given bounding boxes
+/// @param a Bounding box 1
+/// @param b Bounding box 2
+struct boundingBox combineBoundingBoxes(const struct boundingBox *a, const struct boundingBox *b);
+
+/// Get the component of a vector along a given axis
+/// @param v Vector to read
+/// @param axis Axis to read the component for
+float vecAxis(struct vector v, enum bboxAxis axis);
 
 /// Compute the longest axis of a given bounding box
 /// @param bbox Bounding box to process
 enum bboxAxis getLongestAxis(const struct boundingBox *bbox);
 
-/// Checks  for an intersection between a given ray and bounding box
-/// @param box Bounding box to check intersection against
-/// @param ray Ray to intersect
-/// @param t Distance the intersection occurred at along the ray
-bool rayIntersectWithAABB(const struct boundingBox *box, const struct lightRay *ray, float *t);
-
 /// Compute the surface area of a given bounding box
 /// @param box Bounding box to compute surface area for
 float findSurfaceArea(const struct boundingBox *box);
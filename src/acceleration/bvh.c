@@ -0,0 +1,497 @@
+//
+//  bvh.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "bvh.h"
+#include "bbox.h"
+#include "widebvh.h"
+#include "packedtris.h"
+
+#include "../renderer/pathtrace.h"
+#include "../datatypes/vertexbuffer.h"
+#include "../datatypes/poly.h"
+#include "../utils/assert.h"
+#include "../utils/memory.h"
+#include "../utils/multiplatform.h"
+#include "../utils/filehandler.h"
+
+/*
+ Binned SAH builder
+ For each node:
+ 1. Compute the bounds of the primitive centroids in the node
+ 2. For each axis, sort the centroids into BVH_BIN_COUNT evenly sized bins
+ 3. Sweep over the bins to evaluate the SAH cost for every plane between two bins
+ 4. Split at the cheapest plane, or create a leaf if that is cheaper than any split.
+ Primitive indices are partitioned in place, so leaves just reference a range of them.
+ A subtree over N primitives never has more than 2N - 1 nodes, so each subtree gets a range of
+ that size reserved in the node array. Both halves of a split can then be built independently,
+ and large ones are handed to another thread if the thread budget allows it.
+ The gaps this leaves are closed when the nodes are compacted at the end.
+ */
+
+#define BVH_BIN_COUNT 16
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_MAX_DEPTH 64
+#define BVH_NODE_ALIGNMENT 64
+#define BVH_PARALLEL_THRESHOLD 4096
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_INTERSECT_COST 1.0f
+
+struct bvhBin {
+	struct boundingBox bbox;
+	int count;
+};
+
+struct bvhBuilder {
+	const struct boundingBox *bboxes; //Bounds of each primitive. midPoint is used as the centroid
+	int *indices; //Primitive indices, partitioned in place while building
+	struct bvhNode *nodes;
+	struct bvhThreadBudget *budget; //NULL to build on the calling thread only
+};
+
+struct bvhTask {
+	struct bvhBuilder *b;
+	int nodeIndex;
+	int begin, end;
+	int depth;
+	int nodeCount; //Result
+};
+
+bool takeBuildThread(struct bvhThreadBudget *budget) {
+	if (!budget) return false;
+	lockMutex(budget->lock);
+	bool available = budget->available > 0;
+	if (available) budget->available--;
+	releaseMutex(budget->lock);
+	return available;
+}
+
+void returnBuildThread(struct bvhThreadBudget *budget) {
+	if (!budget) return;
+	lockMutex(budget->lock);
+	budget->available++;
+	releaseMutex(budget->lock);
+}
+
+int binForCentroid(struct vector centroid, int axis, float axisMin, float binScale) {
+	int bin = (int)((vecAxis(centroid, axis) - axisMin) * binScale);
+	return min(max(bin, 0), BVH_BIN_COUNT - 1);
+}
+
+//Returns the index of the first primitive on the right side
+int partitionPrimitives(struct bvhBuilder *b, int begin, int end, int axis, int splitBin, float axisMin, float binScale) {
+	int i = begin;
+	int j = end - 1;
+	while (i <= j) {
+		if (binForCentroid(b->bboxes[b->indices[i]].midPoint, axis, axisMin, binScale) <= splitBin) {
+			i++;
+		} else {
+			int temp = b->indices[i];
+			b->indices[i] = b->indices[j];
+			b->indices[j--] = temp;
+		}
+	}
+	return i;
+}
+
+void makeLeaf(struct bvhNode *node, int begin, int end) {
+	node->index = begin;
+	node->primCount = end - begin;
+}
+
+void *buildBvhTask(void *arg);
+
+//Returns the amount of nodes in the subtree
+int buildBvhNode(struct bvhBuilder *b, int nodeIndex, int begin, int end, int depth) {
+	struct bvhNode *node = &b->nodes[nodeIndex];
+	int count = end - begin;
+
+	struct boundingBox bbox = emptyBoundingBox();
+	struct boundingBox centroidBounds = emptyBoundingBox();
+	for (int i = begin; i < end; ++i) {
+		const struct boundingBox *primBox = &b->bboxes[b->indices[i]];
+		bbox = combineBoundingBoxes(&bbox, primBox);
+		centroidBounds.start = vecMin(centroidBounds.start, primBox->midPoint);
+		centroidBounds.end = vecMax(centroidBounds.end, primBox->midPoint);
+	}
+	node->start = bbox.start;
+	node->end = bbox.end;
+
+	if (count == 1) {
+		makeLeaf(node, begin, end);
+		return 1;
+	}
+
+	//Find the cheapest split plane on all three axes
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestBin = -1;
+	for (int axis = 0; axis < 3; ++axis) {
+		float axisMin = vecAxis(centroidBounds.start, axis);
+		float axisMax = vecAxis(centroidBounds.end, axis);
+		if (axisMax - axisMin <= 0.0f) continue;
+		float binScale = BVH_BIN_COUNT / (axisMax - axisMin);
+
+		struct bvhBin bins[BVH_BIN_COUNT];
+		for (int i = 0; i < BVH_BIN_COUNT; ++i) {
+			bins[i].bbox = emptyBoundingBox();
+			bins[i].count = 0;
+		}
+		for (int i = begin; i < end; ++i) {
+			const struct boundingBox *primBox = &b->bboxes[b->indices[i]];
+			struct bvhBin *bin = &bins[binForCentroid(primBox->midPoint, axis, axisMin, binScale)];
+			bin->bbox = combineBoundingBoxes(&bin->bbox, primBox);
+			bin->count++;
+		}
+
+		//Sweep from the right to get the cost of everything right of each plane
+		float rightArea[BVH_BIN_COUNT - 1];
+		int rightCount[BVH_BIN_COUNT - 1];
+		struct boundingBox accum = emptyBoundingBox();
+		int accumCount = 0;
+		for (int i = BVH_BIN_COUNT - 1; i > 0; --i) {
+			accum = combineBoundingBoxes(&accum, &bins[i].bbox);
+			accumCount += bins[i].count;
+			rightArea[i - 1] = accumCount ? findSurfaceArea(&accum) : 0.0f;
+			rightCount[i - 1] = accumCount;
+		}
+
+		//Then sweep from the left, and evaluate the full cost for each plane
+		accum = emptyBoundingBox();
+		accumCount = 0;
+		for (int i = 0; i < BVH_BIN_COUNT - 1; ++i) {
+			accum = combineBoundingBoxes(&accum, &bins[i].bbox);
+			accumCount += bins[i].count;
+			if (!accumCount || !rightCount[i]) continue;
+			float cost = accumCount * findSurfaceArea(&accum) + rightCount[i] * rightArea[i];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = i;
+			}
+		}
+	}
+
+	int mid;
+	if (bestAxis == -1 || depth >= BVH_MAX_DEPTH) {
+		//All centroids are in the same spot, or the tree is getting too deep. SAH can't help us here
+		if (count <= BVH_MAX_LEAF_SIZE) {
+			makeLeaf(node, begin, end);
+			return 1;
+		}
+		mid = begin + count / 2;
+	} else {
+		float parentArea = findSurfaceArea(&bbox);
+		float splitCost = parentArea > 0.0f ? BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * (bestCost / parentArea) : FLT_MAX;
+		float leafCost = BVH_INTERSECT_COST * count;
+		if (splitCost >= leafCost && count <= BVH_MAX_LEAF_SIZE) {
+			makeLeaf(node, begin, end);
+			return 1;
+		}
+		float axisMin = vecAxis(centroidBounds.start, bestAxis);
+		float binScale = BVH_BIN_COUNT / (vecAxis(centroidBounds.end, bestAxis) - axisMin);
+		mid = partitionPrimitives(b, begin, end, bestAxis, bestBin, axisMin, binScale);
+		ASSERT(mid > begin && mid < end);
+	}
+
+	//Left child always goes right after its parent, and the right child after the range reserved for the left one
+	node->primCount = 0;
+	node->index = nodeIndex + 2 * (mid - begin);
+	struct bvhTask left = {b, nodeIndex + 1, begin, mid, depth + 1, 0};
+	struct crThread thread = {.threadFunc = buildBvhTask, .userData = &left};
+	bool parallel = count >= BVH_PARALLEL_THRESHOLD && takeBuildThread(b->budget);
+	if (parallel && spawnThread(&thread)) {
+		//Couldn't spawn a thread, just build it here instead
+		returnBuildThread(b->budget);
+		parallel = false;
+	}
+	if (!parallel) buildBvhTask(&thread);
+	int rightCount = buildBvhNode(b, node->index, mid, end, depth + 1);
+	if (parallel) {
+		checkThread(&thread);
+		returnBuildThread(b->budget);
+	}
+	return 1 + left.nodeCount + rightCount;
+}
+
+void *buildBvhTask(void *arg) {
+	struct crThread *thread = (struct crThread *)arg;
+	struct bvhTask *task = (struct bvhTask *)thread->userData;
+	task->nodeCount = buildBvhNode(task->b, task->nodeIndex, task->begin, task->end, task->depth);
+	return NULL;
+}
+
+//Copy nodes over in depth-first order, closing the gaps left between reserved ranges. Returns the next free index in dst.
+int compactBvhNodes(const struct bvhNode *src, int srcIndex, struct bvhNode *dst, int dstIndex) {
+	dst[dstIndex] = src[srcIndex];
+	if (src[srcIndex].primCount) return dstIndex + 1;
+	int right = compactBvhNodes(src, srcIndex + 1, dst, dstIndex + 1);
+	dst[dstIndex].index = right;
+	return compactBvhNodes(src, src[srcIndex].index, dst, right);
+}
+
+struct boundingBox polygonBoundingBox(int polyIndex) {
+	struct boundingBox bbox = emptyBoundingBox();
+	for (int j = 0; j < 3; ++j) {
+		bbox.start = vecMin(bbox.start, vertexArray[polygonArray[polyIndex].vertexIndex[j]]);
+		bbox.end = vecMax(bbox.end, vertexArray[polygonArray[polyIndex].vertexIndex[j]]);
+	}
+	bbox.midPoint = vecScale(vecAdd(bbox.start, bbox.end), 0.5f);
+	return bbox;
+}
+
+struct bvh *buildBvhFromBoundingBoxes(const struct boundingBox *bboxes, const int count, struct bvhThreadBudget *budget) {
+	struct bvh *bvh = calloc(1, sizeof(struct bvh));
+	if (count == 0) return bvh;
+
+	int *indices = malloc(count * sizeof(int));
+	for (int i = 0; i < count; ++i) {
+		indices[i] = i;
+	}
+
+	//A binary tree with N leaves never has more than 2N - 1 nodes
+	struct bvhBuilder builder = {
+		.bboxes = bboxes,
+		.indices = indices,
+		.nodes = malloc((2 * count - 1) * sizeof(struct bvhNode)),
+		.budget = budget
+	};
+	int nodeCount = buildBvhNode(&builder, 0, 0, count, 0);
+
+	struct bvhNode *nodes = malloc(nodeCount * sizeof(struct bvhNode));
+	compactBvhNodes(builder.nodes, 0, nodes, 0);
+	free(builder.nodes);
+	storeBvhNodes(bvh, nodes, nodeCount);
+	bvh->primIndices = indices;
+	bvh->primCount = count;
+	bvh->buildCost = bvhSAHCost(bvh);
+	return bvh;
+}
+
+struct bvh *buildBvh(const int *polygons, const int count, struct bvhThreadBudget *budget) {
+	struct boundingBox *bboxes = calloc(count, sizeof(struct boundingBox));
+	for (int i = 0; i < count; ++i) {
+		bboxes[i] = polygonBoundingBox(polygons[i]);
+	}
+	struct bvh *bvh = buildBvhFromBoundingBoxes(bboxes, count, budget);
+	//Map back to polygonArray indices
+	for (int i = 0; i < count; ++i) {
+		bvh->primIndices[i] = polygons[bvh->primIndices[i]];
+	}
+	free(bboxes);
+	return bvh;
+}
+
+void storeBvhNodes(struct bvh *bvh, struct bvhNode *nodes, int nodeCount) {
+	bvh->nodes = cray_aligned_malloc(BVH_NODE_ALIGNMENT, nodeCount * sizeof(struct bvhNode));
+	memcpy(bvh->nodes, nodes, nodeCount * sizeof(struct bvhNode));
+	bvh->nodeCount = nodeCount;
+	free(nodes);
+}
+
+bool rayIntersectsWithNodeBounds(const struct bvhNode *node, const struct lightRay *ray, float maxDistance, float *t) {
+	//start and end are laid out next to each other, so the sign bits pick the near and far planes
+	const struct vector *bounds = &node->start;
+	float tNear = (bounds[ray->sign[0]].x - ray->start.x) * ray->inverseDirection.x;
+	float tFar = (bounds[1 - ray->sign[0]].x - ray->start.x) * ray->inverseDirection.x;
+	float tNearY = (bounds[ray->sign[1]].y - ray->start.y) * ray->inverseDirection.y;
+	float tFarY = (bounds[1 - ray->sign[1]].y - ray->start.y) * ray->inverseDirection.y;
+	float tNearZ = (bounds[ray->sign[2]].z - ray->start.z) * ray->inverseDirection.z;
+	float tFarZ = (bounds[1 - ray->sign[2]].z - ray->start.z) * ray->inverseDirection.z;
+
+	tNear = max(max(tNear, tNearY), max(tNearZ, ray->tmin));
+	tFar = min(min(tFar, tFarY), min(tFarZ, maxDistance));
+
+	*t = tNear;
+	return tNear <= tFar;
+}
+
+bool rayIntersectsWithLeaf(const struct bvh *bvh, int first, int count, const struct lightRay *ray, struct hitRecord *isect) {
+	if (bvh->triangles) return rayIntersectsWithPackedTriangles(bvh, first, count, ray, isect);
+	bool hasHit = false;
+	for (int i = first; i < first + count; ++i) {
+		const struct poly *p = &polygonArray[bvh->primIndices[i]];
+		if (rayIntersectsWithPolygon(ray, p, &isect->distance, &isect->uv)) {
+			hasHit = true;
+			isect->type = hitTypePolygon;
+			isect->polyIndex = p->polyIndex;
+		}
+	}
+	return hasHit;
+}
+
+bool rayIntersectsWithBvh(const struct bvh *bvh, const struct lightRay *ray, struct hitRecord *isect) {
+	//If a mesh has no polygons, it won't have any nodes either.
+	if (!bvh || !bvh->nodeCount) return false;
+	if (bvh->wideNodes || bvh->quantizedNodes) return rayIntersectsWithWideBvh(bvh, ray, isect);
+
+	float t;
+	if (!rayIntersectsWithNodeBounds(&bvh->nodes[0], ray, isect->distance, &t)) return false;
+	struct bvhStackEntry stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = (struct bvhStackEntry){0, t};
+
+	bool hasHit = false;
+	while (stackSize > 0) {
+		struct bvhStackEntry entry = stack[--stackSize];
+		//Something closer may have been hit since this node was pushed
+		if (entry.t > isect->distance) continue;
+		const struct bvhNode *node = &bvh->nodes[entry.node];
+
+		if (node->primCount) {
+			if (rayIntersectsWithLeaf(bvh, node->index, node->primCount, ray, isect)) hasHit = true;
+			continue;
+		}
+
+		stackSize = pushBvhChildren(bvh, entry.node, ray, isect->distance, stack, stackSize);
+	}
+	if (hasHit) isect->didIntersect = true;
+	return hasHit;
+}
+
+bool rayOccludedByBvh(const struct bvh *bvh, const struct lightRay *ray, float maxDistance) {
+	if (!bvh || !bvh->nodeCount) return false;
+	if (bvh->wideNodes || bvh->quantizedNodes) return rayOccludedByWideBvh(bvh, ray, maxDistance);
+	float t;
+	if (!rayIntersectsWithNodeBounds(&bvh->nodes[0], ray, maxDistance, &t)) return false;
+	//Leaf tests only need the distance bound, the rest of the record is thrown away
+	struct hitRecord isect;
+	isect.distance = maxDistance;
+	struct bvhStackEntry stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = (struct bvhStackEntry){0, t};
+	while (stackSize > 0) {
+		int nodeIndex = stack[--stackSize].node;
+		const struct bvhNode *node = &bvh->nodes[nodeIndex];
+		if (node->primCount) {
+			if (rayIntersectsWithLeaf(bvh, node->index, node->primCount, ray, &isect)) return true;
+			continue;
+		}
+		stackSize = pushBvhChildren(bvh, nodeIndex, ray, maxDistance, stack, stackSize);
+	}
+	return false;
+}
+
+int pushBvhChildren(const struct bvh *bvh, int nodeIndex, const struct lightRay *ray, float maxDistance, struct bvhStackEntry *stack, int stackSize) {
+	int left = nodeIndex + 1;
+	int right = bvh->nodes[nodeIndex].index;
+	float tLeft, tRight;
+	bool hitLeft = rayIntersectsWithNodeBounds(&bvh->nodes[left], ray, maxDistance, &tLeft);
+	bool hitRight = rayIntersectsWithNodeBounds(&bvh->nodes[right], ray, maxDistance, &tRight);
+	if (hitLeft && hitRight) {
+		//Push the far child first, so the near one gets visited first
+		if (tLeft <= tRight) {
+			stack[stackSize++] = (struct bvhStackEntry){right, tRight};
+			stack[stackSize++] = (struct bvhStackEntry){left, tLeft};
+		} else {
+			stack[stackSize++] = (struct bvhStackEntry){left, tLeft};
+			stack[stackSize++] = (struct bvhStackEntry){right, tRight};
+		}
+	} else if (hitLeft) {
+		stack[stackSize++] = (struct bvhStackEntry){left, tLeft};
+	} else if (hitRight) {
+		stack[stackSize++] = (struct bvhStackEntry){right, tRight};
+	}
+	return stackSize;
+}
+
+void refitBvh(struct bvh *bvh) {
+	if (!bvh) return;
+	//Children always come after their parent, so walking backwards updates both children before the parent
+	for (int i = bvh->nodeCount - 1; i >= 0; --i) {
+		struct bvhNode *node = &bvh->nodes[i];
+		struct vector start, end;
+		if (node->primCount) {
+			start = vecWithPos(FLT_MAX, FLT_MAX, FLT_MAX);
+			end = vecWithPos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (int p = node->index; p < node->index + node->primCount; ++p) {
+				const struct poly *poly = &polygonArray[bvh->primIndices[p]];
+				for (int j = 0; j < 3; ++j) {
+					start = vecMin(start, vertexArray[poly->vertexIndex[j]]);
+					end = vecMax(end, vertexArray[poly->vertexIndex[j]]);
+				}
+			}
+		} else {
+			const struct bvhNode *left = &bvh->nodes[i + 1];
+			const struct bvhNode *right = &bvh->nodes[node->index];
+			start = vecMin(left->start, right->start);
+			end = vecMax(left->end, right->end);
+		}
+		node->start = start;
+		node->end = end;
+	}
+	//The wide nodes are cheap to collapse again from the refitted ones
+	if (bvh->wideNodes) {
+		buildWideBvh(bvh);
+	} else if (bvh->quantizedNodes) {
+		buildWideBvh(bvh);
+		quantizeWideBvh(bvh);
+	}
+	if (bvh->triangles) packBvhTriangles(bvh);
+}
+
+float bvhNodeSurfaceArea(const struct bvhNode *node) {
+	struct boundingBox bbox = {node->start, node->end, vecZero()};
+	return findSurfaceArea(&bbox);
+}
+
+float bvhSAHCost(const struct bvh *bvh) {
+	if (!bvh || !bvh->nodeCount) return 0.0f;
+	float rootArea = bvhNodeSurfaceArea(&bvh->nodes[0]);
+	if (rootArea <= 0.0f) return 0.0f;
+	float cost = 0.0f;
+	for (int i = 0; i < bvh->nodeCount; ++i) {
+		const struct bvhNode *node = &bvh->nodes[i];
+		float area = bvhNodeSurfaceArea(node);
+		cost += node->primCount ? BVH_INTERSECT_COST * node->primCount * area : BVH_TRAVERSAL_COST * area;
+	}
+	return cost / rootArea;
+}
+
+void addBvhMemory(const struct bvh *bvh, struct bvhMemory *memory) {
+	if (!bvh) return;
+	memory->nodes += bvh->nodeCount * sizeof(struct bvhNode);
+	memory->wideNodes += bvh->wideNodeCount * sizeof(struct wideBvhNode);
+	memory->quantizedNodes += bvh->quantizedNodeCount * sizeof(struct quantizedBvhNode);
+	memory->primIndices += bvh->primCount * sizeof(int);
+	memory->triangles += bvh->trianglePackCount * sizeof(struct packedTriangles);
+}
+
+int countNodes(const struct bvh *bvh) {
+	return bvh ? bvh->nodeCount : 0;
+}
+
+int checkTree(const struct bvh *bvh) {
+	int broken = 0;
+	if (!bvh) return broken;
+	for (int i = 0; i < bvh->nodeCount; ++i) {
+		const struct bvhNode *node = &bvh->nodes[i];
+		if (node->primCount == 0) {
+			//Interior node, the right child has to come after the left one
+			if (node->index <= i + 1 || node->index >= bvh->nodeCount) broken++;
+		} else {
+			if (node->index < 0 || node->index + node->primCount > bvh->primCount) broken++;
+		}
+	}
+	return broken;
+}
+
+void destroyBvh(struct bvh *bvh) {
+	if (bvh) {
+		if (bvh->wideNodes) cray_aligned_free(bvh->wideNodes);
+		if (bvh->quantizedNodes) cray_aligned_free(bvh->quantizedNodes);
+		if (bvh->triangles) cray_aligned_free(bvh->triangles);
+		if (bvh->mapping) {
+			unmapFile(bvh->mapping, bvh->mappingSize);
+		} else {
+			if (bvh->nodes) cray_aligned_free(bvh->nodes);
+			if (bvh->primIndices) free(bvh->primIndices);
+		}
+		free(bvh);
+	}
+}
@@ -0,0 +1,173 @@
+//
+//  bvh.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include "../datatypes/vector.h"
+
+struct lightRay;
+struct hitRecord;
+struct boundingBox;
+struct crMutex;
+
+/// A single node in a flattened bounding volume hierarchy. 32 bytes, so two nodes fit in a cache line.
+/// The left child of an interior node is always the next node in the array,
+/// so only the index of the right child is stored.
+struct bvhNode {
+	struct vector start, end; //Bounding box
+	int index;     //Interior: Index of the right child. Leaf: First index into primIndices
+	int primCount; //Amount of primitives in a leaf, 0 for interior nodes
+};
+
+//The builders limit depth to 64, and the fallback median splits can only add log2(N) on top of that
+#define BVH_STACK_SIZE 128
+
+/// Entry in a traversal stack
+struct bvhStackEntry {
+	int node;
+	float t; //Distance the ray enters the node at
+};
+
+/// Bounding volume hierarchy, stored as a flat array of nodes in depth-first order.
+/// Both the BVH and KD-tree builders produce this layout.
+struct bvh {
+	struct bvhNode *nodes; //Cache-line aligned
+	int nodeCount;
+	int *primIndices; //Indices to polygons, in leaf order
+	int primCount;
+	
+	float buildCost; //SAH cost when built, to see how much refitting has degraded the tree
+	
+	//Optional 4-wide version of nodes, used for traversal if set. See widebvh.h
+	struct wideBvhNode *wideNodes;
+	int wideNodeCount;
+	
+	//Optional quantized version of wideNodes, used for traversal instead if set
+	struct quantizedBvhNode *quantizedNodes;
+	int quantizedNodeCount;
+	
+	//Optional precomputed triangles in primIndices order, used for leaf tests if set. See packedtris.h
+	struct packedTriangles *triangles;
+	int trianglePackCount;
+	
+	//Set if nodes and primIndices point into a file mapped with mapFile()
+	void *mapping;
+	size_t mappingSize;
+};
+
+/// Amount of extra threads BVH builds may split subtrees onto. Can be shared between concurrent builds.
+struct bvhThreadBudget {
+	struct crMutex *lock;
+	int available;
+};
+
+/// Take a thread from a budget, if there is one available
+/// @param budget Budget to take from. May be NULL.
+/// @return true if a thread was taken, and should later be given back with returnBuildThread()
+bool takeBuildThread(struct bvhThreadBudget *budget);
+
+/// Give a thread back to a budget
+/// @param budget Budget to return the thread to. May be NULL.
+void returnBuildThread(struct bvhThreadBudget *budget);
+
+/// Builds a BVH for a given array of polygons, using binned SAH splits
+/// @param polygons Array of polygon indices to process
+/// @param count Amount of polygons given
+/// @param budget Extra threads large subtrees may be built on. NULL to only use the calling thread.
+struct bvh *buildBvh(const int *polygons, const int count, struct bvhThreadBudget *budget);
+
+/// Builds a BVH over arbitrary primitives, given as bounding boxes. midPoint is used as the centroid of each primitive.
+/// primIndices of the resulting BVH index into the given bboxes array.
+/// @param bboxes Bounding box for each primitive
+/// @param count Amount of primitives given
+/// @param budget Extra threads large subtrees may be built on. NULL to only use the calling thread.
+struct bvh *buildBvhFromBoundingBoxes(const struct boundingBox *bboxes, const int count, struct bvhThreadBudget *budget);
+
+/// Copy the nodes of a finished build into a tightly sized, cache-line aligned array owned by the given BVH
+/// @param bvh BVH to store the nodes in
+/// @param nodes Node array the builder worked with. This is freed.
+/// @param nodeCount Amount of nodes used
+void storeBvhNodes(struct bvh *bvh, struct bvhNode *nodes, int nodeCount);
+
+/// Check for an intersection between a ray and the bounds of a single node
+/// @param node Node to check
+/// @param ray Ray to intersect. Uses the precomputed inverse direction and sign bits.
+/// @param maxDistance Ignore intersections further than this, usually the closest hit so far
+/// @param t Distance the ray enters the node at, clamped to tmin of the ray
+bool rayIntersectsWithNodeBounds(const struct bvhNode *node, const struct lightRay *ray, float maxDistance, float *t);
+
+/// Push the children of an interior node hit by a ray to a traversal stack, so the nearer one gets popped first
+/// @param bvh BVH being traversed
+/// @param nodeIndex Interior node to process
+/// @param ray Ray being traversed
+/// @param maxDistance Children further away than this are skipped
+/// @param stack Traversal stack. Has to have room for two more entries.
+/// @param stackSize Current size of the stack
+/// @return New size of the stack
+int pushBvhChildren(const struct bvh *bvh, int nodeIndex, const struct lightRay *ray, float maxDistance, struct bvhStackEntry *stack, int stackSize);
+
+/// Intersect a ray with a range of polygons in a leaf
+/// @param bvh BVH the leaf belongs to
+/// @param first First index into primIndices
+/// @param count Amount of polygons in the leaf
+/// @param ray Ray to check intersection against
+/// @param isect Intersection information is saved to this struct
+bool rayIntersectsWithLeaf(const struct bvh *bvh, int first, int count, const struct lightRay *ray, struct hitRecord *isect);
+
+/// Traverses a given BVH to find the closest intersection between a ray and a polygon in it
+/// @param bvh BVH to traverse
+/// @param ray Ray to check intersection against
+/// @param isect Intersection information is saved to this struct
+bool rayIntersectsWithBvh(const struct bvh *bvh, const struct lightRay *ray, struct hitRecord *isect);
+
+/// Check if any polygon in a BVH blocks a ray before a given distance. Stops at the first one found, in any order.
+/// @param bvh BVH to traverse
+/// @param ray Ray to check, like a shadow ray towards a light
+/// @param maxDistance Distance along the ray to check up to
+bool rayOccludedByBvh(const struct bvh *bvh, const struct lightRay *ray, float maxDistance);
+
+/// Recompute the bounds of every node in a polygon BVH from the current vertex positions, keeping the tree topology.
+/// Much cheaper than a rebuild, but the tree gets worse the further the polygons move relative to each other.
+/// Compare bvhSAHCost() to buildCost to decide when to rebuild.
+/// @param bvh BVH to refit
+void refitBvh(struct bvh *bvh);
+
+/// Compute the surface area of the bounds of a node
+/// @param node Node to compute the surface area for
+float bvhNodeSurfaceArea(const struct bvhNode *node);
+
+/// Compute the SAH cost of a given BVH, relative to the surface area of the root node
+/// @param bvh BVH to evaluate
+float bvhSAHCost(const struct bvh *bvh);
+
+/// Bytes used by each part of one or more BVHs
+struct bvhMemory {
+	size_t nodes;
+	size_t wideNodes;
+	size_t quantizedNodes;
+	size_t primIndices;
+	size_t triangles;
+};
+
+/// Add the memory used by a given BVH to a running total
+/// @param bvh BVH to measure
+/// @param memory Total to add to
+void addBvhMemory(const struct bvh *bvh, struct bvhMemory *memory);
+
+/// Count total nodes in a given tree
+/// @param bvh Tree to evaluate
+int countNodes(const struct bvh *bvh);
+
+/// Check the health of a given tree
+/// @param bvh Tree to evaluate
+/// @return Amount of nodes with an invalid child index or polygon range
+int checkTree(const struct bvh *bvh);
+
+/// Free a given BVH
+/// @param bvh BVH to free
+void destroyBvh(struct bvh *bvh);
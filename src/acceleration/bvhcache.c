@@ -0,0 +1,175 @@
+//
+//  bvhcache.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "bvhcache.h"
+#include "bvh.h"
+
+#include "../datatypes/mesh.h"
+#include "../datatypes/poly.h"
+#include "../datatypes/vertexbuffer.h"
+#include "../renderer/renderer.h"
+#include "../utils/filehandler.h"
+#include "../utils/logging.h"
+
+#ifdef WINDOWS
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+//Bump this whenever a builder or the node layout changes, so stale files get rebuilt
+#define BVH_CACHE_VERSION 1
+#define BVH_CACHE_MAGIC "CRAYBVH"
+
+//Padded to 64 bytes, so the nodes following it stay cache-line aligned when mapped
+struct bvhCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t nodeSize;
+	uint64_t key;
+	int32_t nodeCount;
+	int32_t primCount;
+	char padding[32];
+};
+
+//FNV-1a
+uint64_t hashBytes(uint64_t hash, const void *data, size_t bytes) {
+	const unsigned char *bytePtr = data;
+	for (size_t i = 0; i < bytes; ++i) {
+		hash ^= bytePtr[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+uint64_t bvhCacheKey(const struct mesh *mesh, const struct prefs *prefs) {
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	//primIndices are absolute polygonArray indices, so the range has to match too
+	int32_t params[4] = {BVH_CACHE_VERSION, mesh->accelerator, mesh->firstPolyIndex, mesh->polyCount};
+	hash = hashBytes(hash, params, sizeof(params));
+	if (mesh->accelerator == acceleratorSbvh) {
+		hash = hashBytes(hash, &prefs->spatialSplitBudget, sizeof(prefs->spatialSplitBudget));
+	}
+	if (mesh->accelerator == acceleratorLbvh) {
+		hash = hashBytes(hash, &prefs->treeletOptimization, sizeof(prefs->treeletOptimization));
+	}
+	for (int i = mesh->firstPolyIndex; i < mesh->firstPolyIndex + mesh->polyCount; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			hash = hashBytes(hash, &vertexArray[polygonArray[i].vertexIndex[j]], sizeof(struct vector));
+		}
+	}
+	return hash;
+}
+
+char *bvhCacheFilePath(const char *directory, uint64_t key) {
+	size_t length = strlen(directory);
+	bool needsSlash = length && directory[length - 1] != '/' && directory[length - 1] != '\\';
+	char *path = malloc(length + 32);
+	sprintf(path, "%s%s%016llx.bvh", directory, needsSlash ? "/" : "", (unsigned long long)key);
+	return path;
+}
+
+size_t bvhCacheFileSize(int nodeCount, int primCount) {
+	return sizeof(struct bvhCacheHeader) + nodeCount * sizeof(struct bvhNode) + primCount * sizeof(int);
+}
+
+//A corrupt file of the right size would otherwise send traversal out of bounds
+bool cachedBvhIsValid(const struct bvh *bvh, const struct mesh *mesh) {
+	if (checkTree(bvh)) return false;
+	for (int i = 0; i < bvh->nodeCount; ++i) {
+		if (bvh->nodes[i].primCount < 0) return false;
+	}
+	for (int i = 0; i < bvh->primCount; ++i) {
+		int index = bvh->primIndices[i];
+		if (index < mesh->firstPolyIndex || index >= mesh->firstPolyIndex + mesh->polyCount) return false;
+	}
+	return true;
+}
+
+struct bvh *loadCachedBvh(const char *directory, uint64_t key, const struct mesh *mesh) {
+	char *path = bvhCacheFilePath(directory, key);
+	size_t bytes = 0;
+	unsigned char *data = mapFile(path, &bytes);
+	if (!data) {
+		free(path);
+		return NULL;
+	}
+	
+	const struct bvhCacheHeader *header = (const struct bvhCacheHeader *)data;
+	if (bytes < sizeof(*header) ||
+		memcmp(header->magic, BVH_CACHE_MAGIC, sizeof(header->magic)) ||
+		header->version != BVH_CACHE_VERSION ||
+		header->nodeSize != sizeof(struct bvhNode) ||
+		header->key != key ||
+		header->primCount < mesh->polyCount ||
+		header->nodeCount < 1 ||
+		bytes != bvhCacheFileSize(header->nodeCount, header->primCount)) {
+		logr(warning, "Ignoring invalid BVH cache file %s\n", path);
+		unmapFile(data, bytes);
+		free(path);
+		return NULL;
+	}
+	
+	struct bvh *bvh = calloc(1, sizeof(struct bvh));
+	bvh->nodes = (struct bvhNode *)(data + sizeof(*header));
+	bvh->nodeCount = header->nodeCount;
+	bvh->primIndices = (int *)(data + sizeof(*header) + header->nodeCount * sizeof(struct bvhNode));
+	bvh->primCount = header->primCount;
+	bvh->mapping = data;
+	bvh->mappingSize = bytes;
+	if (!cachedBvhIsValid(bvh, mesh)) {
+		logr(warning, "Ignoring invalid BVH cache file %s\n", path);
+		//Frees the mapping too
+		destroyBvh(bvh);
+		free(path);
+		return NULL;
+	}
+	free(path);
+	bvh->buildCost = bvhSAHCost(bvh);
+	return bvh;
+}
+
+bool saveCachedBvh(const char *directory, uint64_t key, const struct bvh *bvh) {
+	if (!bvh->nodeCount) return false;
+	struct bvhCacheHeader header = {
+		.magic = BVH_CACHE_MAGIC,
+		.version = BVH_CACHE_VERSION,
+		.nodeSize = sizeof(struct bvhNode),
+		.key = key,
+		.nodeCount = bvh->nodeCount,
+		.primCount = bvh->primCount
+	};
+	
+	//Write to a temporary file first, so other processes never map a partially written one
+	char *path = bvhCacheFilePath(directory, key);
+	char *tempPath = malloc(strlen(path) + 32);
+	sprintf(tempPath, "%s.%i.tmp", path, (int)getpid());
+	FILE *f = fopen(tempPath, "wb");
+	if (!f) {
+		logr(warning, "Failed to write BVH cache file %s\n", tempPath);
+		free(tempPath);
+		free(path);
+		return false;
+	}
+	bool success = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(bvh->nodes, sizeof(struct bvhNode), bvh->nodeCount, f) == (size_t)bvh->nodeCount &&
+		fwrite(bvh->primIndices, sizeof(int), bvh->primCount, f) == (size_t)bvh->primCount;
+	success = fclose(f) == 0 && success;
+	if (success) {
+		//On Windows rename fails if the file exists, which just means someone else already cached it
+		rename(tempPath, path);
+	} else {
+		logr(warning, "Failed to write BVH cache file %s\n", tempPath);
+	}
+	remove(tempPath);
+	free(tempPath);
+	free(path);
+	return success;
+}
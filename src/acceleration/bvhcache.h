@@ -0,0 +1,41 @@
+//
+//  bvhcache.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+struct bvh;
+struct mesh;
+struct prefs;
+
+/*
+ Built mesh BVHs can be cached on disk, so repeated renders of the same geometry skip the build.
+ Cache files are named after a hash of the transformed polygons of a mesh, and are mapped
+ straight into memory when loaded.
+ */
+
+/// Compute the cache key for the acceleration structure of a mesh.
+/// Covers the transformed vertices of every polygon, the polygon range and the builder used.
+/// @param mesh Mesh to compute the key for. Transforms have to be applied first.
+/// @param prefs Prefs the acceleration structure is going to be built with
+uint64_t bvhCacheKey(const struct mesh *mesh, const struct prefs *prefs);
+
+/// Load a cached BVH
+/// @param directory Cache directory
+/// @param key Cache key, see bvhCacheKey()
+/// @param mesh Mesh the BVH is for. Every node and polygon index in the file has to fall within it.
+/// @return Mapped BVH, or NULL if there is no valid cache file for the given key
+struct bvh *loadCachedBvh(const char *directory, uint64_t key, const struct mesh *mesh);
+
+/// Write a BVH to the cache
+/// @param directory Cache directory. Has to exist.
+/// @param key Cache key, see bvhCacheKey()
+/// @param bvh BVH to write
+/// @return true if the file was written
+bool saveCachedBvh(const char *directory, uint64_t key, const struct bvh *bvh);
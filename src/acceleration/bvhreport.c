@@ -0,0 +1,125 @@
+//
+//  bvhreport.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "bvhreport.h"
+#include "bbox.h"
+
+#include "../libraries/cJSON.h"
+#include "../utils/logging.h"
+
+struct reportEntry {
+	int node;
+	int depth;
+};
+
+struct bvhReport reportBvh(const struct bvh *bvh) {
+	struct bvhReport report = {0};
+	if (!bvh || !bvh->nodeCount) return report;
+	report.nodeCount = bvh->nodeCount;
+	report.primCount = bvh->primCount;
+	report.brokenCount = checkTree(bvh);
+	report.sahCost = bvhSAHCost(bvh);
+	report.buildCost = bvh->buildCost;
+	addBvhMemory(bvh, &report.memory);
+	
+	//Walk down from the root with a heap stack, since a broken tree can be arbitrarily deep.
+	//Children always come after their parent, so a node can't be pushed twice unless the tree is broken.
+	bool *reached = calloc(bvh->nodeCount, sizeof(bool));
+	struct reportEntry *stack = malloc(bvh->nodeCount * sizeof(struct reportEntry));
+	int stackSize = 0;
+	stack[stackSize++] = (struct reportEntry){0, 0};
+	reached[0] = true;
+	long depthSum = 0;
+	while (stackSize > 0) {
+		struct reportEntry entry = stack[--stackSize];
+		const struct bvhNode *node = &bvh->nodes[entry.node];
+		struct boundingBox bounds = {node->start, node->end, vecZero()};
+		if (isEmptyBoundingBox(&bounds)) report.emptyCount++;
+		report.maxDepth = max(report.maxDepth, entry.depth);
+		if (node->primCount) {
+			report.leafCount++;
+			report.leafDepths[min(entry.depth, BVH_STACK_SIZE)]++;
+			report.leafSizes[min(node->primCount, BVH_REPORT_LEAF_SIZES) - 1]++;
+			depthSum += entry.depth;
+			continue;
+		}
+		int children[2] = {entry.node + 1, node->index};
+		for (int i = 0; i < 2; ++i) {
+			//checkTree() already counted bad indices, just don't follow them
+			if (children[i] <= entry.node || children[i] >= bvh->nodeCount || reached[children[i]]) continue;
+			reached[children[i]] = true;
+			stack[stackSize++] = (struct reportEntry){children[i], entry.depth + 1};
+		}
+	}
+	for (int i = 0; i < bvh->nodeCount; ++i) {
+		if (!reached[i]) report.orphanCount++;
+	}
+	report.meanLeafDepth = report.leafCount ? (float)depthSum / report.leafCount : 0.0f;
+	free(reached);
+	free(stack);
+	return report;
+}
+
+size_t totalBvhMemory(const struct bvhMemory *memory) {
+	return memory->nodes + memory->wideNodes + memory->quantizedNodes + memory->primIndices + memory->triangles;
+}
+
+//Appends "key: count" pairs of the non-zero entries of a histogram, starting from firstKey
+void formatHistogram(char *buf, size_t size, const int *counts, int countCount, int firstKey, bool lastIsOpen) {
+	size_t length = 0;
+	buf[0] = '\0';
+	for (int i = 0; i < countCount && length < size; ++i) {
+		if (!counts[i]) continue;
+		bool open = lastIsOpen && i == countCount - 1;
+		length += snprintf(buf + length, size - length, "%s%i%s: %i", length ? ", " : "", firstKey + i, open ? "+" : "", counts[i]);
+	}
+}
+
+void logBvhReport(const struct bvhReport *report, const char *name, const char *accelerator) {
+	logr(info, "%s: %s, %i nodes, %i leaves, %i references, SAH cost %.2f (%.2f when built), %.2fMB\n", name, accelerator,
+		 report->nodeCount, report->leafCount, report->primCount, report->sahCost, report->buildCost, totalBvhMemory(&report->memory) / 1000000.0f);
+	char buf[2048];
+	formatHistogram(buf, sizeof(buf), report->leafDepths, min(report->maxDepth + 1, BVH_STACK_SIZE + 1), 0, report->maxDepth >= BVH_STACK_SIZE);
+	logr(info, "Leaf depths (max %i, mean %.1f): %s\n", report->maxDepth, report->meanLeafDepth, buf);
+	formatHistogram(buf, sizeof(buf), report->leafSizes, BVH_REPORT_LEAF_SIZES, 1, true);
+	logr(info, "Leaf sizes (mean %.1f): %s\n", report->leafCount ? (float)report->primCount / report->leafCount : 0.0f, buf);
+	if (report->orphanCount || report->emptyCount || report->brokenCount) {
+		logr(warning, "%s has %i orphaned, %i empty and %i broken nodes\n", name, report->orphanCount, report->emptyCount, report->brokenCount);
+	}
+	if (report->maxDepth >= BVH_STACK_SIZE) {
+		logr(warning, "%s is deeper than traversal supports (%i > %i)\n", name, report->maxDepth, BVH_STACK_SIZE - 1);
+	}
+}
+
+struct cJSON *bvhReportToJSON(const struct bvhReport *report, const char *name, const char *accelerator) {
+	cJSON *json = cJSON_CreateObject();
+	cJSON_AddStringToObject(json, "name", name);
+	cJSON_AddStringToObject(json, "accelerator", accelerator);
+	cJSON_AddNumberToObject(json, "nodes", report->nodeCount);
+	cJSON_AddNumberToObject(json, "leaves", report->leafCount);
+	cJSON_AddNumberToObject(json, "references", report->primCount);
+	cJSON_AddNumberToObject(json, "maxDepth", report->maxDepth);
+	cJSON_AddNumberToObject(json, "meanLeafDepth", report->meanLeafDepth);
+	cJSON_AddItemToObject(json, "leafDepths", cJSON_CreateIntArray(report->leafDepths, min(report->maxDepth + 1, BVH_STACK_SIZE + 1)));
+	cJSON_AddItemToObject(json, "leafSizes", cJSON_CreateIntArray(report->leafSizes, BVH_REPORT_LEAF_SIZES));
+	cJSON_AddNumberToObject(json, "orphans", report->orphanCount);
+	cJSON_AddNumberToObject(json, "empty", report->emptyCount);
+	cJSON_AddNumberToObject(json, "broken", report->brokenCount);
+	cJSON_AddNumberToObject(json, "sahCost", report->sahCost);
+	cJSON_AddNumberToObject(json, "buildCost", report->buildCost);
+	cJSON *bytes = cJSON_CreateObject();
+	cJSON_AddNumberToObject(bytes, "nodes", report->memory.nodes);
+	cJSON_AddNumberToObject(bytes, "wideNodes", report->memory.wideNodes);
+	cJSON_AddNumberToObject(bytes, "quantizedNodes", report->memory.quantizedNodes);
+	cJSON_AddNumberToObject(bytes, "primIndices", report->memory.primIndices);
+	cJSON_AddNumberToObject(bytes, "triangles", report->memory.triangles);
+	cJSON_AddNumberToObject(bytes, "total", totalBvhMemory(&report->memory));
+	cJSON_AddItemToObject(json, "bytes", bytes);
+	return json;
+}
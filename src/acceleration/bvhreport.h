@@ -0,0 +1,50 @@
+//
+//  bvhreport.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include "bvh.h"
+
+//Leaf sizes 1 to 16 are counted one by one, larger leaves all go to the last bucket
+#define BVH_REPORT_LEAF_SIZES 17
+
+struct cJSON;
+
+/// Shape and health of a BVH, to catch a degenerate tree before rendering with it
+struct bvhReport {
+	int nodeCount;
+	int leafCount;
+	int primCount;
+	int maxDepth;
+	float meanLeafDepth;
+	int leafDepths[BVH_STACK_SIZE + 1]; //Leaves at each depth, the last entry counts anything deeper
+	int leafSizes[BVH_REPORT_LEAF_SIZES]; //Leaves with 1 to 16 primitives, and then the rest
+	int orphanCount; //Nodes that can't be reached from the root
+	int emptyCount; //Reachable nodes with inverted bounds, which no ray can hit
+	int brokenCount; //Nodes with an invalid child index or primitive range, see checkTree()
+	float sahCost;
+	float buildCost;
+	struct bvhMemory memory;
+};
+
+/// Walk a BVH and gather its report
+/// @param bvh BVH to inspect
+struct bvhReport reportBvh(const struct bvh *bvh);
+
+/// Log a report, warning about orphaned, empty or broken nodes
+/// @param report Report to log
+/// @param name Name to log the report under
+/// @param accelerator Name of the builder that produced the BVH
+void logBvhReport(const struct bvhReport *report, const char *name, const char *accelerator);
+
+/// Convert a report to JSON, with the same fields as struct bvhReport
+/// @param report Report to convert
+/// @param name Name to store in the object
+/// @param accelerator Name of the builder that produced the BVH
+/// @return New cJSON object, owned by the caller
+struct cJSON *bvhReportToJSON(const struct bvhReport *report, const char *name, const char *accelerator);
@@ -9,8 +9,8 @@
 #include "../includes.h"
 #include "kdtree.h"
 #include "bbox.h"
+#include "bvh.h"
 
-#include "../renderer/pathtrace.h"
 #include "../datatypes/vertexbuffer.h"
 #include "../datatypes/poly.h"
 
@@ -26,194 +26,91 @@
  3. For each tri in the node, check if for the current axis, it is less than or greater than the overall midpoint
  If less, push to left child
  if greater, push to right child
+ The polygon index array is partitioned in place, so each node just references a range of it.
  */
 
-struct Array {
-	int *array;
-	size_t used;
-	size_t size;
-};
-
-void initArray(struct Array *a, size_t initialSize) {
-	a->array = malloc(initialSize * sizeof(int));
-	a->used = 0;
-	a->size = initialSize;
-}
-
-void insertArray(struct Array *a, int element) {
-	// a->used is the number of used entries, because a->array[a->used++] updates a->used only *after* the array has been accessed.
-	// Therefore a->used can go up to a->size
-	if (a->used == a->size) {
-		a->size *= 2;
-		a->array = realloc(a->array, a->size * sizeof(int));
-	}
-	a->array[a->used++] = element;
-}
-
-void freeArray(struct Array *a) {
-	free(a->array);
-	a->array = NULL;
-	a->used = a->size = 0;
-}
+//Traversal uses a fixed size stack, see BVH_STACK_SIZE
+#define KD_MAX_DEPTH 64
 
-struct kdTreeNode *getNewNode() {
-	struct kdTreeNode *node = calloc(1, sizeof(struct kdTreeNode));
-	node->bbox = NULL;
-	node->left = NULL;
-	node->right = NULL;
-	node->polygons = NULL;
-	node->polyCount = 0;
-	return node;
-}
+struct kdTreeBuilder {
+	int *polygons; //Partitioned in place while building
+	struct bvhNode *nodes;
+	int nodeCount;
+};
 
-struct kdTreeNode *buildTree(int *polygons, const int polyCount) {
-	struct kdTreeNode *node = getNewNode();
-	node->polygons = polygons;
-	node->polyCount = polyCount;
+void buildTreeNode(struct kdTreeBuilder *b, int nodeIndex, int begin, int end, const struct boundingBox *bbox, int depth) {
+	struct bvhNode *node = &b->nodes[nodeIndex];
+	node->start = bbox->start;
+	node->end = bbox->end;
+	//Every node starts out as a leaf, and is turned into an interior node if splitting it pays off
+	node->index = begin;
+	node->primCount = end - begin;
 	
-	if (polyCount == 0)
-		return node;
-	if (polyCount == 1) {
-		node->bbox = computeBoundingBox(&node->polygons[0], 1);
-		node->left = NULL;
-		node->right = NULL;
-		return node;
-	}
-	
-	node->bbox = computeBoundingBox(node->polygons, node->polyCount);
-	float currentSAHCost = node->polyCount * findSurfaceArea(node->bbox);
-	
-	struct vector midPoint = node->bbox->midPoint;
-	
-	struct Array leftPolys;
-	initArray(&leftPolys, 5);
-	struct Array rightPolys;
-	initArray(&rightPolys, 5);
+	int polyCount = end - begin;
+	if (polyCount <= 1 || depth >= KD_MAX_DEPTH)
+		return;
 	
-	enum bboxAxis axis = getLongestAxis(node->bbox);
+	float currentSAHCost = polyCount * findSurfaceArea(bbox);
+	enum bboxAxis axis = getLongestAxis(bbox);
+	float midPoint = vecAxis(bbox->midPoint, axis);
 	
-	for (int i = 0; i < node->polyCount; ++i) {
-		struct vector polyMidPoint = getMidPoint(vertexArray[polygonArray[node->polygons[i]].vertexIndex[0]],
-									   vertexArray[polygonArray[node->polygons[i]].vertexIndex[1]],
-									   vertexArray[polygonArray[node->polygons[i]].vertexIndex[2]]);
-		
-		if (((axis == X) && (midPoint.x >= polyMidPoint.x)) ||
-			((axis == Y) && (midPoint.y >= polyMidPoint.y)) ||
-			((axis == Z) && (midPoint.z >= polyMidPoint.z))) {
-			insertArray(&rightPolys, node->polygons[i]);
+	//Polygons at or below the midpoint go to the left child, the rest to the right child
+	int i = begin;
+	int j = end - 1;
+	while (i <= j) {
+		struct vector polyMidPoint = getMidPoint(vertexArray[polygonArray[b->polygons[i]].vertexIndex[0]],
+												 vertexArray[polygonArray[b->polygons[i]].vertexIndex[1]],
+												 vertexArray[polygonArray[b->polygons[i]].vertexIndex[2]]);
+		if (vecAxis(polyMidPoint, axis) <= midPoint) {
+			i++;
 		} else {
-			insertArray(&leftPolys, node->polygons[i]);
+			int temp = b->polygons[i];
+			b->polygons[i] = b->polygons[j];
+			b->polygons[j--] = temp;
 		}
 	}
+	int mid = i;
 	
-	bool rightFreed = false;
-	bool leftFreed = false;
-	if (leftPolys.used == 0 && rightPolys.used > 0) {
-		freeArray(&leftPolys);
-		leftPolys = rightPolys;
-		leftFreed = true;
-	}
-	if (rightPolys.used == 0 && leftPolys.used > 0) {
-		freeArray(&rightPolys);
-		rightPolys = leftPolys;
-		rightFreed = true;
-	}
+	//Everything ended up on one side, splitting won't help
+	if (mid == begin || mid == end)
+		return;
 	
-	struct boundingBox *leftBBox = computeBoundingBox(leftPolys.array, (int)leftPolys.used);
-	struct boundingBox *rightBBox = computeBoundingBox(rightPolys.array, (int)rightPolys.used);
+	struct boundingBox leftBBox = computeBoundingBox(&b->polygons[begin], mid - begin);
+	struct boundingBox rightBBox = computeBoundingBox(&b->polygons[mid], end - mid);
 	
-	float leftSAHCost = leftPolys.used * findSurfaceArea(leftBBox);
-	float rightSAHCost = rightPolys.used * findSurfaceArea(rightBBox);
-	
-	free(leftBBox);
-	free(rightBBox);
+	float leftSAHCost = (mid - begin) * findSurfaceArea(&leftBBox);
+	float rightSAHCost = (end - mid) * findSurfaceArea(&rightBBox);
 	
 	if ((leftSAHCost + rightSAHCost) > currentSAHCost) {
 		//Stop here
-		node->left = NULL;
-		node->right = NULL;
-		if (leftPolys.used > 0 && !leftFreed) freeArray(&leftPolys);
-		if (rightPolys.used > 0 && !rightFreed) freeArray(&rightPolys);
-	} else {
-		//Keep going
-		node->left = buildTree(leftPolys.array, (int)leftPolys.used);
-		node->right = buildTree(rightPolys.array, (int)rightPolys.used);
+		return;
 	}
 	
-	return node;
+	//Keep going. The left child always goes right after its parent
+	node->primCount = 0;
+	int left = b->nodeCount++;
+	buildTreeNode(b, left, begin, mid, &leftBBox, depth + 1);
+	int right = b->nodeCount++;
+	buildTreeNode(b, right, mid, end, &rightBBox, depth + 1);
+	node->index = right;
 }
 
-//Recurse through tree and count orphan nodes with no polygons
-int checkTree(const struct kdTreeNode *node) {
-	int orphans = 0;
-	if (node) {
-		if (node->polyCount == 0) {
-			orphans += 1;
-		}
-		if (node->left) {
-			orphans += checkTree(node->left);
-		}
-		if (node->right) {
-			orphans += checkTree(node->right);
-		}
-	}
-	return orphans;
-}
-
-int countNodes(const struct kdTreeNode *node) {
-	int nodes = 0;
-	if (node) {
-		if (node->left) {
-			nodes += countNodes(node->left);
-		}
-		if (node->right) {
-			nodes += countNodes(node->right);
-		}
-		nodes += 1;
-	}
-	return nodes;
-}
-
-bool rayIntersectsWithNode(const struct kdTreeNode *node, const struct lightRay *ray, struct hitRecord *isect) {
-	if (!node) return false;
-	//A bit of a hack, but it does work...!
-	float fakeIsect = 20000.0;
-	if (rayIntersectWithAABB(node->bbox, ray, &fakeIsect)) {
-		bool hasHit = false;
-		
-		if (node->left != NULL || node->right != NULL) {
-			//Recurse down both sides
-			bool hitLeft  = rayIntersectsWithNode(node->left, ray, isect);
-			bool hitRight = rayIntersectsWithNode(node->right, ray, isect);
-			
-			return hitLeft || hitRight;
-		} else {
-			//This is a leaf, so check all polys
-			for (int i = 0; i < node->polyCount; ++i) {
-				struct poly p = polygonArray[node->polygons[i]];
-				if (rayIntersectsWithPolygon(ray, &p, &isect->distance, &isect->surfaceNormal, &isect->uv)) {
-					hasHit = true;
-					isect->type = hitTypePolygon;
-					isect->polyIndex = p.polyIndex;
-				}
-			}
-			if (hasHit) {
-				isect->didIntersect = true;
-				return true;
-			} else {
-				return false;
-			}
-		}
-	}
-	return false;
-}
-
-void destroyTree(struct kdTreeNode *node) {
-	if (node) {
-		destroyTree(node->left);
-		destroyTree(node->right);
-		if (node->bbox) free(node->bbox);
-		if (node->polygons) free(node->polygons);
-		free(node);
-	}
+struct bvh *buildTree(int *polygons, const int polyCount) {
+	struct bvh *tree = calloc(1, sizeof(struct bvh));
+	tree->primIndices = polygons;
+	tree->primCount = polyCount;
+	if (polyCount == 0)
+		return tree;
+	
+	//Both halves of a split always have polygons, so there are never more than 2N - 1 nodes
+	struct kdTreeBuilder builder = {
+		.polygons = polygons,
+		.nodes = malloc((2 * polyCount - 1) * sizeof(struct bvhNode)),
+		.nodeCount = 1
+	};
+	struct boundingBox rootBBox = computeBoundingBox(polygons, polyCount);
+	buildTreeNode(&builder, 0, 0, polyCount, &rootBBox, 0);
+	storeBvhNodes(tree, builder.nodes, builder.nodeCount);
+	tree->buildCost = bvhSAHCost(tree);
+	return tree;
 }
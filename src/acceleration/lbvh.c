@@ -0,0 +1,456 @@
+//
+//  lbvh.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "lbvh.h"
+#include "bvh.h"
+#include "bbox.h"
+
+#include "../utils/logging.h"
+#include "../utils/multiplatform.h"
+
+/*
+ Linear BVH builder
+ 1. Compute a 63-bit Morton code for the centroid of each polygon, quantized to the centroid bounds
+ 2. Sort the polygons by their codes with a radix sort, split over threads for large meshes
+ 3. Emit the hierarchy top-down. Each node splits its range at the highest bit where the codes differ,
+    found with a binary search since the codes are sorted. This takes no SAH evaluation at all.
+ 4. Optionally restructure treelets of up to seven leaves bottom-up, picking the topology with the lowest
+    SAH cost for each. This is the treelet restructuring approach by Karras and Aila.
+ Every primitive starts out in its own leaf. The tree is built with explicit child indices so treelets can be
+ moved around, and flattened at the end, collapsing small subtrees into leaves wherever that lowers the SAH cost.
+ */
+
+#define LBVH_MAX_LEAF_SIZE 1
+#define LBVH_MAX_COLLAPSED_LEAF_SIZE 8
+#define LBVH_PARALLEL_THRESHOLD 65536
+#define LBVH_PARALLEL_SUBTREE_SIZE 4096
+#define LBVH_MAX_SORT_THREADS 16
+#define LBVH_RADIX_BITS 8
+#define LBVH_RADIX_BUCKETS (1 << LBVH_RADIX_BITS)
+#define LBVH_TREELET_SIZE 7
+#define LBVH_TREELET_SUBSETS (1 << LBVH_TREELET_SIZE)
+#define LBVH_TREELET_PASSES 2
+#define LBVH_TRAVERSAL_COST 1.0f
+#define LBVH_INTERSECT_COST 1.0f
+
+struct mortonPrim {
+	uint64_t code;
+	int prim; //Index into the polygons given to the builder
+};
+
+struct lbvhNode {
+	struct boundingBox bbox;
+	int left, right; //-1 for leaves
+	int first, count; //Leaves: range of sorted primitives
+	int primCount; //Primitives in the subtree
+	float cost; //SAH cost of the subtree
+};
+
+struct lbvhBuilder {
+	const struct mortonPrim *prims;
+	const struct boundingBox *bboxes;
+	struct lbvhNode *nodes;
+	int nodeCount;
+	struct bvhThreadBudget *budget; //NULL to build on the calling thread only
+};
+
+struct lbvhTask {
+	struct lbvhBuilder *b;
+	int index;
+};
+
+struct radixTask {
+	const struct mortonPrim *src;
+	struct mortonPrim *dst;
+	int begin, end;
+	int shift;
+	int counts[LBVH_RADIX_BUCKETS]; //Histogram of this chunk, then turned into its scatter offsets
+	bool scatter;
+};
+
+//Spread the lowest 21 bits out so there are two zero bits between each of them
+uint64_t expandBits(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | v << 32) & UINT64_C(0x1f00000000ffff);
+	v = (v | v << 16) & UINT64_C(0x1f0000ff0000ff);
+	v = (v | v << 8) & UINT64_C(0x100f00f00f00f00f);
+	v = (v | v << 4) & UINT64_C(0x10c30c30c30c30c3);
+	v = (v | v << 2) & UINT64_C(0x1249249249249249);
+	return v;
+}
+
+uint64_t quantizeAxis(float value) {
+	return (uint64_t)min(max(value * 2097151.0f, 0.0f), 2097151.0f);
+}
+
+//Position should be normalized to [0, 1] within the centroid bounds
+uint64_t mortonCode(struct vector position) {
+	return expandBits(quantizeAxis(position.x)) << 2 | expandBits(quantizeAxis(position.y)) << 1 | expandBits(quantizeAxis(position.z));
+}
+
+void *radixTaskThread(void *arg) {
+	struct crThread *thread = (struct crThread *)arg;
+	struct radixTask *task = (struct radixTask *)thread->userData;
+	if (task->scatter) {
+		for (int i = task->begin; i < task->end; ++i) {
+			int bucket = (task->src[i].code >> task->shift) & (LBVH_RADIX_BUCKETS - 1);
+			task->dst[task->counts[bucket]++] = task->src[i];
+		}
+	} else {
+		memset(task->counts, 0, sizeof(task->counts));
+		for (int i = task->begin; i < task->end; ++i) {
+			task->counts[(task->src[i].code >> task->shift) & (LBVH_RADIX_BUCKETS - 1)]++;
+		}
+	}
+	return NULL;
+}
+
+void runRadixTasks(struct radixTask *tasks, int taskCount) {
+	struct crThread threads[LBVH_MAX_SORT_THREADS];
+	bool spawned[LBVH_MAX_SORT_THREADS];
+	for (int t = 0; t < taskCount; ++t) {
+		threads[t] = (struct crThread){.threadFunc = radixTaskThread, .userData = &tasks[t]};
+		//The first chunk is always done on the calling thread
+		spawned[t] = t > 0 && !spawnThread(&threads[t]);
+	}
+	for (int t = 0; t < taskCount; ++t) {
+		if (!spawned[t]) radixTaskThread(&threads[t]);
+	}
+	for (int t = 1; t < taskCount; ++t) {
+		if (spawned[t]) checkThread(&threads[t]);
+	}
+}
+
+//Least significant digit first, so every pass has to be stable
+void sortMortonPrims(struct mortonPrim *prims, int count, struct bvhThreadBudget *budget) {
+	int threadCount = 1;
+	if (count >= LBVH_PARALLEL_THRESHOLD) {
+		while (threadCount < LBVH_MAX_SORT_THREADS && takeBuildThread(budget)) threadCount++;
+	}
+	struct mortonPrim *src = prims;
+	struct mortonPrim *dst = malloc(count * sizeof(struct mortonPrim));
+	struct mortonPrim *temp = dst;
+	struct radixTask tasks[LBVH_MAX_SORT_THREADS];
+	int chunkSize = (count + threadCount - 1) / threadCount;
+
+	for (int shift = 0; shift < 64; shift += LBVH_RADIX_BITS) {
+		for (int t = 0; t < threadCount; ++t) {
+			int begin = min(t * chunkSize, count);
+			tasks[t] = (struct radixTask){src, dst, begin, min(begin + chunkSize, count), shift, {0}, false};
+		}
+		runRadixTasks(tasks, threadCount);
+
+		//Buckets go in order, and chunks go in order within each bucket
+		int offset = 0;
+		bool sorted = false;
+		for (int bucket = 0; bucket < LBVH_RADIX_BUCKETS; ++bucket) {
+			int bucketStart = offset;
+			for (int t = 0; t < threadCount; ++t) {
+				int bucketCount = tasks[t].counts[bucket];
+				tasks[t].counts[bucket] = offset;
+				offset += bucketCount;
+			}
+			//Everything has the same digit, so this pass wouldn't move anything
+			if (offset - bucketStart == count) sorted = true;
+		}
+		if (sorted) continue;
+
+		for (int t = 0; t < threadCount; ++t) {
+			tasks[t].scatter = true;
+		}
+		runRadixTasks(tasks, threadCount);
+		struct mortonPrim *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != prims) memcpy(prims, src, count * sizeof(struct mortonPrim));
+	free(temp);
+	for (int t = 1; t < threadCount; ++t) {
+		returnBuildThread(budget);
+	}
+}
+
+//Returns the first index of the right half
+int findMortonSplit(const struct mortonPrim *prims, int begin, int end) {
+	uint64_t first = prims[begin].code;
+	uint64_t last = prims[end - 1].code;
+	//Duplicate codes, just split in the middle
+	if (first == last) return begin + (end - begin) / 2;
+
+	//The codes in the range share everything above the highest differing bit,
+	//so the ones with that bit cleared come first
+	uint64_t bit = first ^ last;
+	while (bit & (bit - 1)) bit &= bit - 1;
+	int low = begin;
+	int high = end - 1;
+	while (low + 1 < high) {
+		int mid = low + (high - low) / 2;
+		if (prims[mid].code & bit) {
+			high = mid;
+		} else {
+			low = mid;
+		}
+	}
+	return high;
+}
+
+//Returns the index of the node
+int emitLbvhNode(struct lbvhBuilder *b, int begin, int end) {
+	int index = b->nodeCount++;
+	struct lbvhNode *node = &b->nodes[index];
+	if (end - begin <= LBVH_MAX_LEAF_SIZE) {
+		struct boundingBox bbox = emptyBoundingBox();
+		for (int i = begin; i < end; ++i) {
+			bbox = combineBoundingBoxes(&bbox, &b->bboxes[b->prims[i].prim]);
+		}
+		*node = (struct lbvhNode){bbox, -1, -1, begin, end - begin, end - begin, 0.0f};
+		node->cost = LBVH_INTERSECT_COST * node->count * findSurfaceArea(&bbox);
+		return index;
+	}
+	int split = findMortonSplit(b->prims, begin, end);
+	int left = emitLbvhNode(b, begin, split);
+	int right = emitLbvhNode(b, split, end);
+	const struct lbvhNode *l = &b->nodes[left];
+	const struct lbvhNode *r = &b->nodes[right];
+	*node = (struct lbvhNode){combineBoundingBoxes(&l->bbox, &r->bbox), left, right, 0, 0, end - begin, 0.0f};
+	node->cost = LBVH_TRAVERSAL_COST * findSurfaceArea(&node->bbox) + l->cost + r->cost;
+	return index;
+}
+
+struct treelet {
+	int leaves[LBVH_TREELET_SIZE];
+	int leafCount;
+	int internal[LBVH_TREELET_SIZE - 1]; //Nodes that get reused for the new topology, root first
+	int internalCount;
+	int nextInternal;
+	//Indexed by subsets of leaves
+	struct boundingBox bounds[LBVH_TREELET_SUBSETS];
+	float cost[LBVH_TREELET_SUBSETS];
+	int partition[LBVH_TREELET_SUBSETS]; //Leaves that go to the left child
+};
+
+int lowestBitIndex(int bits) {
+	int index = 0;
+	while (!(bits & (1 << index))) index++;
+	return index;
+}
+
+int rebuildTreelet(struct lbvhBuilder *b, struct treelet *t, int subset) {
+	if (!(subset & (subset - 1))) return t->leaves[lowestBitIndex(subset)];
+	int index = t->internal[t->nextInternal++];
+	int partition = t->partition[subset];
+	int left = rebuildTreelet(b, t, partition);
+	int right = rebuildTreelet(b, t, subset ^ partition);
+	int primCount = b->nodes[left].primCount + b->nodes[right].primCount;
+	b->nodes[index] = (struct lbvhNode){t->bounds[subset], left, right, 0, 0, primCount, t->cost[subset]};
+	return index;
+}
+
+void optimizeTreelet(struct lbvhBuilder *b, int root) {
+	struct treelet t;
+	t.leaves[0] = b->nodes[root].left;
+	t.leaves[1] = b->nodes[root].right;
+	t.leafCount = 2;
+	t.internal[0] = root;
+	t.internalCount = 1;
+	t.nextInternal = 0;
+	//Grow the treelet by opening up the largest interior node among its leaves
+	while (t.leafCount < LBVH_TREELET_SIZE) {
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (int i = 0; i < t.leafCount; ++i) {
+			const struct lbvhNode *node = &b->nodes[t.leaves[i]];
+			if (node->left == -1) continue;
+			float area = findSurfaceArea(&node->bbox);
+			if (area > largestArea) {
+				largestArea = area;
+				largest = i;
+			}
+		}
+		if (largest == -1) break;
+		const struct lbvhNode *node = &b->nodes[t.leaves[largest]];
+		t.internal[t.internalCount++] = t.leaves[largest];
+		t.leaves[largest] = node->left;
+		t.leaves[t.leafCount++] = node->right;
+	}
+	//Three leaves or more are needed for there to be more than one topology
+	if (t.leafCount < 3) return;
+
+	//Every proper subset of a set is a smaller number, so they're always done first
+	int fullSet = (1 << t.leafCount) - 1;
+	for (int subset = 1; subset <= fullSet; ++subset) {
+		int lowest = subset & -subset;
+		int rest = subset ^ lowest;
+		const struct lbvhNode *leaf = &b->nodes[t.leaves[lowestBitIndex(lowest)]];
+		if (!rest) {
+			t.bounds[subset] = leaf->bbox;
+			t.cost[subset] = leaf->cost;
+			continue;
+		}
+		t.bounds[subset] = combineBoundingBoxes(&t.bounds[rest], &leaf->bbox);
+
+		//Every split shows up twice, so only look at the ones with the lowest leaf on the left
+		float bestCost = FLT_MAX;
+		for (int part = (subset - 1) & subset; part; part = (part - 1) & subset) {
+			if (!(part & lowest)) continue;
+			float cost = t.cost[part] + t.cost[subset ^ part];
+			if (cost < bestCost) {
+				bestCost = cost;
+				t.partition[subset] = part;
+			}
+		}
+		t.cost[subset] = LBVH_TRAVERSAL_COST * findSurfaceArea(&t.bounds[subset]) + bestCost;
+	}
+	//Leave the treelet alone unless it gets noticeably better, so rounding doesn't shuffle it for nothing
+	if (t.cost[fullSet] >= b->nodes[root].cost * 0.9999f) return;
+	rebuildTreelet(b, &t, fullSet);
+}
+
+void *optimizeSubtreeTask(void *arg);
+
+//Children first, so every treelet is built from already optimized subtrees
+void optimizeSubtree(struct lbvhBuilder *b, int index) {
+	struct lbvhNode *node = &b->nodes[index];
+	if (node->left == -1) return;
+	//Subtrees don't share any nodes, so large ones can be done on another thread
+	struct lbvhTask left = {b, node->left};
+	struct crThread thread = {.threadFunc = optimizeSubtreeTask, .userData = &left};
+	bool parallel = node->primCount >= LBVH_PARALLEL_SUBTREE_SIZE && takeBuildThread(b->budget);
+	if (parallel && spawnThread(&thread)) {
+		returnBuildThread(b->budget);
+		parallel = false;
+	}
+	if (!parallel) optimizeSubtreeTask(&thread);
+	optimizeSubtree(b, node->right);
+	if (parallel) {
+		checkThread(&thread);
+		returnBuildThread(b->budget);
+	}
+	node->cost = LBVH_TRAVERSAL_COST * findSurfaceArea(&node->bbox) + b->nodes[node->left].cost + b->nodes[node->right].cost;
+	optimizeTreelet(b, index);
+}
+
+void *optimizeSubtreeTask(void *arg) {
+	struct crThread *thread = (struct crThread *)arg;
+	struct lbvhTask *task = (struct lbvhTask *)thread->userData;
+	optimizeSubtree(task->b, task->index);
+	return NULL;
+}
+
+struct lbvhFlattener {
+	const struct lbvhNode *nodes;
+	const struct mortonPrim *prims;
+	const int *polygons;
+	struct bvhNode *out;
+	int nodeCount;
+	int *primIndices; //Written in leaf order, since restructuring moves leaves around
+	int primCount;
+	bool collapse;
+	int maxDepth;
+};
+
+void gatherLbvhPrims(struct lbvhFlattener *f, int index) {
+	const struct lbvhNode *node = &f->nodes[index];
+	if (node->left != -1) {
+		gatherLbvhPrims(f, node->left);
+		gatherLbvhPrims(f, node->right);
+		return;
+	}
+	for (int i = node->first; i < node->first + node->count; ++i) {
+		f->primIndices[f->primCount++] = f->polygons[f->prims[i].prim];
+	}
+}
+
+//Write the tree out in depth-first order. Returns the index of the node written.
+int flattenLbvhNode(struct lbvhFlattener *f, int index, int depth) {
+	const struct lbvhNode *node = &f->nodes[index];
+	int outIndex = f->nodeCount++;
+	f->maxDepth = max(f->maxDepth, depth);
+	bool leaf = node->left == -1;
+	//Small subtrees are cheaper to just test as one leaf
+	if (!leaf && f->collapse && node->primCount <= LBVH_MAX_COLLAPSED_LEAF_SIZE) {
+		leaf = LBVH_INTERSECT_COST * node->primCount * findSurfaceArea(&node->bbox) <= node->cost;
+	}
+	if (leaf) {
+		f->out[outIndex] = (struct bvhNode){node->bbox.start, node->bbox.end, f->primCount, node->primCount};
+		gatherLbvhPrims(f, index);
+		return outIndex;
+	}
+	flattenLbvhNode(f, node->left, depth + 1);
+	int right = flattenLbvhNode(f, node->right, depth + 1);
+	f->out[outIndex] = (struct bvhNode){node->bbox.start, node->bbox.end, right, 0};
+	return outIndex;
+}
+
+struct bvh *buildLinearBvh(const int *polygons, const int count, bool optimizeTreelets, struct bvhThreadBudget *budget) {
+	struct bvh *bvh = calloc(1, sizeof(struct bvh));
+	if (count == 0) return bvh;
+
+	struct boundingBox *bboxes = calloc(count, sizeof(struct boundingBox));
+	struct boundingBox centroidBounds = emptyBoundingBox();
+	for (int i = 0; i < count; ++i) {
+		bboxes[i] = computeBoundingBox(&polygons[i], 1);
+		centroidBounds.start = vecMin(centroidBounds.start, bboxes[i].midPoint);
+		centroidBounds.end = vecMax(centroidBounds.end, bboxes[i].midPoint);
+	}
+	struct vector extent = vecSub(centroidBounds.end, centroidBounds.start);
+	struct vector scale = vecWithPos(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+									 extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+									 extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+	struct mortonPrim *prims = malloc(count * sizeof(struct mortonPrim));
+	for (int i = 0; i < count; ++i) {
+		struct vector offset = vecSub(bboxes[i].midPoint, centroidBounds.start);
+		prims[i] = (struct mortonPrim){mortonCode(vecWithPos(offset.x * scale.x, offset.y * scale.y, offset.z * scale.z)), i};
+	}
+	sortMortonPrims(prims, count, budget);
+
+	//A binary tree with N leaves never has more than 2N - 1 nodes
+	struct lbvhBuilder builder = {
+		.prims = prims,
+		.bboxes = bboxes,
+		.nodes = malloc((2 * count - 1) * sizeof(struct lbvhNode)),
+		.nodeCount = 0,
+		.budget = budget
+	};
+	emitLbvhNode(&builder, 0, count);
+	//Copy of the plain tree, in case restructuring makes it too deep to traverse
+	struct lbvhNode *original = NULL;
+	if (optimizeTreelets) {
+		original = malloc(builder.nodeCount * sizeof(struct lbvhNode));
+		memcpy(original, builder.nodes, builder.nodeCount * sizeof(struct lbvhNode));
+		for (int pass = 0; pass < LBVH_TREELET_PASSES; ++pass) {
+			optimizeSubtree(&builder, 0);
+		}
+	}
+
+	struct lbvhFlattener flattener = {
+		.nodes = builder.nodes,
+		.prims = prims,
+		.polygons = polygons,
+		.out = malloc(builder.nodeCount * sizeof(struct bvhNode)),
+		.primIndices = malloc(count * sizeof(int)),
+		.collapse = true
+	};
+	flattenLbvhNode(&flattener, 0, 0);
+	if (flattener.maxDepth >= BVH_STACK_SIZE && original) {
+		logr(warning, "Treelet optimization made a BVH too deep (%i levels), using the plain one\n", flattener.maxDepth);
+		flattener.nodes = original;
+		flattener.nodeCount = flattener.primCount = 0;
+		flattenLbvhNode(&flattener, 0, 0);
+	}
+	free(original);
+	free(builder.nodes);
+	storeBvhNodes(bvh, flattener.out, flattener.nodeCount);
+	bvh->primIndices = flattener.primIndices;
+	bvh->primCount = count;
+	bvh->buildCost = bvhSAHCost(bvh);
+	free(prims);
+	free(bboxes);
+	return bvh;
+}
@@ -0,0 +1,27 @@
+//
+//  lbvh.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "../datatypes/vector.h"
+
+struct bvh;
+struct bvhThreadBudget;
+
+/// 63-bit Morton code of a position, with each axis quantized to 21 bits
+/// @param position Position normalized to [0, 1] on each axis
+uint64_t mortonCode(struct vector position);
+
+/// Builds a linear BVH for a given array of polygons, by sorting them along a Morton curve and splitting
+/// where the codes differ. Much faster to build than the SAH builders, but the resulting tree is slower to trace.
+/// @param polygons Array of polygon indices to process
+/// @param count Amount of polygons given
+/// @param optimizeTreelets Restructure small treelets to lower the SAH cost, recovering some of the trace speed
+/// @param budget Extra threads the sort and treelet optimization may run on. NULL to only use the calling thread.
+struct bvh *buildLinearBvh(const int *polygons, const int count, bool optimizeTreelets, struct bvhThreadBudget *budget);
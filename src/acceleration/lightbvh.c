@@ -0,0 +1,290 @@
+//
+//  lightbvh.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "lightbvh.h"
+
+#include "bbox.h"
+#include "../datatypes/lights.h"
+#include "../datatypes/material.h"
+
+#define LIGHT_BVH_BIN_COUNT 12
+
+/// What a node needs to know about the lights in it, while building
+struct lightBounds {
+	struct boundingBox box;
+	struct vector axis;
+	float spread; //Half angle of the normal cone, PI if it covers every direction
+	float power;
+};
+
+struct lightBvhBuild {
+	struct lightBvh *bvh;
+	struct lightBounds *bounds; //Of each light
+	struct vector *centroids;
+};
+
+struct lightBounds boundsForLight(const struct light *light) {
+	struct lightBounds bounds;
+	bounds.power = lightPower(light);
+	if (light->type == lightTypeSphere) {
+		struct vector radius = vecWithPos(light->radius, light->radius, light->radius);
+		bounds.box.start = vecSub(light->center, radius);
+		bounds.box.end = vecAdd(light->center, radius);
+		bounds.axis = vecWithPos(0.0f, 1.0f, 0.0f);
+		bounds.spread = PI;
+	} else {
+		struct vector v1 = vecAdd(light->v0, light->edge1);
+		struct vector v2 = vecAdd(light->v0, light->edge2);
+		bounds.box.start = vecMin(light->v0, vecMin(v1, v2));
+		bounds.box.end = vecMax(light->v0, vecMax(v1, v2));
+		struct vector normal = vecCross(light->edge1, light->edge2);
+		bool degenerate = vecLengthSquared(normal) <= 0.0f;
+		bounds.axis = degenerate ? vecWithPos(0.0f, 1.0f, 0.0f) : vecNormalize(normal);
+		bounds.spread = degenerate ? PI : 0.0f;
+	}
+	bounds.box.midPoint = vecScale(vecAdd(bounds.box.start, bounds.box.end), 0.5f);
+	return bounds;
+}
+
+//Smallest cone that contains both normal cones. Lights emit from both sides, so the axes can be flipped to match.
+void combineCones(const struct lightBounds *a, const struct lightBounds *b, struct vector *axis, float *spread) {
+	if (a->spread >= PI || b->spread >= PI) {
+		*axis = a->axis;
+		*spread = PI;
+		return;
+	}
+	struct vector otherAxis = vecDot(a->axis, b->axis) < 0.0f ? vecNegate(b->axis) : b->axis;
+	float cosAngle = min(vecDot(a->axis, otherAxis), 1.0f);
+	float angle = acosf(cosAngle);
+	if (min(angle + b->spread, PI) <= a->spread) {
+		*axis = a->axis;
+		*spread = a->spread;
+		return;
+	}
+	if (min(angle + a->spread, PI) <= b->spread) {
+		*axis = otherAxis;
+		*spread = b->spread;
+		return;
+	}
+	*spread = 0.5f * (a->spread + angle + b->spread);
+	if (*spread >= PI) {
+		*axis = a->axis;
+		*spread = PI;
+		return;
+	}
+	//Rotate the axis of a towards the other one, so the new cone just reaches the far edge of both
+	struct vector perpendicular = vecSub(otherAxis, vecScale(a->axis, cosAngle));
+	if (vecLengthSquared(perpendicular) <= 0.0f) {
+		*axis = a->axis;
+		return;
+	}
+	float rotation = *spread - a->spread;
+	*axis = vecNormalize(vecAdd(vecScale(a->axis, cosf(rotation)), vecScale(vecNormalize(perpendicular), sinf(rotation))));
+}
+
+struct lightBounds combineLightBounds(const struct lightBounds *a, const struct lightBounds *b) {
+	struct lightBounds bounds;
+	bounds.box = combineBoundingBoxes(&a->box, &b->box);
+	bounds.power = a->power + b->power;
+	combineCones(a, b, &bounds.axis, &bounds.spread);
+	return bounds;
+}
+
+//Split lights along the longest axis of their centroids, minimizing power times surface area on both sides.
+//Returns the amount of lights moved to the front of indices, for the left child.
+int splitLights(const struct lightBvhBuild *build, int *indices, int count) {
+	struct boundingBox centroidBounds = emptyBoundingBox();
+	for (int i = 0; i < count; ++i) {
+		centroidBounds.start = vecMin(centroidBounds.start, build->centroids[indices[i]]);
+		centroidBounds.end = vecMax(centroidBounds.end, build->centroids[indices[i]]);
+	}
+	enum bboxAxis axis = getLongestAxis(&centroidBounds);
+	float low = vecAxis(centroidBounds.start, axis);
+	float extent = vecAxis(centroidBounds.end, axis) - low;
+	if (extent <= 0.0f) return count / 2;
+	
+	struct boundingBox binBoxes[LIGHT_BVH_BIN_COUNT];
+	float binPower[LIGHT_BVH_BIN_COUNT] = {0};
+	int binCount[LIGHT_BVH_BIN_COUNT] = {0};
+	for (int b = 0; b < LIGHT_BVH_BIN_COUNT; ++b) binBoxes[b] = emptyBoundingBox();
+	for (int i = 0; i < count; ++i) {
+		int light = indices[i];
+		int b = min((int)(LIGHT_BVH_BIN_COUNT * (vecAxis(build->centroids[light], axis) - low) / extent), LIGHT_BVH_BIN_COUNT - 1);
+		binBoxes[b] = combineBoundingBoxes(&binBoxes[b], &build->bounds[light].box);
+		binPower[b] += build->bounds[light].power;
+		binCount[b]++;
+	}
+	
+	//Sweep from the right to get the cost of everything after each split
+	float rightCost[LIGHT_BVH_BIN_COUNT];
+	struct boundingBox box = emptyBoundingBox();
+	float power = 0.0f;
+	for (int b = LIGHT_BVH_BIN_COUNT - 1; b > 0; --b) {
+		box = combineBoundingBoxes(&box, &binBoxes[b]);
+		power += binPower[b];
+		rightCost[b] = power * findSurfaceArea(&box);
+	}
+	int bestSplit = 0;
+	float bestCost = FLT_MAX;
+	box = emptyBoundingBox();
+	power = 0.0f;
+	int leftCount = 0;
+	for (int b = 0; b < LIGHT_BVH_BIN_COUNT - 1; ++b) {
+		box = combineBoundingBoxes(&box, &binBoxes[b]);
+		power += binPower[b];
+		leftCount += binCount[b];
+		if (!leftCount || leftCount == count) continue;
+		float cost = power * findSurfaceArea(&box) + rightCost[b + 1];
+		if (cost < bestCost) {
+			bestCost = cost;
+			bestSplit = b + 1;
+		}
+	}
+	if (!bestSplit) return count / 2;
+	
+	int left = 0;
+	for (int i = 0; i < count; ++i) {
+		int b = min((int)(LIGHT_BVH_BIN_COUNT * (vecAxis(build->centroids[indices[i]], axis) - low) / extent), LIGHT_BVH_BIN_COUNT - 1);
+		if (b < bestSplit) {
+			int swap = indices[left];
+			indices[left++] = indices[i];
+			indices[i] = swap;
+		}
+	}
+	return left;
+}
+
+int buildLightNode(struct lightBvhBuild *build, int *indices, int count, int parent) {
+	struct lightBvh *bvh = build->bvh;
+	int nodeIndex = bvh->nodeCount++;
+	struct lightBounds bounds = build->bounds[indices[0]];
+	for (int i = 1; i < count; ++i) {
+		bounds = combineLightBounds(&bounds, &build->bounds[indices[i]]);
+	}
+	struct lightBvhNode *node = &bvh->nodes[nodeIndex];
+	node->start = bounds.box.start;
+	node->end = bounds.box.end;
+	node->axis = bounds.axis;
+	node->cosSpread = bounds.spread >= PI ? -1.0f : cosf(bounds.spread);
+	node->sinSpread = bounds.spread >= PI ? 0.0f : sinf(bounds.spread);
+	node->power = bounds.power;
+	node->parent = parent;
+	node->leaf = count == 1;
+	if (node->leaf) {
+		node->index = indices[0];
+		bvh->leaves[indices[0]] = nodeIndex;
+		return nodeIndex;
+	}
+	
+	int leftCount = splitLights(build, indices, count);
+	buildLightNode(build, indices, leftCount, nodeIndex);
+	int right = buildLightNode(build, indices + leftCount, count - leftCount, nodeIndex);
+	bvh->nodes[nodeIndex].index = right;
+	return nodeIndex;
+}
+
+struct lightBvh *buildLightBvh(const struct light *lights, int count) {
+	struct lightBvh *bvh = calloc(1, sizeof(struct lightBvh));
+	bvh->nodes = calloc(2 * count - 1, sizeof(struct lightBvhNode));
+	bvh->leaves = malloc(count * sizeof(int));
+	
+	struct lightBvhBuild build = {0};
+	build.bvh = bvh;
+	build.bounds = malloc(count * sizeof(struct lightBounds));
+	build.centroids = malloc(count * sizeof(struct vector));
+	int *indices = malloc(count * sizeof(int));
+	for (int i = 0; i < count; ++i) {
+		build.bounds[i] = boundsForLight(&lights[i]);
+		build.centroids[i] = build.bounds[i].box.midPoint;
+		indices[i] = i;
+	}
+	buildLightNode(&build, indices, count, -1);
+	
+	free(indices);
+	free(build.centroids);
+	free(build.bounds);
+	return bvh;
+}
+
+//Upper bound of the light a node could send to a point, from its power, distance and orientation
+float lightNodeImportance(const struct lightBvhNode *node, struct vector point) {
+	if (node->power <= 0.0f) return 0.0f;
+	struct vector halfExtent = vecScale(vecSub(node->end, node->start), 0.5f);
+	struct vector toPoint = vecSub(point, vecAdd(node->start, halfExtent));
+	float distanceSquared = vecDot(toPoint, toPoint);
+	float radiusSquared = vecDot(halfExtent, halfExtent);
+	//Inside the bounding sphere, any of the lights could be right next to the point
+	if (distanceSquared <= radiusSquared) return node->power / max(radiusSquared, FLT_MIN);
+	
+	float bound = 1.0f;
+	if (node->cosSpread > -1.0f) {
+		float distance = sqrtf(distanceSquared);
+		float cosAngle = fabsf(vecDot(node->axis, toPoint)) / distance;
+		float sinAngle = sqrtf(max(0.0f, 1.0f - cosAngle * cosAngle));
+		//Widen the normal cone by the angle the bounding sphere covers from the point
+		float sinBounds = sqrtf(radiusSquared / distanceSquared);
+		float cosBounds = sqrtf(max(0.0f, 1.0f - sinBounds * sinBounds));
+		float cosWidened = node->cosSpread * cosBounds - node->sinSpread * sinBounds;
+		float sinWidened = node->sinSpread * cosBounds + node->cosSpread * sinBounds;
+		//Past the widened cone, the lights are seen at an angle of at least the difference
+		if (sinWidened >= 0.0f && cosAngle < cosWidened) {
+			bound = cosAngle * cosWidened + sinAngle * sinWidened;
+		}
+	}
+	return node->power * bound / distanceSquared;
+}
+
+//Probability of picking the left child of an interior node, -1 if neither child can light the point
+float leftProbability(const struct lightBvh *bvh, int node, struct vector point) {
+	float left = lightNodeImportance(&bvh->nodes[node + 1], point);
+	float right = lightNodeImportance(&bvh->nodes[bvh->nodes[node].index], point);
+	if (left + right <= 0.0f) return -1.0f;
+	return left / (left + right);
+}
+
+int pickLightFromBvh(const struct lightBvh *bvh, struct vector point, float u, float *probability) {
+	int node = 0;
+	*probability = 1.0f;
+	while (!bvh->nodes[node].leaf) {
+		float left = leftProbability(bvh, node, point);
+		if (left < 0.0f) return -1;
+		//Where u fell within the chosen side is uniform again, and picks the next level
+		if (u < left) {
+			u = min(u / left, 0.99999994f);
+			*probability *= left;
+			node = node + 1;
+		} else {
+			u = min((u - left) / (1.0f - left), 0.99999994f);
+			*probability *= 1.0f - left;
+			node = bvh->nodes[node].index;
+		}
+	}
+	return bvh->nodes[node].index;
+}
+
+float lightBvhProbability(const struct lightBvh *bvh, int light, struct vector point) {
+	float probability = 1.0f;
+	int node = bvh->leaves[light];
+	while (bvh->nodes[node].parent >= 0) {
+		int parent = bvh->nodes[node].parent;
+		float left = leftProbability(bvh, parent, point);
+		if (left < 0.0f) return 0.0f;
+		probability *= node == parent + 1 ? left : 1.0f - left;
+		node = parent;
+	}
+	return probability;
+}
+
+void destroyLightBvh(struct lightBvh *bvh) {
+	if (bvh) {
+		free(bvh->nodes);
+		free(bvh->leaves);
+		free(bvh);
+	}
+}
@@ -0,0 +1,55 @@
+//
+//  lightbvh.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include "../datatypes/vector.h"
+
+struct light;
+
+/// A node in a light hierarchy. Bounds where its lights are, which way they face and how much light they emit,
+/// to estimate how much they could contribute to a point.
+/// The left child of an interior node is always the next node in the array, like in struct bvhNode.
+struct lightBvhNode {
+	struct vector start, end; //Bounding box
+	struct vector axis; //Axis of a cone that contains the normals of the lights. Lights emit from both sides, so it works both ways.
+	float cosSpread, sinSpread; //Half angle of the cone. cosSpread is -1 if a light in the node emits in every direction.
+	float power;
+	int parent; //-1 for the root
+	int index; //Interior: Index of the right child. Leaf: Index of the light
+	bool leaf;
+};
+
+/// Binary hierarchy over the lights of a scene, with one light in each leaf, stored depth-first.
+/// Lights are picked by walking down from the root, choosing each child in proportion to its estimated contribution.
+struct lightBvh {
+	struct lightBvhNode *nodes;
+	int nodeCount;
+	int *leaves; //Node of each light
+};
+
+/// Build a light hierarchy, splitting the lights by their power and the surface area of their bounds
+/// @param lights Lights to build for, in world space
+/// @param count Amount of lights given, at least 1
+struct lightBvh *buildLightBvh(const struct light *lights, int count);
+
+/// Pick a light to sample from a point, walking down the hierarchy in O(log N)
+/// @param bvh Hierarchy to walk
+/// @param point Point being shaded
+/// @param u Uniform value in [0, 1), rescaled at each level so one value is enough
+/// @param probability Set to the probability of picking the returned light
+/// @return Index of the light, or -1 if no light can reach the point
+int pickLightFromBvh(const struct lightBvh *bvh, struct vector point, float u, float *probability);
+
+/// Probability pickLightFromBvh() picks a given light from a point
+/// @param bvh Hierarchy that would have been walked
+/// @param light Index of the light
+/// @param point Point being shaded
+float lightBvhProbability(const struct lightBvh *bvh, int light, struct vector point);
+
+void destroyLightBvh(struct lightBvh *bvh);
@@ -0,0 +1,154 @@
+//
+//  packedtris.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "packedtris.h"
+#include "bvh.h"
+
+#include "../renderer/pathtrace.h"
+#include "../datatypes/vertexbuffer.h"
+#include "../datatypes/poly.h"
+#include "../utils/memory.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TRI_PACK_SSE
+#include <xmmintrin.h>
+#endif
+
+#define TRI_PACK_ALIGNMENT 64
+
+void packBvhTriangles(struct bvh *bvh) {
+	if (bvh->triangles) {
+		cray_aligned_free(bvh->triangles);
+		bvh->triangles = NULL;
+		bvh->trianglePackCount = 0;
+	}
+	if (!bvh->primCount) return;
+
+	int packCount = (bvh->primCount + TRI_PACK_WIDTH - 1) / TRI_PACK_WIDTH;
+	//Unused lanes in the last pack are zeroed, so they have degenerate triangles that are never hit
+	struct packedTriangles *packs = cray_aligned_malloc(TRI_PACK_ALIGNMENT, packCount * sizeof(struct packedTriangles));
+	memset(packs, 0, packCount * sizeof(struct packedTriangles));
+	for (int i = 0; i < bvh->primCount; ++i) {
+		struct packedTriangles *pack = &packs[i / TRI_PACK_WIDTH];
+		int lane = i % TRI_PACK_WIDTH;
+		const struct poly *p = &polygonArray[bvh->primIndices[i]];
+		struct vector v0 = vertexArray[p->vertexIndex[0]];
+		struct vector edge1 = vecSub(vertexArray[p->vertexIndex[2]], v0);
+		struct vector edge2 = vecSub(vertexArray[p->vertexIndex[1]], v0);
+		pack->v0X[lane] = v0.x;
+		pack->v0Y[lane] = v0.y;
+		pack->v0Z[lane] = v0.z;
+		pack->e1X[lane] = edge1.x;
+		pack->e1Y[lane] = edge1.y;
+		pack->e1Z[lane] = edge1.z;
+		pack->e2X[lane] = edge2.x;
+		pack->e2Y[lane] = edge2.y;
+		pack->e2Z[lane] = edge2.z;
+		pack->polyIndex[lane] = bvh->primIndices[i];
+	}
+	bvh->triangles = packs;
+	bvh->trianglePackCount = packCount;
+}
+
+//Möller-Trumbore for all lanes of a pack, with the same operations in the same order as rayIntersectsWithPolygon().
+//Returns a bitmask of the lanes that pass all tests except the distance range, which is checked in order by the caller.
+int rayIntersectsWithPack(const struct packedTriangles *pack, const struct lightRay *ray, float *t, float *u, float *v) {
+#ifdef TRI_PACK_SSE
+	__m128 dirX = _mm_set1_ps(ray->direction.x);
+	__m128 dirY = _mm_set1_ps(ray->direction.y);
+	__m128 dirZ = _mm_set1_ps(ray->direction.z);
+	__m128 e1X = _mm_load_ps(pack->e1X);
+	__m128 e1Y = _mm_load_ps(pack->e1Y);
+	__m128 e1Z = _mm_load_ps(pack->e1Z);
+	__m128 e2X = _mm_load_ps(pack->e2X);
+	__m128 e2Y = _mm_load_ps(pack->e2Y);
+	__m128 e2Z = _mm_load_ps(pack->e2Z);
+
+	//s1 = direction x edge2
+	__m128 s1X = _mm_sub_ps(_mm_mul_ps(dirY, e2Z), _mm_mul_ps(dirZ, e2Y));
+	__m128 s1Y = _mm_sub_ps(_mm_mul_ps(dirZ, e2X), _mm_mul_ps(dirX, e2Z));
+	__m128 s1Z = _mm_sub_ps(_mm_mul_ps(dirX, e2Y), _mm_mul_ps(dirY, e2X));
+	__m128 orientation = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1X, s1X), _mm_mul_ps(e1Y, s1Y)), _mm_mul_ps(e1Z, s1Z));
+	__m128 inverseOrientation = _mm_div_ps(_mm_set1_ps(1.0f), orientation);
+
+	//s2 = start - v0
+	__m128 s2X = _mm_sub_ps(_mm_set1_ps(ray->start.x), _mm_load_ps(pack->v0X));
+	__m128 s2Y = _mm_sub_ps(_mm_set1_ps(ray->start.y), _mm_load_ps(pack->v0Y));
+	__m128 s2Z = _mm_sub_ps(_mm_set1_ps(ray->start.z), _mm_load_ps(pack->v0Z));
+	__m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s2X, s1X), _mm_mul_ps(s2Y, s1Y)), _mm_mul_ps(s2Z, s1Z)), inverseOrientation);
+
+	//s3 = s2 x edge1
+	__m128 s3X = _mm_sub_ps(_mm_mul_ps(s2Y, e1Z), _mm_mul_ps(s2Z, e1Y));
+	__m128 s3Y = _mm_sub_ps(_mm_mul_ps(s2Z, e1X), _mm_mul_ps(s2X, e1Z));
+	__m128 s3Z = _mm_sub_ps(_mm_mul_ps(s2X, e1Y), _mm_mul_ps(s2Y, e1X));
+	__m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, s3X), _mm_mul_ps(dirY, s3Y)), _mm_mul_ps(dirZ, s3Z)), inverseOrientation);
+	__m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2X, s3X), _mm_mul_ps(e2Y, s3Y)), _mm_mul_ps(e2Z, s3Z)), inverseOrientation);
+
+	//Collect the rejections like the scalar version does, so NaNs pass through the same way
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 reject = _mm_and_ps(_mm_cmpgt_ps(orientation, _mm_set1_ps(-0.00000001f)), _mm_cmplt_ps(orientation, _mm_set1_ps(0.00000001f)));
+	reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(uu, zero), _mm_cmpgt_ps(uu, one)));
+	reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(vv, zero), _mm_cmpgt_ps(_mm_add_ps(uu, vv), one)));
+
+	_mm_storeu_ps(t, tt);
+	_mm_storeu_ps(u, uu);
+	_mm_storeu_ps(v, vv);
+	return ~_mm_movemask_ps(reject) & ((1 << TRI_PACK_WIDTH) - 1);
+#else
+	int mask = 0;
+	for (int i = 0; i < TRI_PACK_WIDTH; ++i) {
+		struct vector edge1 = {pack->e1X[i], pack->e1Y[i], pack->e1Z[i]};
+		struct vector edge2 = {pack->e2X[i], pack->e2Y[i], pack->e2Z[i]};
+		struct vector s1 = vecCross(ray->direction, edge2);
+		float orientation = vecDot(edge1, s1);
+		if (orientation > -0.00000001f && orientation < 0.00000001f) continue;
+		float inverseOrientation = 1.0f / orientation;
+		struct vector s2 = vecSub(ray->start, (struct vector){pack->v0X[i], pack->v0Y[i], pack->v0Z[i]});
+		u[i] = vecDot(s2, s1) * inverseOrientation;
+		if (u[i] < 0.0f || u[i] > 1.0f) continue;
+		struct vector s3 = vecCross(s2, edge1);
+		v[i] = vecDot(ray->direction, s3) * inverseOrientation;
+		if (v[i] < 0.0f || (u[i] + v[i]) > 1.0f) continue;
+		t[i] = vecDot(edge2, s3) * inverseOrientation;
+		mask |= 1 << i;
+	}
+	return mask;
+#endif
+}
+
+bool rayIntersectsWithPackedTriangles(const struct bvh *bvh, int first, int count, const struct lightRay *ray, struct hitRecord *isect) {
+	int hitPack = -1;
+	int hitLane = 0;
+	float hitU = 0.0f, hitV = 0.0f;
+	int end = first + count;
+	for (int p = first / TRI_PACK_WIDTH; p <= (end - 1) / TRI_PACK_WIDTH; ++p) {
+		float t[TRI_PACK_WIDTH], u[TRI_PACK_WIDTH], v[TRI_PACK_WIDTH];
+		int mask = rayIntersectsWithPack(&bvh->triangles[p], ray, t, u, v);
+		//Lanes are checked in order against the closest hit so far, so ties resolve like they do one polygon at a time
+		for (int lane = 0; mask && lane < TRI_PACK_WIDTH; ++lane) {
+			if (!(mask & (1 << lane))) continue;
+			int i = p * TRI_PACK_WIDTH + lane;
+			//Packs can be shared with neighboring leaves
+			if (i < first || i >= end) continue;
+			if (t[lane] < ray->tmin || t[lane] > isect->distance) continue;
+			isect->distance = t[lane];
+			hitPack = p;
+			hitLane = lane;
+			hitU = u[lane];
+			hitV = v[lane];
+		}
+	}
+	if (hitPack < 0) return false;
+
+	isect->uv = (struct coord){hitU, hitV};
+	isect->type = hitTypePolygon;
+	isect->polyIndex = bvh->triangles[hitPack].polyIndex[hitLane];
+	return true;
+}
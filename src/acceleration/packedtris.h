@@ -0,0 +1,38 @@
+//
+//  packedtris.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#define TRI_PACK_WIDTH 4
+
+struct bvh;
+struct lightRay;
+struct hitRecord;
+
+/// Four triangles, precomputed for intersection and stored as structure-of-arrays so a ray can be tested against all of them at once.
+/// edge1 and edge2 are the same as in rayIntersectsWithPolygon(), so hits match exactly. 160 bytes.
+struct packedTriangles {
+	float v0X[TRI_PACK_WIDTH], v0Y[TRI_PACK_WIDTH], v0Z[TRI_PACK_WIDTH];
+	float e1X[TRI_PACK_WIDTH], e1Y[TRI_PACK_WIDTH], e1Z[TRI_PACK_WIDTH]; //v2 - v0
+	float e2X[TRI_PACK_WIDTH], e2Y[TRI_PACK_WIDTH], e2Z[TRI_PACK_WIDTH]; //v1 - v0
+	int polyIndex[TRI_PACK_WIDTH]; //Index into polygonArray, only looked at for the final hit
+};
+
+/// Precompute triangles for all the polygons in a BVH, in the same order as primIndices.
+/// Triangle i is in lane i % 4 of pack i / 4, so any leaf range maps directly to a run of packs.
+/// Has to be called again whenever the vertices move. refitBvh() does this.
+/// @param bvh Polygon BVH to pack triangles for
+void packBvhTriangles(struct bvh *bvh);
+
+/// Intersect a ray with a range of packed triangles in a leaf
+/// @param bvh BVH the leaf belongs to. packBvhTriangles() has to be called first.
+/// @param first First index into primIndices
+/// @param count Amount of triangles in the leaf
+/// @param ray Ray to check intersection against
+/// @param isect Intersection information is saved to this struct
+bool rayIntersectsWithPackedTriangles(const struct bvh *bvh, int first, int count, const struct lightRay *ray, struct hitRecord *isect);
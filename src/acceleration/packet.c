@@ -0,0 +1,205 @@
+//
+//  packet.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "packet.h"
+#include "bvh.h"
+#include "tlas.h"
+#include "bbox.h"
+
+#include "../renderer/pathtrace.h"
+#include "../datatypes/scene.h"
+#include "../datatypes/mesh.h"
+#include "../datatypes/instance.h"
+#include "../datatypes/poly.h"
+
+struct packetStackEntry {
+	int node;
+	int first; //Rays before this are known to miss the node
+};
+
+void finishRayPacket(struct rayPacket *packet) {
+	packet->commonOrigin = true;
+	packet->tmin = FLT_MAX;
+	for (int i = 0; i < packet->count; ++i) {
+		const struct lightRay *ray = &packet->rays[i];
+		packet->tmin = min(packet->tmin, ray->tmin);
+		if (ray->start.x != packet->rays[0].start.x || ray->start.y != packet->rays[0].start.y || ray->start.z != packet->rays[0].start.z) {
+			packet->commonOrigin = false;
+		}
+	}
+	for (int axis = 0; axis < 3; ++axis) {
+		float low = FLT_MAX;
+		float high = -FLT_MAX;
+		bool sameSign = true;
+		bool finite = true;
+		for (int i = 0; i < packet->count; ++i) {
+			const struct lightRay *ray = &packet->rays[i];
+			float inverse = vecAxis(ray->inverseDirection, axis);
+			low = min(low, inverse);
+			high = max(high, inverse);
+			if (ray->sign[axis] != packet->rays[0].sign[axis]) sameSign = false;
+			if (!isfinite(inverse)) finite = false;
+		}
+		packet->inverseMin[axis] = low;
+		packet->inverseMax[axis] = high;
+		packet->cullAxis[axis] = sameSign && finite;
+	}
+}
+
+//Interval version of the slab test, true if any ray of the packet could hit the node.
+//Rounding is monotonic, so the distances for each ray always land within the ones computed for the bounds here.
+bool packetMayHitNode(const struct rayPacket *packet, const struct bvhNode *node, float maxDistance) {
+	if (!packet->commonOrigin) return true;
+	float entry = packet->tmin;
+	float exit = maxDistance;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (!packet->cullAxis[axis]) continue;
+		float origin = vecAxis(packet->rays[0].start, axis);
+		float low = vecAxis(node->start, axis) - origin;
+		float high = vecAxis(node->end, axis) - origin;
+		float lowMin = min(low * packet->inverseMin[axis], low * packet->inverseMax[axis]);
+		float lowMax = max(low * packet->inverseMin[axis], low * packet->inverseMax[axis]);
+		float highMin = min(high * packet->inverseMin[axis], high * packet->inverseMax[axis]);
+		float highMax = max(high * packet->inverseMin[axis], high * packet->inverseMax[axis]);
+		//Negative directions enter through the high plane
+		bool negative = packet->rays[0].sign[axis];
+		entry = max(entry, negative ? highMin : lowMin);
+		exit = min(exit, negative ? lowMax : highMax);
+	}
+	return entry <= exit;
+}
+
+float furthestHit(const struct hitRecord *isects, int first, int count) {
+	float distance = 0.0f;
+	for (int i = first; i < count; ++i) {
+		distance = max(distance, isects[i].distance);
+	}
+	return distance;
+}
+
+uint64_t rayPacketIntersectsWithBvh(const struct bvh *bvh, const struct rayPacket *packet, int first, struct hitRecord *isects) {
+	if (!bvh || !bvh->nodeCount) return 0;
+	struct packetStackEntry stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = (struct packetStackEntry){0, first};
+	float maxDistance = furthestHit(isects, first, packet->count);
+	
+	uint64_t hits = 0;
+	while (stackSize > 0) {
+		struct packetStackEntry entry = stack[--stackSize];
+		const struct bvhNode *node = &bvh->nodes[entry.node];
+		if (!packetMayHitNode(packet, node, maxDistance)) continue;
+		
+		//Rays that miss the node can be skipped for the whole subtree, up to the first one that hits it
+		float t;
+		int active = entry.first;
+		while (active < packet->count && !rayIntersectsWithNodeBounds(node, &packet->rays[active], isects[active].distance, &t)) active++;
+		if (active == packet->count) continue;
+		
+		if (node->primCount) {
+			bool hitLeaf = false;
+			for (int i = active; i < packet->count; ++i) {
+				//Only test polygons for rays that hit the leaf, like single ray traversal would
+				if (i != active && !rayIntersectsWithNodeBounds(node, &packet->rays[i], isects[i].distance, &t)) continue;
+				if (rayIntersectsWithLeaf(bvh, node->index, node->primCount, &packet->rays[i], &isects[i])) {
+					isects[i].didIntersect = true;
+					hits |= UINT64_C(1) << i;
+					hitLeaf = true;
+				}
+			}
+			if (hitLeaf) maxDistance = furthestHit(isects, first, packet->count);
+			continue;
+		}
+		
+		//Visit the child nearer to the first active ray first
+		int left = entry.node + 1;
+		int right = node->index;
+		const struct lightRay *ray = &packet->rays[active];
+		struct vector leftCenter = vecAdd(bvh->nodes[left].start, bvh->nodes[left].end);
+		struct vector rightCenter = vecAdd(bvh->nodes[right].start, bvh->nodes[right].end);
+		bool leftFirst = vecDot(vecSub(leftCenter, rightCenter), ray->direction) <= 0.0f;
+		stack[stackSize++] = (struct packetStackEntry){leftFirst ? right : left, active};
+		stack[stackSize++] = (struct packetStackEntry){leftFirst ? left : right, active};
+	}
+	return hits;
+}
+
+void rayPacketIntersectsWithMesh(const struct mesh *mesh, const struct instance *instance, int object, const struct rayPacket *packet, int first, struct hitRecord *isects) {
+	uint64_t hits;
+	if (instance) {
+		//Affine transforms keep a common origin common, so the moved packet can still be culled as a whole
+		struct rayPacket local;
+		local.count = packet->count;
+		for (int i = first; i < packet->count; ++i) {
+			local.rays[i] = rayToInstance(instance, &packet->rays[i]);
+		}
+		for (int i = 0; i < first; ++i) {
+			local.rays[i] = local.rays[first];
+		}
+		finishRayPacket(&local);
+		hits = rayPacketIntersectsWithBvh(mesh->bvh, &local, first, isects);
+	} else {
+		hits = rayPacketIntersectsWithBvh(mesh->bvh, packet, first, isects);
+	}
+	for (int i = first; i < packet->count; ++i) {
+		if (!(hits & (UINT64_C(1) << i))) continue;
+		isects[i].object = object;
+	}
+}
+
+void rayPacketIntersectsWithObject(const struct world *scene, int object, const struct rayPacket *packet, int first, struct hitRecord *isects) {
+	if (object < scene->meshCount) {
+		rayPacketIntersectsWithMesh(&scene->meshes[object], NULL, object, packet, first, isects);
+	} else if (object < scene->meshCount + scene->sphereCount) {
+		for (int i = first; i < packet->count; ++i) {
+			if (rayIntersectsWithObject(scene, object, &packet->rays[i], &isects[i])) isects[i].didIntersect = true;
+		}
+	} else {
+		const struct instance *instance = &scene->instances[object - scene->meshCount - scene->sphereCount];
+		rayPacketIntersectsWithMesh(&scene->meshes[instance->meshIndex], instance, object, packet, first, isects);
+	}
+}
+
+void rayPacketIntersectsWithScene(const struct world *scene, const struct rayPacket *packet, struct hitRecord *isects) {
+	const struct bvh *bvh = scene->topLevel;
+	if (bvh->nodeCount) {
+		struct packetStackEntry stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = (struct packetStackEntry){0, 0};
+		while (stackSize > 0) {
+			struct packetStackEntry entry = stack[--stackSize];
+			const struct bvhNode *node = &bvh->nodes[entry.node];
+			if (!packetMayHitNode(packet, node, furthestHit(isects, entry.first, packet->count))) continue;
+			
+			float t;
+			int active = entry.first;
+			while (active < packet->count && !rayIntersectsWithNodeBounds(node, &packet->rays[active], isects[active].distance, &t)) active++;
+			if (active == packet->count) continue;
+			
+			if (node->primCount) {
+				for (int i = node->index; i < node->index + node->primCount; ++i) {
+					rayPacketIntersectsWithObject(scene, bvh->primIndices[i], packet, active, isects);
+				}
+				continue;
+			}
+			
+			int left = entry.node + 1;
+			int right = node->index;
+			const struct lightRay *ray = &packet->rays[active];
+			struct vector leftCenter = vecAdd(bvh->nodes[left].start, bvh->nodes[left].end);
+			struct vector rightCenter = vecAdd(bvh->nodes[right].start, bvh->nodes[right].end);
+			bool leftFirst = vecDot(vecSub(leftCenter, rightCenter), ray->direction) <= 0.0f;
+			stack[stackSize++] = (struct packetStackEntry){leftFirst ? right : left, active};
+			stack[stackSize++] = (struct packetStackEntry){leftFirst ? left : right, active};
+		}
+	}
+	for (int i = 0; i < packet->count; ++i) {
+		computeHitSurface(scene, &isects[i]);
+	}
+}
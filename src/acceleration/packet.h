@@ -0,0 +1,51 @@
+//
+//  packet.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include "../datatypes/lightRay.h"
+
+#define RAY_PACKET_WIDTH 8
+#define RAY_PACKET_SIZE (RAY_PACKET_WIDTH * RAY_PACKET_WIDTH)
+
+struct world;
+struct bvh;
+struct hitRecord;
+
+/// Coherent rays traced through the acceleration structures together, like camera rays for a block of pixels.
+/// Nodes are visited once for the whole packet, and skipped for rays that are known to miss them.
+struct rayPacket {
+	struct lightRay rays[RAY_PACKET_SIZE];
+	int count;
+	
+	//Set by finishRayPacket(). When every ray starts from the same point, bounds of the inverse directions
+	//let whole nodes be culled for the packet at once, on axes where all directions have the same sign.
+	bool commonOrigin;
+	bool cullAxis[3];
+	float inverseMin[3], inverseMax[3];
+	float tmin;
+};
+
+/// Precompute what traversal needs, once the rays of a packet have been set
+/// @param packet Packet to process
+void finishRayPacket(struct rayPacket *packet);
+
+/// Find the closest hits between the rays of a packet and the polygons of a BVH
+/// @param bvh BVH to traverse
+/// @param packet Rays to trace
+/// @param first Rays before this are skipped
+/// @param isects Closest hits so far, one per ray. Updated with closer hits.
+/// @return Bitmask of the rays that got a closer hit
+uint64_t rayPacketIntersectsWithBvh(const struct bvh *bvh, const struct rayPacket *packet, int first, struct hitRecord *isects);
+
+/// Find the closest hit for every ray of a packet, and compute its surface, like getClosestIsect() does for a single ray
+/// @param scene Scene to intersect with. topLevel has to be built.
+/// @param packet Rays to trace
+/// @param isects One hit record per ray, initialized with newHitRecord()
+void rayPacketIntersectsWithScene(const struct world *scene, const struct rayPacket *packet, struct hitRecord *isects);
@@ -0,0 +1,374 @@
+//
+//  sbvh.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "sbvh.h"
+#include "bvh.h"
+#include "bbox.h"
+
+#include "../datatypes/vertexbuffer.h"
+#include "../datatypes/poly.h"
+
+/*
+ Spatial split BVH builder (SBVH)
+ Works on references to polygons instead of the polygons themselves. Each reference has its own
+ bounding box, which starts out as the polygon bounds, and gets clipped whenever the reference is split.
+ For each node:
+ 1. Find the best binned object split, like the regular BVH builder
+ 2. If the children of that split overlap, also try spatial splits. These bin the node bounds into
+    evenly sized slabs, and chop each reference into a piece for every slab it touches.
+ 3. Take the cheaper of the two, as long as the references duplicated by a spatial split fit in the budget.
+ Nodes and leaves are written out in depth-first order as they are built, so no compaction is needed.
+ */
+
+#define SBVH_OBJECT_BINS 16
+#define SBVH_SPATIAL_BINS 32
+#define SBVH_MAX_LEAF_SIZE 8
+#define SBVH_MAX_DEPTH 64
+#define SBVH_TRAVERSAL_COST 1.0f
+#define SBVH_INTERSECT_COST 1.0f
+//Spatial splits are only tried when the object split children overlap by more than this fraction of the root area
+#define SBVH_OVERLAP_THRESHOLD 0.00001f
+//Small nodes span few bins, so their references get chopped into many pieces for very little gain
+#define SBVH_MIN_SPATIAL_SPLIT_COUNT 32
+
+struct sbvhRef {
+	struct boundingBox bbox; //Clipped polygon bounds. midPoint is used as the centroid
+	int poly;
+};
+
+struct sbvhBuilder {
+	struct bvhNode *nodes;
+	int nodeCount, nodeCapacity;
+	int *primIndices;
+	int primCount, primCapacity;
+	int refCount; //References in the tree, including the nodes not built yet
+	int maxRefs;
+	float rootArea;
+};
+
+struct sbvhSplit {
+	float cost;
+	int axis; //-1 if no split was found
+	int bin; //Object splits: last bin on the left side
+	float position; //Spatial splits: split plane
+	struct boundingBox left, right;
+	int leftCount, rightCount;
+};
+
+struct sbvhBin {
+	struct boundingBox bbox;
+	int count; //Object bins: references in the bin. Spatial bins: references starting in the bin
+	int exits; //Spatial bins: references ending in the bin
+};
+
+void setVecAxis(struct vector *v, int axis, float value) {
+	if (axis == X) v->x = value;
+	else if (axis == Y) v->y = value;
+	else v->z = value;
+}
+
+//Split a reference in two at a plane, clipping the polygon to both sides
+void splitReference(const struct sbvhRef *ref, int axis, float position, struct boundingBox *left, struct boundingBox *right) {
+	//Either output may alias the reference
+	struct boundingBox bounds = ref->bbox;
+	const struct poly *p = &polygonArray[ref->poly];
+	*left = emptyBoundingBox();
+	*right = emptyBoundingBox();
+	for (int j = 0; j < 3; ++j) {
+		struct vector a = vertexArray[p->vertexIndex[j]];
+		struct vector b = vertexArray[p->vertexIndex[(j + 1) % 3]];
+		float pa = vecAxis(a, axis);
+		float pb = vecAxis(b, axis);
+		if (pa <= position) {
+			left->start = vecMin(left->start, a);
+			left->end = vecMax(left->end, a);
+		}
+		if (pa >= position) {
+			right->start = vecMin(right->start, a);
+			right->end = vecMax(right->end, a);
+		}
+		//Edges crossing the plane add their intersection point to both sides
+		if ((pa < position && pb > position) || (pa > position && pb < position)) {
+			struct vector crossing = vecAdd(a, vecScale(vecSub(b, a), (position - pa) / (pb - pa)));
+			setVecAxis(&crossing, axis, position);
+			left->start = vecMin(left->start, crossing);
+			left->end = vecMax(left->end, crossing);
+			right->start = vecMin(right->start, crossing);
+			right->end = vecMax(right->end, crossing);
+		}
+	}
+	//The reference may already have been clipped by earlier splits
+	left->start = vecMax(left->start, bounds.start);
+	left->end = vecMin(left->end, bounds.end);
+	right->start = vecMax(right->start, bounds.start);
+	right->end = vecMin(right->end, bounds.end);
+	left->midPoint = vecScale(vecAdd(left->start, left->end), 0.5f);
+	right->midPoint = vecScale(vecAdd(right->start, right->end), 0.5f);
+}
+
+int objectBin(struct vector centroid, int axis, float axisMin, float binScale) {
+	int bin = (int)((vecAxis(centroid, axis) - axisMin) * binScale);
+	return min(max(bin, 0), SBVH_OBJECT_BINS - 1);
+}
+
+struct sbvhSplit findObjectSplit(const struct sbvhRef *refs, int count, const struct boundingBox *centroidBounds) {
+	struct sbvhSplit best = {.cost = FLT_MAX, .axis = -1};
+	for (int axis = 0; axis < 3; ++axis) {
+		float axisMin = vecAxis(centroidBounds->start, axis);
+		float axisMax = vecAxis(centroidBounds->end, axis);
+		if (axisMax - axisMin <= 0.0f) continue;
+		float binScale = SBVH_OBJECT_BINS / (axisMax - axisMin);
+
+		struct sbvhBin bins[SBVH_OBJECT_BINS];
+		for (int i = 0; i < SBVH_OBJECT_BINS; ++i) {
+			bins[i] = (struct sbvhBin){emptyBoundingBox(), 0, 0};
+		}
+		for (int i = 0; i < count; ++i) {
+			struct sbvhBin *bin = &bins[objectBin(refs[i].bbox.midPoint, axis, axisMin, binScale)];
+			bin->bbox = combineBoundingBoxes(&bin->bbox, &refs[i].bbox);
+			bin->count++;
+		}
+
+		struct boundingBox rightBox[SBVH_OBJECT_BINS - 1];
+		int rightCount[SBVH_OBJECT_BINS - 1];
+		struct boundingBox accum = emptyBoundingBox();
+		int accumCount = 0;
+		for (int i = SBVH_OBJECT_BINS - 1; i > 0; --i) {
+			accum = combineBoundingBoxes(&accum, &bins[i].bbox);
+			accumCount += bins[i].count;
+			rightBox[i - 1] = accum;
+			rightCount[i - 1] = accumCount;
+		}
+
+		accum = emptyBoundingBox();
+		accumCount = 0;
+		for (int i = 0; i < SBVH_OBJECT_BINS - 1; ++i) {
+			accum = combineBoundingBoxes(&accum, &bins[i].bbox);
+			accumCount += bins[i].count;
+			if (!accumCount || !rightCount[i]) continue;
+			float cost = accumCount * findSurfaceArea(&accum) + rightCount[i] * findSurfaceArea(&rightBox[i]);
+			if (cost < best.cost) {
+				best = (struct sbvhSplit){cost, axis, i, 0.0f, accum, rightBox[i], accumCount, rightCount[i]};
+			}
+		}
+	}
+	return best;
+}
+
+struct sbvhSplit findSpatialSplit(const struct sbvhRef *refs, int count, const struct boundingBox *bounds) {
+	struct sbvhSplit best = {.cost = FLT_MAX, .axis = -1};
+	for (int axis = 0; axis < 3; ++axis) {
+		float axisMin = vecAxis(bounds->start, axis);
+		float binWidth = (vecAxis(bounds->end, axis) - axisMin) / SBVH_SPATIAL_BINS;
+		if (binWidth <= 0.0f) continue;
+
+		struct sbvhBin bins[SBVH_SPATIAL_BINS];
+		for (int i = 0; i < SBVH_SPATIAL_BINS; ++i) {
+			bins[i] = (struct sbvhBin){emptyBoundingBox(), 0, 0};
+		}
+		for (int i = 0; i < count; ++i) {
+			const struct sbvhRef *ref = &refs[i];
+			int first = min(max((int)((vecAxis(ref->bbox.start, axis) - axisMin) / binWidth), 0), SBVH_SPATIAL_BINS - 1);
+			int last = min(max((int)((vecAxis(ref->bbox.end, axis) - axisMin) / binWidth), first), SBVH_SPATIAL_BINS - 1);
+			//Chop the reference into pieces at every bin boundary it crosses
+			struct sbvhRef remainder = *ref;
+			for (int bin = first; bin < last; ++bin) {
+				struct boundingBox piece;
+				splitReference(&remainder, axis, axisMin + (bin + 1) * binWidth, &piece, &remainder.bbox);
+				if (!isEmptyBoundingBox(&piece)) bins[bin].bbox = combineBoundingBoxes(&bins[bin].bbox, &piece);
+			}
+			if (!isEmptyBoundingBox(&remainder.bbox)) bins[last].bbox = combineBoundingBoxes(&bins[last].bbox, &remainder.bbox);
+			bins[first].count++;
+			bins[last].exits++;
+		}
+
+		struct boundingBox rightBox[SBVH_SPATIAL_BINS - 1];
+		int rightCount[SBVH_SPATIAL_BINS - 1];
+		struct boundingBox accum = emptyBoundingBox();
+		int accumCount = 0;
+		for (int i = SBVH_SPATIAL_BINS - 1; i > 0; --i) {
+			accum = combineBoundingBoxes(&accum, &bins[i].bbox);
+			accumCount += bins[i].exits;
+			rightBox[i - 1] = accum;
+			rightCount[i - 1] = accumCount;
+		}
+
+		accum = emptyBoundingBox();
+		accumCount = 0;
+		for (int i = 0; i < SBVH_SPATIAL_BINS - 1; ++i) {
+			accum = combineBoundingBoxes(&accum, &bins[i].bbox);
+			accumCount += bins[i].count;
+			if (!accumCount || !rightCount[i]) continue;
+			float cost = accumCount * findSurfaceArea(&accum) + rightCount[i] * findSurfaceArea(&rightBox[i]);
+			if (cost < best.cost) {
+				best = (struct sbvhSplit){cost, axis, -1, axisMin + (i + 1) * binWidth, accum, rightBox[i], accumCount, rightCount[i]};
+			}
+		}
+	}
+	return best;
+}
+
+//References crossing the split plane are clipped to both sides
+void spatialPartition(const struct sbvhRef *refs, int count, const struct sbvhSplit *split, struct sbvhRef *left, int *leftCount, struct sbvhRef *right, int *rightCount) {
+	for (int i = 0; i < count; ++i) {
+		const struct sbvhRef *ref = &refs[i];
+		if (vecAxis(ref->bbox.end, split->axis) <= split->position) {
+			left[(*leftCount)++] = *ref;
+		} else if (vecAxis(ref->bbox.start, split->axis) >= split->position) {
+			right[(*rightCount)++] = *ref;
+		} else {
+			struct boundingBox leftBox, rightBox;
+			splitReference(ref, split->axis, split->position, &leftBox, &rightBox);
+			bool hasLeft = !isEmptyBoundingBox(&leftBox);
+			bool hasRight = !isEmptyBoundingBox(&rightBox);
+			if (hasLeft) left[(*leftCount)++] = (struct sbvhRef){leftBox, ref->poly};
+			if (hasRight) right[(*rightCount)++] = (struct sbvhRef){rightBox, ref->poly};
+			//Clipping can miss a sliver due to rounding, but never drop the polygon entirely
+			if (!hasLeft && !hasRight) left[(*leftCount)++] = *ref;
+		}
+	}
+}
+
+void objectPartition(const struct sbvhRef *refs, int count, const struct sbvhSplit *split, const struct boundingBox *centroidBounds, struct sbvhRef *left, int *leftCount, struct sbvhRef *right, int *rightCount) {
+	float axisMin = vecAxis(centroidBounds->start, split->axis);
+	float binScale = SBVH_OBJECT_BINS / (vecAxis(centroidBounds->end, split->axis) - axisMin);
+	for (int i = 0; i < count; ++i) {
+		if (objectBin(refs[i].bbox.midPoint, split->axis, axisMin, binScale) <= split->bin) {
+			left[(*leftCount)++] = refs[i];
+		} else {
+			right[(*rightCount)++] = refs[i];
+		}
+	}
+}
+
+int pushSbvhNode(struct sbvhBuilder *b) {
+	if (b->nodeCount == b->nodeCapacity) {
+		b->nodeCapacity *= 2;
+		b->nodes = realloc(b->nodes, b->nodeCapacity * sizeof(struct bvhNode));
+	}
+	return b->nodeCount++;
+}
+
+void makeSbvhLeaf(struct sbvhBuilder *b, int nodeIndex, const struct sbvhRef *refs, int count) {
+	if (b->primCount + count > b->primCapacity) {
+		b->primCapacity = max(b->primCapacity * 2, b->primCount + count);
+		b->primIndices = realloc(b->primIndices, b->primCapacity * sizeof(int));
+	}
+	b->nodes[nodeIndex].index = b->primCount;
+	b->nodes[nodeIndex].primCount = count;
+	for (int i = 0; i < count; ++i) {
+		b->primIndices[b->primCount++] = refs[i].poly;
+	}
+}
+
+//Takes ownership of refs. Returns the index of the node.
+int buildSbvhNode(struct sbvhBuilder *b, struct sbvhRef *refs, int count, int depth) {
+	//Nodes may move when the array grows, so only refer to them by index
+	int nodeIndex = pushSbvhNode(b);
+
+	struct boundingBox bbox = emptyBoundingBox();
+	struct boundingBox centroidBounds = emptyBoundingBox();
+	for (int i = 0; i < count; ++i) {
+		bbox = combineBoundingBoxes(&bbox, &refs[i].bbox);
+		centroidBounds.start = vecMin(centroidBounds.start, refs[i].bbox.midPoint);
+		centroidBounds.end = vecMax(centroidBounds.end, refs[i].bbox.midPoint);
+	}
+	b->nodes[nodeIndex].start = bbox.start;
+	b->nodes[nodeIndex].end = bbox.end;
+
+	struct sbvhSplit split = {.cost = FLT_MAX, .axis = -1};
+	bool spatial = false;
+	if (count > 1 && depth < SBVH_MAX_DEPTH) {
+		split = findObjectSplit(refs, count, &centroidBounds);
+		struct boundingBox overlap = {vecMax(split.left.start, split.right.start), vecMin(split.left.end, split.right.end), vecZero()};
+		float overlapArea = split.axis != -1 && !isEmptyBoundingBox(&overlap) ? findSurfaceArea(&overlap) : 0.0f;
+		if (count > SBVH_MIN_SPATIAL_SPLIT_COUNT && b->refCount < b->maxRefs && (split.axis == -1 || overlapArea > SBVH_OVERLAP_THRESHOLD * b->rootArea)) {
+			struct sbvhSplit spatialSplit = findSpatialSplit(refs, count, &bbox);
+			int duplicates = spatialSplit.leftCount + spatialSplit.rightCount - count;
+			if (spatialSplit.axis != -1 && spatialSplit.cost < split.cost && b->refCount + duplicates <= b->maxRefs) {
+				split = spatialSplit;
+				spatial = true;
+			}
+		}
+	}
+
+	bool leaf = count == 1;
+	if (!leaf && count <= SBVH_MAX_LEAF_SIZE) {
+		float parentArea = findSurfaceArea(&bbox);
+		float splitCost = split.axis != -1 && parentArea > 0.0f ? SBVH_TRAVERSAL_COST + SBVH_INTERSECT_COST * (split.cost / parentArea) : FLT_MAX;
+		leaf = splitCost >= SBVH_INTERSECT_COST * count;
+	}
+	if (leaf) {
+		makeSbvhLeaf(b, nodeIndex, refs, count);
+		free(refs);
+		return nodeIndex;
+	}
+
+	//Spatial splits can't produce more than count references per side
+	struct sbvhRef *left = malloc(count * sizeof(struct sbvhRef));
+	struct sbvhRef *right = malloc(count * sizeof(struct sbvhRef));
+	int leftCount = 0;
+	int rightCount = 0;
+	if (spatial) {
+		spatialPartition(refs, count, &split, left, &leftCount, right, &rightCount);
+		if (!leftCount || !rightCount) {
+			//Clipping disagreed with the binning, fall back to an object split
+			leftCount = rightCount = 0;
+			split = findObjectSplit(refs, count, &centroidBounds);
+		}
+	}
+	if (!leftCount && !rightCount && split.axis != -1) {
+		objectPartition(refs, count, &split, &centroidBounds, left, &leftCount, right, &rightCount);
+	}
+	if (!leftCount || !rightCount) {
+		//All centroids are in the same spot, or the tree is getting too deep. SAH can't help us here
+		leftCount = count / 2;
+		rightCount = count - leftCount;
+		memcpy(left, refs, leftCount * sizeof(struct sbvhRef));
+		memcpy(right, refs + leftCount, rightCount * sizeof(struct sbvhRef));
+	}
+	free(refs);
+	b->refCount += leftCount + rightCount - count;
+
+	//Left child always goes right after its parent
+	buildSbvhNode(b, left, leftCount, depth + 1);
+	int rightIndex = buildSbvhNode(b, right, rightCount, depth + 1);
+	b->nodes[nodeIndex].index = rightIndex;
+	b->nodes[nodeIndex].primCount = 0;
+	return nodeIndex;
+}
+
+struct bvh *buildSpatialBvh(const int *polygons, const int count, float budget) {
+	struct bvh *bvh = calloc(1, sizeof(struct bvh));
+	if (count == 0) return bvh;
+
+	struct sbvhRef *refs = malloc(count * sizeof(struct sbvhRef));
+	struct boundingBox rootBox = emptyBoundingBox();
+	for (int i = 0; i < count; ++i) {
+		refs[i] = (struct sbvhRef){computeBoundingBox(&polygons[i], 1), polygons[i]};
+		rootBox = combineBoundingBoxes(&rootBox, &refs[i].bbox);
+	}
+	int maxRefs = count + (int)(count * max(budget, 0.0f));
+	struct sbvhBuilder builder = {
+		.nodes = malloc(2 * maxRefs * sizeof(struct bvhNode)),
+		.nodeCapacity = 2 * maxRefs,
+		.primIndices = malloc(maxRefs * sizeof(int)),
+		.primCapacity = maxRefs,
+		.refCount = count,
+		.maxRefs = maxRefs,
+		.rootArea = findSurfaceArea(&rootBox)
+	};
+	buildSbvhNode(&builder, refs, count, 0);
+
+	storeBvhNodes(bvh, builder.nodes, builder.nodeCount);
+	bvh->primIndices = realloc(builder.primIndices, builder.primCount * sizeof(int));
+	bvh->primCount = builder.primCount;
+	bvh->buildCost = bvhSAHCost(bvh);
+	return bvh;
+}
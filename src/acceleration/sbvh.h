@@ -0,0 +1,20 @@
+//
+//  sbvh.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+struct bvh;
+
+/// Builds a BVH for a given array of polygons, using spatial splits where object splits leave children overlapping.
+/// Polygons straddling a spatial split are referenced from both sides, with their bounds clipped to each side,
+/// so primCount of the result can be larger than the polygon count.
+/// Refitting keeps the references but bounds them by whole polygons again, losing the clipping.
+/// @param polygons Array of polygon indices to process
+/// @param count Amount of polygons given
+/// @param budget Maximum amount of extra references to create, as a fraction of count
+struct bvh *buildSpatialBvh(const int *polygons, const int count, float budget);
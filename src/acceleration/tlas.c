@@ -0,0 +1,165 @@
+//
+//  tlas.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "tlas.h"
+#include "bvh.h"
+#include "bbox.h"
+
+#include "../renderer/pathtrace.h"
+#include "../datatypes/scene.h"
+#include "../datatypes/mesh.h"
+#include "../datatypes/sphere.h"
+#include "../datatypes/poly.h"
+#include "../datatypes/instance.h"
+
+struct boundingBox sphereBoundingBox(const struct sphere *sphere) {
+	struct vector radius = vecWithPos(sphere->radius, sphere->radius, sphere->radius);
+	return (struct boundingBox){vecSub(sphere->pos, radius), vecAdd(sphere->pos, radius), sphere->pos};
+}
+
+//Bounds of the corners of the mesh bounds, moved to world space
+struct boundingBox instanceBoundingBox(const struct instance *instance, const struct bvhNode *root) {
+	struct vector start = vecWithPos(FLT_MAX, FLT_MAX, FLT_MAX);
+	struct vector end = vecWithPos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < 8; ++i) {
+		struct vector corner = vecWithPos(i & 1 ? root->end.x : root->start.x,
+										  i & 2 ? root->end.y : root->start.y,
+										  i & 4 ? root->end.z : root->start.z);
+		transformVector(&corner, instance->transform.A);
+		start = vecMin(start, corner);
+		end = vecMax(end, corner);
+	}
+	return (struct boundingBox){start, end, vecScale(vecAdd(start, end), 0.5f)};
+}
+
+struct bvh *buildTopLevelBvh(const struct world *scene) {
+	int objectCount = scene->meshCount + scene->sphereCount + scene->instanceCount;
+	struct boundingBox *bboxes = calloc(objectCount, sizeof(struct boundingBox));
+	int *objects = malloc(objectCount * sizeof(int));
+	int count = 0;
+	for (int i = 0; i < scene->meshCount; ++i) {
+		const struct bvh *bvh = scene->meshes[i].bvh;
+		//Meshes without polygons have no nodes, and can't be hit anyway
+		if (!bvh || !bvh->nodeCount || scene->meshes[i].instanced) continue;
+		struct vector start = bvh->nodes[0].start;
+		struct vector end = bvh->nodes[0].end;
+		bboxes[count] = (struct boundingBox){start, end, vecScale(vecAdd(start, end), 0.5f)};
+		objects[count++] = i;
+	}
+	for (int i = 0; i < scene->sphereCount; ++i) {
+		bboxes[count] = sphereBoundingBox(&scene->spheres[i]);
+		objects[count++] = scene->meshCount + i;
+	}
+	for (int i = 0; i < scene->instanceCount; ++i) {
+		const struct bvh *bvh = scene->meshes[scene->instances[i].meshIndex].bvh;
+		if (!bvh || !bvh->nodeCount) continue;
+		bboxes[count] = instanceBoundingBox(&scene->instances[i], &bvh->nodes[0]);
+		objects[count++] = scene->meshCount + scene->sphereCount + i;
+	}
+	
+	struct bvh *bvh = buildBvhFromBoundingBoxes(bboxes, count, NULL);
+	//Map back to object indices
+	for (int i = 0; i < count; ++i) {
+		bvh->primIndices[i] = objects[bvh->primIndices[i]];
+	}
+	free(bboxes);
+	free(objects);
+	return bvh;
+}
+
+bool rayIntersectsWithObject(const struct world *scene, int object, const struct lightRay *ray, struct hitRecord *isect) {
+	if (object < scene->meshCount) {
+		if (rayIntersectsWithBvh(scene->meshes[object].bvh, ray, isect)) {
+			isect->object = object;
+			return true;
+		}
+	} else if (object < scene->meshCount + scene->sphereCount) {
+		if (rayIntersectsWithSphere(ray, &scene->spheres[object - scene->meshCount], isect)) {
+			isect->object = object;
+			return true;
+		}
+	} else {
+		const struct instance *instance = &scene->instances[object - scene->meshCount - scene->sphereCount];
+		const struct mesh *mesh = &scene->meshes[instance->meshIndex];
+		//Distances along the object space ray match world space, so isect->distance carries over as is
+		struct lightRay local = rayToInstance(instance, ray);
+		if (rayIntersectsWithBvh(mesh->bvh, &local, isect)) {
+			isect->object = object;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool rayIntersectsWithTopLevelBvh(const struct world *scene, const struct lightRay *ray, struct hitRecord *isect) {
+	const struct bvh *bvh = scene->topLevel;
+	if (!bvh->nodeCount) return false;
+	
+	float t;
+	if (!rayIntersectsWithNodeBounds(&bvh->nodes[0], ray, isect->distance, &t)) return false;
+	struct bvhStackEntry stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = (struct bvhStackEntry){0, t};
+	
+	bool hasHit = false;
+	while (stackSize > 0) {
+		struct bvhStackEntry entry = stack[--stackSize];
+		//Something closer may have been hit since this node was pushed
+		if (entry.t > isect->distance) continue;
+		const struct bvhNode *node = &bvh->nodes[entry.node];
+		
+		if (node->primCount) {
+			for (int i = node->index; i < node->index + node->primCount; ++i) {
+				if (rayIntersectsWithObject(scene, bvh->primIndices[i], ray, isect)) hasHit = true;
+			}
+			continue;
+		}
+		
+		stackSize = pushBvhChildren(bvh, entry.node, ray, isect->distance, stack, stackSize);
+	}
+	if (hasHit) isect->didIntersect = true;
+	return hasHit;
+}
+
+bool rayOccludesObject(const struct world *scene, int object, const struct lightRay *ray, float maxDistance) {
+	if (object < scene->meshCount) {
+		return rayOccludedByBvh(scene->meshes[object].bvh, ray, maxDistance);
+	} else if (object < scene->meshCount + scene->sphereCount) {
+		struct hitRecord isect;
+		isect.distance = maxDistance;
+		return rayIntersectsWithSphere(ray, &scene->spheres[object - scene->meshCount], &isect);
+	} else {
+		const struct instance *instance = &scene->instances[object - scene->meshCount - scene->sphereCount];
+		struct lightRay local = rayToInstance(instance, ray);
+		return rayOccludedByBvh(scene->meshes[instance->meshIndex].bvh, &local, maxDistance);
+	}
+}
+
+bool rayOccludedInScene(const struct world *scene, const struct lightRay *ray, float maxDistance) {
+	const struct bvh *bvh = scene->topLevel;
+	if (!bvh->nodeCount) return false;
+	
+	float t;
+	if (!rayIntersectsWithNodeBounds(&bvh->nodes[0], ray, maxDistance, &t)) return false;
+	struct bvhStackEntry stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = (struct bvhStackEntry){0, t};
+	while (stackSize > 0) {
+		int nodeIndex = stack[--stackSize].node;
+		const struct bvhNode *node = &bvh->nodes[nodeIndex];
+		if (node->primCount) {
+			for (int i = node->index; i < node->index + node->primCount; ++i) {
+				if (rayOccludesObject(scene, bvh->primIndices[i], ray, maxDistance)) return true;
+			}
+			continue;
+		}
+		stackSize = pushBvhChildren(bvh, nodeIndex, ray, maxDistance, stack, stackSize);
+	}
+	return false;
+}
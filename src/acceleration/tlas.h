@@ -0,0 +1,47 @@
+//
+//  tlas.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+struct bvh;
+struct world;
+struct lightRay;
+struct hitRecord;
+
+/*
+ The top-level BVH is built over the bounds of every mesh, sphere and instance in the scene.
+ Its primIndices are object indices: Values below meshCount refer to meshes,
+ then come spheres, offset by meshCount, and the rest are instances, offset by meshCount + sphereCount.
+ Meshes that are only placed through instances aren't in it themselves.
+ */
+
+/// Builds a top-level BVH over the meshes, spheres and instances of a given scene.
+/// Mesh BVHs have to be built before calling this.
+/// @param scene Scene to process
+struct bvh *buildTopLevelBvh(const struct world *scene);
+
+/// Check for an intersection between a ray and a single object of the top-level BVH, closer than the hit so far
+/// @param scene Scene the object belongs to
+/// @param object Object index, as stored in primIndices of the top-level BVH
+/// @param ray Ray to check intersection against
+/// @param isect Intersection information is saved to this struct, including the object index
+bool rayIntersectsWithObject(const struct world *scene, int object, const struct lightRay *ray, struct hitRecord *isect);
+
+/// Find the closest intersection between a ray and the objects of a scene.
+/// Objects are visited front-to-back, and skipped if they start further away than the closest hit so far.
+/// @note Only the polygon hit and its uv are found for meshes, surface properties are left to the caller.
+/// @param scene Scene to intersect with. topLevel has to be built.
+/// @param ray Ray to check intersection against
+/// @param isect Intersection information is saved to this struct
+bool rayIntersectsWithTopLevelBvh(const struct world *scene, const struct lightRay *ray, struct hitRecord *isect);
+
+/// Check if anything in a scene blocks a ray before a given distance, for shadow rays. Stops at the first blocker found.
+/// @param scene Scene to check. topLevel has to be built.
+/// @param ray Ray to check
+/// @param maxDistance Distance along the ray to check up to
+bool rayOccludedInScene(const struct world *scene, const struct lightRay *ray, float maxDistance);
@@ -0,0 +1,375 @@
+//
+//  widebvh.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "widebvh.h"
+#include "bvh.h"
+
+#include "../renderer/pathtrace.h"
+#include "../utils/memory.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define WIDE_BVH_SSE
+#include <xmmintrin.h>
+#endif
+
+//Unpacking the quantized bounds needs integer SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WIDE_BVH_SSE2
+#include <emmintrin.h>
+#endif
+
+#define WIDE_BVH_ALIGNMENT 64
+//Every node can push three more entries than it pops
+#define WIDE_BVH_STACK_SIZE (3 * BVH_STACK_SIZE)
+
+struct wideBvhBuilder {
+	const struct bvh *bvh;
+	struct wideBvhNode *nodes;
+	int nodeCount;
+};
+
+void setWideChild(struct wideBvhNode *node, int slot, const struct bvhNode *child) {
+	node->minX[slot] = child->start.x;
+	node->minY[slot] = child->start.y;
+	node->minZ[slot] = child->start.z;
+	node->maxX[slot] = child->end.x;
+	node->maxY[slot] = child->end.y;
+	node->maxZ[slot] = child->end.z;
+	node->index[slot] = child->index;
+	node->primCount[slot] = child->primCount;
+}
+
+void clearWideChild(struct wideBvhNode *node, int slot) {
+	node->minX[slot] = node->minY[slot] = node->minZ[slot] = FLT_MAX;
+	node->maxX[slot] = node->maxY[slot] = node->maxZ[slot] = -FLT_MAX;
+	node->index[slot] = -1;
+	node->primCount[slot] = 0;
+}
+
+//Returns the index of the new wide node
+int collapseBinaryNode(struct wideBvhBuilder *w, int binaryIndex) {
+	const struct bvhNode *binary = w->bvh->nodes;
+	int wideIndex = w->nodeCount++;
+	
+	int children[WIDE_BVH_WIDTH];
+	int childCount = 0;
+	if (binary[binaryIndex].primCount) {
+		//Only happens when the root is a leaf
+		children[childCount++] = binaryIndex;
+	} else {
+		children[childCount++] = binaryIndex + 1;
+		children[childCount++] = binary[binaryIndex].index;
+	}
+	
+	//Open up the largest interior child until the node is full
+	while (childCount < WIDE_BVH_WIDTH) {
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (int i = 0; i < childCount; ++i) {
+			if (binary[children[i]].primCount) continue;
+			float area = bvhNodeSurfaceArea(&binary[children[i]]);
+			if (area > largestArea) {
+				largestArea = area;
+				largest = i;
+			}
+		}
+		if (largest == -1) break;
+		int opened = children[largest];
+		children[largest] = opened + 1;
+		children[childCount++] = binary[opened].index;
+	}
+	
+	for (int i = 0; i < WIDE_BVH_WIDTH; ++i) {
+		if (i < childCount) {
+			setWideChild(&w->nodes[wideIndex], i, &binary[children[i]]);
+		} else {
+			clearWideChild(&w->nodes[wideIndex], i);
+		}
+	}
+	//Then collapse the interior children, depth-first
+	for (int i = 0; i < childCount; ++i) {
+		if (binary[children[i]].primCount) continue;
+		int childIndex = collapseBinaryNode(w, children[i]);
+		w->nodes[wideIndex].index[i] = childIndex;
+	}
+	return wideIndex;
+}
+
+void buildWideBvh(struct bvh *bvh) {
+	if (bvh->wideNodes) {
+		cray_aligned_free(bvh->wideNodes);
+		bvh->wideNodes = NULL;
+		bvh->wideNodeCount = 0;
+	}
+	if (!bvh->nodeCount) return;
+	
+	//Every wide node consumes at least one binary interior node, and there are (N - 1) / 2 of those
+	int maxNodes = max((bvh->nodeCount - 1) / 2, 1);
+	struct wideBvhBuilder builder = {
+		.bvh = bvh,
+		.nodes = cray_aligned_malloc(WIDE_BVH_ALIGNMENT, maxNodes * sizeof(struct wideBvhNode)),
+		.nodeCount = 0
+	};
+	collapseBinaryNode(&builder, 0);
+	bvh->wideNodes = builder.nodes;
+	bvh->wideNodeCount = builder.nodeCount;
+}
+
+//Quantization step for an exponent, built straight from the float bits
+float quantizationStep(int exponent) {
+	union {
+		uint32_t bits;
+		float value;
+	} step = { (uint32_t)(exponent + 127) << 23 };
+	return step.value;
+}
+
+//Both the quantizer and the traversal decode bounds with this, so the rounding checks below hold exactly
+float dequantize(float origin, int q, float step) {
+	return origin + (float)q * step;
+}
+
+uint8_t quantizeMin(float value, float origin, float step) {
+	int q = min(max((int)floorf((value - origin) / step), 0), UINT8_MAX);
+	while (q > 0 && dequantize(origin, q, step) > value) q--;
+	return q;
+}
+
+uint8_t quantizeMax(float value, float origin, float step) {
+	int q = min(max((int)ceilf((value - origin) / step), 0), UINT8_MAX);
+	while (q < UINT8_MAX && dequantize(origin, q, step) < value) q++;
+	return q;
+}
+
+//Pick the smallest step that still reaches from origin to end in 255 steps
+int quantizationExponent(float origin, float end) {
+	float extent = end - origin;
+	int exponent = extent > 0.0f ? (int)ceilf(log2f(extent / UINT8_MAX)) : -126;
+	exponent = min(max(exponent, -126), 127);
+	while (exponent < 127 && dequantize(origin, UINT8_MAX, quantizationStep(exponent)) < end) exponent++;
+	return exponent;
+}
+
+void quantizeWideNode(const struct wideBvhNode *node, struct quantizedBvhNode *q) {
+	int childCount = 0;
+	while (childCount < WIDE_BVH_WIDTH && node->index[childCount] != -1) childCount++;
+	
+	struct vector start = vecWithPos(FLT_MAX, FLT_MAX, FLT_MAX);
+	struct vector end = vecWithPos(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < childCount; ++i) {
+		start = vecMin(start, vecWithPos(node->minX[i], node->minY[i], node->minZ[i]));
+		end = vecMax(end, vecWithPos(node->maxX[i], node->maxY[i], node->maxZ[i]));
+	}
+	
+	memset(q, 0, sizeof(*q));
+	q->origin[0] = start.x;
+	q->origin[1] = start.y;
+	q->origin[2] = start.z;
+	q->exponent[0] = quantizationExponent(start.x, end.x);
+	q->exponent[1] = quantizationExponent(start.y, end.y);
+	q->exponent[2] = quantizationExponent(start.z, end.z);
+	q->childCount = childCount;
+	float stepX = quantizationStep(q->exponent[0]);
+	float stepY = quantizationStep(q->exponent[1]);
+	float stepZ = quantizationStep(q->exponent[2]);
+	for (int i = 0; i < WIDE_BVH_WIDTH; ++i) {
+		if (i < childCount) {
+			q->minX[i] = quantizeMin(node->minX[i], start.x, stepX);
+			q->minY[i] = quantizeMin(node->minY[i], start.y, stepY);
+			q->minZ[i] = quantizeMin(node->minZ[i], start.z, stepZ);
+			q->maxX[i] = quantizeMax(node->maxX[i], start.x, stepX);
+			q->maxY[i] = quantizeMax(node->maxY[i], start.y, stepY);
+			q->maxZ[i] = quantizeMax(node->maxZ[i], start.z, stepZ);
+			q->index[i] = node->index[i];
+			q->primCount[i] = node->primCount[i];
+		} else {
+			q->index[i] = -1;
+		}
+	}
+}
+
+bool quantizeWideBvh(struct bvh *bvh) {
+	if (!bvh->wideNodes) return false;
+	for (int i = 0; i < bvh->wideNodeCount; ++i) {
+		for (int c = 0; c < WIDE_BVH_WIDTH; ++c) {
+			if (bvh->wideNodes[i].primCount[c] > UINT8_MAX) return false;
+		}
+	}
+	if (bvh->quantizedNodes) cray_aligned_free(bvh->quantizedNodes);
+	bvh->quantizedNodes = cray_aligned_malloc(WIDE_BVH_ALIGNMENT, bvh->wideNodeCount * sizeof(struct quantizedBvhNode));
+	bvh->quantizedNodeCount = bvh->wideNodeCount;
+	for (int i = 0; i < bvh->wideNodeCount; ++i) {
+		quantizeWideNode(&bvh->wideNodes[i], &bvh->quantizedNodes[i]);
+	}
+	cray_aligned_free(bvh->wideNodes);
+	bvh->wideNodes = NULL;
+	bvh->wideNodeCount = 0;
+	return true;
+}
+
+#ifdef WIDE_BVH_SSE2
+void dequantizeAxis(const uint8_t *q, __m128 origin, __m128 step, float *out) {
+	int32_t packed;
+	memcpy(&packed, q, sizeof(packed));
+	__m128i zero = _mm_setzero_si128();
+	__m128i ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+	_mm_storeu_ps(out, _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(ints), step)));
+}
+#else
+void dequantizeAxis(const uint8_t *q, float origin, float step, float *out) {
+	for (int i = 0; i < WIDE_BVH_WIDTH; ++i) {
+		out[i] = dequantize(origin, q[i], step);
+	}
+}
+#endif
+
+//Expand a quantized node back to floats for the ray test. Returns a bitmask of the children in use.
+int dequantizeWideNode(const struct quantizedBvhNode *q, struct wideBvhNode *node) {
+#ifdef WIDE_BVH_SSE2
+	__m128 originX = _mm_set1_ps(q->origin[0]);
+	__m128 originY = _mm_set1_ps(q->origin[1]);
+	__m128 originZ = _mm_set1_ps(q->origin[2]);
+	__m128 stepX = _mm_set1_ps(quantizationStep(q->exponent[0]));
+	__m128 stepY = _mm_set1_ps(quantizationStep(q->exponent[1]));
+	__m128 stepZ = _mm_set1_ps(quantizationStep(q->exponent[2]));
+#else
+	float originX = q->origin[0];
+	float originY = q->origin[1];
+	float originZ = q->origin[2];
+	float stepX = quantizationStep(q->exponent[0]);
+	float stepY = quantizationStep(q->exponent[1]);
+	float stepZ = quantizationStep(q->exponent[2]);
+#endif
+	dequantizeAxis(q->minX, originX, stepX, node->minX);
+	dequantizeAxis(q->minY, originY, stepY, node->minY);
+	dequantizeAxis(q->minZ, originZ, stepZ, node->minZ);
+	dequantizeAxis(q->maxX, originX, stepX, node->maxX);
+	dequantizeAxis(q->maxY, originY, stepY, node->maxY);
+	dequantizeAxis(q->maxZ, originZ, stepZ, node->maxZ);
+	for (int i = 0; i < WIDE_BVH_WIDTH; ++i) {
+		node->index[i] = q->index[i];
+		node->primCount[i] = q->primCount[i];
+	}
+	return (1 << q->childCount) - 1;
+}
+
+//Returns a bitmask of the children hit, and their entry distances in t
+int rayIntersectsWithWideNode(const struct wideBvhNode *node, const struct lightRay *ray, float maxDistance, float *t) {
+	//Sign bits pick the near and far planes for each axis, like in rayIntersectsWithNodeBounds()
+	const float *nearX = ray->sign[0] ? node->maxX : node->minX;
+	const float *farX = ray->sign[0] ? node->minX : node->maxX;
+	const float *nearY = ray->sign[1] ? node->maxY : node->minY;
+	const float *farY = ray->sign[1] ? node->minY : node->maxY;
+	const float *nearZ = ray->sign[2] ? node->maxZ : node->minZ;
+	const float *farZ = ray->sign[2] ? node->minZ : node->maxZ;
+#ifdef WIDE_BVH_SSE
+	__m128 startX = _mm_set1_ps(ray->start.x);
+	__m128 startY = _mm_set1_ps(ray->start.y);
+	__m128 startZ = _mm_set1_ps(ray->start.z);
+	__m128 invX = _mm_set1_ps(ray->inverseDirection.x);
+	__m128 invY = _mm_set1_ps(ray->inverseDirection.y);
+	__m128 invZ = _mm_set1_ps(ray->inverseDirection.z);
+	
+	__m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearX), startX), invX);
+	__m128 tFar = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farX), startX), invX);
+	__m128 tNearY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearY), startY), invY);
+	__m128 tFarY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farY), startY), invY);
+	__m128 tNearZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearZ), startZ), invZ);
+	__m128 tFarZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farZ), startZ), invZ);
+	
+	//Operand order matches the scalar max()/min() macros, so NaNs are handled the same way
+	tNear = _mm_max_ps(_mm_max_ps(tNear, tNearY), _mm_max_ps(tNearZ, _mm_set1_ps(ray->tmin)));
+	tFar = _mm_min_ps(_mm_min_ps(tFar, tFarY), _mm_min_ps(tFarZ, _mm_set1_ps(maxDistance)));
+	_mm_storeu_ps(t, tNear);
+	return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+#else
+	int mask = 0;
+	for (int i = 0; i < WIDE_BVH_WIDTH; ++i) {
+		float tNear = (nearX[i] - ray->start.x) * ray->inverseDirection.x;
+		float tFar = (farX[i] - ray->start.x) * ray->inverseDirection.x;
+		float tNearY = (nearY[i] - ray->start.y) * ray->inverseDirection.y;
+		float tFarY = (farY[i] - ray->start.y) * ray->inverseDirection.y;
+		float tNearZ = (nearZ[i] - ray->start.z) * ray->inverseDirection.z;
+		float tFarZ = (farZ[i] - ray->start.z) * ray->inverseDirection.z;
+		tNear = max(max(tNear, tNearY), max(tNearZ, ray->tmin));
+		tFar = min(min(tFar, tFarY), min(tFarZ, maxDistance));
+		t[i] = tNear;
+		if (tNear <= tFar) mask |= 1 << i;
+	}
+	return mask;
+#endif
+}
+
+struct wideStackEntry {
+	int index;     //Wide node, or first index into primIndices for leaves
+	int primCount; //0 for interior nodes
+	float t;       //Distance the ray enters the node at
+};
+
+//With anyHit set, return as soon as any leaf has a hit within isect->distance, instead of looking for the closest one
+bool traverseWideBvh(const struct bvh *bvh, const struct lightRay *ray, struct hitRecord *isect, bool anyHit) {
+	struct wideStackEntry stack[WIDE_BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = (struct wideStackEntry){0, 0, ray->tmin};
+	
+	bool hasHit = false;
+	while (stackSize > 0) {
+		struct wideStackEntry entry = stack[--stackSize];
+		//Something closer may have been hit since this node was pushed
+		if (entry.t > isect->distance) continue;
+		
+		if (entry.primCount) {
+			if (rayIntersectsWithLeaf(bvh, entry.index, entry.primCount, ray, isect)) {
+				if (anyHit) return true;
+				hasHit = true;
+			}
+			continue;
+		}
+		
+		const struct wideBvhNode *node;
+		struct wideBvhNode decoded;
+		int childMask = (1 << WIDE_BVH_WIDTH) - 1;
+		if (bvh->quantizedNodes) {
+			childMask = dequantizeWideNode(&bvh->quantizedNodes[entry.index], &decoded);
+			node = &decoded;
+		} else {
+			node = &bvh->wideNodes[entry.index];
+		}
+		float t[WIDE_BVH_WIDTH];
+		int mask = rayIntersectsWithWideNode(node, ray, isect->distance, t) & childMask;
+		
+		//Push the children that were hit far to near, so the nearest one gets popped first
+		struct wideStackEntry hits[WIDE_BVH_WIDTH];
+		int hitCount = 0;
+		for (int i = 0; i < WIDE_BVH_WIDTH; ++i) {
+			if (!(mask & (1 << i))) continue;
+			int j = hitCount++;
+			while (j > 0 && hits[j - 1].t < t[i]) {
+				hits[j] = hits[j - 1];
+				j--;
+			}
+			hits[j] = (struct wideStackEntry){node->index[i], node->primCount[i], t[i]};
+		}
+		for (int i = 0; i < hitCount; ++i) {
+			stack[stackSize++] = hits[i];
+		}
+	}
+	if (hasHit) isect->didIntersect = true;
+	return hasHit;
+}
+
+bool rayIntersectsWithWideBvh(const struct bvh *bvh, const struct lightRay *ray, struct hitRecord *isect) {
+	return traverseWideBvh(bvh, ray, isect, false);
+}
+
+bool rayOccludedByWideBvh(const struct bvh *bvh, const struct lightRay *ray, float maxDistance) {
+	struct hitRecord isect;
+	isect.distance = maxDistance;
+	return traverseWideBvh(bvh, ray, &isect, true);
+}
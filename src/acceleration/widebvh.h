@@ -0,0 +1,64 @@
+//
+//  widebvh.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#define WIDE_BVH_WIDTH 4
+
+struct bvh;
+struct lightRay;
+struct hitRecord;
+
+/// A node with up to four children, with the child bounds stored as structure-of-arrays
+/// so one ray can be tested against all of them at once. 128 bytes, two cache lines.
+/// Unused child slots have inverted bounds, so rays never hit them.
+struct wideBvhNode {
+	float minX[WIDE_BVH_WIDTH], minY[WIDE_BVH_WIDTH], minZ[WIDE_BVH_WIDTH];
+	float maxX[WIDE_BVH_WIDTH], maxY[WIDE_BVH_WIDTH], maxZ[WIDE_BVH_WIDTH];
+	int index[WIDE_BVH_WIDTH];     //Interior: Index of the child node. Leaf: First index into primIndices
+	int primCount[WIDE_BVH_WIDTH]; //Amount of primitives in a leaf child, 0 for interior children
+};
+
+/// A wide node with the child bounds quantized to 8 bits within the bounds of the node itself. 64 bytes, one cache line.
+/// Quantized bounds are rounded outwards, so they always contain the exact ones. Leaves can have at most 255 primitives.
+struct quantizedBvhNode {
+	float origin[3]; //Minimum corner of the node
+	int index[WIDE_BVH_WIDTH]; //Interior: Index of the child node. Leaf: First index into primIndices
+	uint8_t minX[WIDE_BVH_WIDTH], minY[WIDE_BVH_WIDTH], minZ[WIDE_BVH_WIDTH];
+	uint8_t maxX[WIDE_BVH_WIDTH], maxY[WIDE_BVH_WIDTH], maxZ[WIDE_BVH_WIDTH];
+	uint8_t primCount[WIDE_BVH_WIDTH]; //Amount of primitives in a leaf child, 0 for interior children
+	int8_t exponent[3]; //Child bounds are origin + q * 2^exponent on each axis
+	uint8_t childCount; //Children are packed to the first slots
+	uint8_t padding[4];
+};
+
+/// Collapse the binary nodes of a polygon BVH into 4-wide nodes, which rayIntersectsWithBvh() then uses instead.
+/// Every interior node pulls in the largest of its grandchildren until it has four children.
+/// Calling this again rebuilds the wide nodes from the current binary ones.
+/// @param bvh BVH to collapse
+void buildWideBvh(struct bvh *bvh);
+
+/// Replace the wide nodes of a BVH with quantized ones, halving their size. The float wide nodes are freed,
+/// so after refitting, call buildWideBvh() and then this again.
+/// @param bvh BVH to quantize. buildWideBvh() has to be called first.
+/// @return false if the BVH has leaves too large to quantize, in which case the wide nodes are kept
+bool quantizeWideBvh(struct bvh *bvh);
+
+/// Traverses the wide nodes of a given BVH to find the closest intersection between a ray and a polygon in it
+/// @param bvh BVH to traverse. buildWideBvh() has to be called first, quantizeWideBvh() optionally after that.
+/// @param ray Ray to check intersection against
+/// @param isect Intersection information is saved to this struct
+bool rayIntersectsWithWideBvh(const struct bvh *bvh, const struct lightRay *ray, struct hitRecord *isect);
+
+/// Check if any polygon blocks a ray before a given distance, using the wide nodes. Stops at the first one found.
+/// @param bvh BVH to traverse. buildWideBvh() has to be called first, quantizeWideBvh() optionally after that.
+/// @param ray Ray to check
+/// @param maxDistance Distance along the ray to check up to
+bool rayOccludedByWideBvh(const struct bvh *bvh, const struct lightRay *ray, float maxDistance);
@@ -10,6 +10,7 @@
 #include "c-ray.h"
 
 #include "renderer/renderer.h"
+#include "renderer/adaptive.h"
 #include "datatypes/scene.h"
 #include "utils/gitsha1.h"
 #include "utils/logging.h"
@@ -68,14 +69,27 @@ void crDestroySDL() {
 void crWriteImage() {
 	if (currentImage) {
 		if (grenderer->state.saveImage) {
-			writeImage(currentImage, (struct renderInfo){
+			struct renderInfo info = {
 				.bounces = crGetBounces(),
 				.samples = crGetSampleCount(),
 				.crayVersion = crGetVersion(),
 				.gitHash = crGitHash(),
 				.renderTime = getMs(*grenderer->state.timer),
 				.threadCount = crGetThreadCount()
-			});
+			};
+			writeImage(currentImage, info);
+			//Save how many samples each pixel took next to the image, to check where adaptive sampling spent them
+			if (grenderer->state.adaptive) {
+				struct texture *samples = sampleCountImage(grenderer->state.adaptive, maxSampleCount(&grenderer->prefs));
+				samples->fileType = currentImage->fileType;
+				samples->count = currentImage->count;
+				copyString(currentImage->filePath, &samples->filePath);
+				size_t length = strlen(currentImage->fileName) + sizeof("_samples");
+				samples->fileName = malloc(length);
+				snprintf(samples->fileName, length, "%s_samples", currentImage->fileName);
+				writeImage(samples, info);
+				destroyTexture(samples);
+			}
 		} else {
 			logr(info, "Abort pressed, image won't be saved.\n");
 		}
@@ -120,6 +134,10 @@ int crLoadSceneFromBuf(char *buf) {
 	return loadScene(grenderer, buf);
 }
 
+int crReportAccelerators(char *jsonPath) {
+	return reportAccelerators(grenderer->scene, jsonPath);
+}
+
 void crSetRenderOrder(void) {
 	ASSERT_NOT_REACHED();
 }
@@ -252,7 +270,10 @@ void crRestartInteractive() {
 	ASSERT_NOT_REACHED();
 }
 
-void crTransformMesh(void); //Transform, recompute kd-tree, restart
+void crTransformMesh(int meshIndex, const struct transform *transform) {
+	ASSERT(meshIndex >= 0 && meshIndex < grenderer->scene->meshCount);
+	transformSceneMesh(grenderer, meshIndex, transform);
+}
 
 void crMoveCamera(void/*struct dimension delta*/);
 void crSetHDR(void);
@@ -33,6 +33,8 @@ void crDestroyRenderer(void);
 int crLoadSceneFromFile(char *filePath);
 int crLoadSceneFromBuf(char *buf);
 
+int crReportAccelerators(char *jsonPath); //Log acceleration structure health for the loaded scene, and write it to jsonPath if not NULL
+
 void crLoadMeshFromFile(char *filePath);
 void crLoadMeshFromBuf(char *buf);
 
@@ -82,7 +84,8 @@ void crPauseInteractive(void); //Toggle paused state
 void crGetCurrentImage(void); //Just get the current buffer
 void crRestartInteractive(void);
 
-void crTransformMesh(void); //Transform, recompute kd-tree, restart
+struct transform;
+void crTransformMesh(int meshIndex, const struct transform *transform); //Transform, refit BVH. Render again to see the result
 
 void crMoveCamera(void/*struct dimension delta*/);
 void crSetHDR(void);
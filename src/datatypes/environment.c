@@ -0,0 +1,239 @@
+//
+//  environment.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "environment.h"
+
+#include "texture.h"
+#include "color.h"
+#include "lights.h"
+#include "lightRay.h"
+
+float wrapMax(float x, float max) {
+	return fmod(max + fmod(x, max), max);
+}
+
+float wrapMinMax(float x, float min, float max) {
+	return min + wrapMax(x - min, max - min);
+}
+
+void environmentCoordinates(const struct texture *hdr, struct vector direction, float *u, float *v) {
+	//Unit direction vector
+	struct vector ud = vecNormalize(direction);
+	
+	//To polar from cartesian
+	float r = 1.0f; //Normalized above
+	float phi = (atan2f(ud.z, ud.x)/4) + hdr->offset;
+	float theta = acosf((-ud.y/r));
+	
+	*u = wrapMinMax(theta / PI, 0, 1);
+	*v = wrapMinMax(phi / (PI/2), 0, 1);
+}
+
+//Inverse of environmentCoordinates()
+struct vector environmentDirection(const struct texture *hdr, float u, float v) {
+	float theta = u * PI;
+	float phi = v * 2.0f * PI - 4.0f * hdr->offset;
+	float sinTheta = sinf(theta);
+	return (struct vector){sinTheta * cosf(phi), -cosf(theta), sinTheta * sinf(phi)};
+}
+
+//Octahedral coordinates of a direction, in [0, 1] on both axes with the upper hemisphere in the middle
+void octahedralCoordinates(struct vector direction, float *x, float *y) {
+	float length = fabsf(direction.x) + fabsf(direction.y) + fabsf(direction.z);
+	float px = direction.x / length;
+	float pz = direction.z / length;
+	//Fold the lower hemisphere out to the corners
+	float foldedX = copysignf(1.0f - fabsf(pz), px);
+	float foldedZ = copysignf(1.0f - fabsf(px), pz);
+	bool lower = direction.y < 0.0f;
+	*x = (lower ? foldedX : px) * 0.5f + 0.5f;
+	*y = (lower ? foldedZ : pz) * 0.5f + 0.5f;
+}
+
+//Inverse of octahedralCoordinates()
+struct vector octahedralDirection(float x, float y) {
+	float px = 2.0f * x - 1.0f;
+	float pz = 2.0f * y - 1.0f;
+	float py = 1.0f - fabsf(px) - fabsf(pz);
+	if (py < 0.0f) {
+		float foldedX = copysignf(1.0f - fabsf(pz), px);
+		float foldedZ = copysignf(1.0f - fabsf(px), pz);
+		px = foldedX;
+		pz = foldedZ;
+	}
+	return vecNormalize((struct vector){px, py, pz});
+}
+
+struct octahedralMap *newOctahedralMap(const struct texture *hdr) {
+	struct octahedralMap *map = calloc(1, sizeof(struct octahedralMap));
+	//The equator runs along the diamond in the middle, 2 * sqrt(2) times the size around, so this keeps
+	//twice the detail the original has there, in as many texels as the original
+	map->size = min(max((int)(hdr->width / sqrtf(2.0f)), 1), OCTAHEDRAL_MAX_SIZE);
+	map->data = malloc(map->size * map->size * 3 * sizeof(float));
+	for (int y = 0; y < map->size; ++y) {
+		for (int x = 0; x < map->size; ++x) {
+			float u, v;
+			environmentCoordinates(hdr, octahedralDirection((x + 0.5f) / map->size, (y + 0.5f) / map->size), &u, &v);
+			struct color color = textureGetPixelFiltered(hdr, v * hdr->width, u * hdr->height);
+			float *texel = &map->data[(y * map->size + x) * 3];
+			texel[0] = color.red;
+			texel[1] = color.green;
+			texel[2] = color.blue;
+		}
+	}
+	return map;
+}
+
+struct color octahedralLookup(const struct octahedralMap *map, struct vector direction) {
+	float u, v;
+	octahedralCoordinates(direction, &u, &v);
+	float x = u * map->size - 0.5f;
+	float y = v * map->size - 0.5f;
+	float floorX = floorf(x);
+	float floorY = floorf(y);
+	float tx = x - floorX;
+	float ty = y - floorY;
+	//Clamped at the edges, where the folds meet
+	int last = map->size - 1;
+	int x0 = min(max((int)floorX, 0), last);
+	int x1 = min(max((int)floorX + 1, 0), last);
+	int y0 = min(max((int)floorY, 0), last);
+	int y1 = min(max((int)floorY + 1, 0), last);
+	const float *row0 = &map->data[y0 * map->size * 3];
+	const float *row1 = &map->data[y1 * map->size * 3];
+	float w00 = (1.0f - tx) * (1.0f - ty);
+	float w10 = tx * (1.0f - ty);
+	float w01 = (1.0f - tx) * ty;
+	float w11 = tx * ty;
+	struct color color;
+	color.red = w00 * row0[x0 * 3 + 0] + w10 * row0[x1 * 3 + 0] + w01 * row1[x0 * 3 + 0] + w11 * row1[x1 * 3 + 0];
+	color.green = w00 * row0[x0 * 3 + 1] + w10 * row0[x1 * 3 + 1] + w01 * row1[x0 * 3 + 1] + w11 * row1[x1 * 3 + 1];
+	color.blue = w00 * row0[x0 * 3 + 2] + w10 * row0[x1 * 3 + 2] + w01 * row1[x0 * 3 + 2] + w11 * row1[x1 * 3 + 2];
+	color.alpha = 1.0f;
+	return color;
+}
+
+void destroyOctahedralMap(struct octahedralMap *map) {
+	if (map) {
+		free(map->data);
+		free(map);
+	}
+}
+
+//Normalize a running sum to end at 1. Spreads evenly if there's nothing to sum.
+void normalizeCdf(float *cdf, int count) {
+	float total = cdf[count - 1];
+	for (int i = 0; i < count; ++i) {
+		cdf[i] = total > 0.0f ? cdf[i] / total : (float)(i + 1) / count;
+	}
+}
+
+//Index of the first entry of a running sum above u
+int searchCdf(const float *cdf, int count, float u) {
+	int low = 0;
+	int high = count - 1;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (cdf[middle] <= u) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+float cdfProbability(const float *cdf, int index) {
+	return cdf[index] - (index ? cdf[index - 1] : 0.0f);
+}
+
+struct environmentMap *newEnvironmentMap(const struct texture *hdr, const struct octahedralMap *background) {
+	int width = hdr->width;
+	int height = hdr->height;
+	if (!width || !height) return NULL;
+	struct environmentMap *map = calloc(1, sizeof(struct environmentMap));
+	map->hdr = hdr;
+	map->background = background;
+	map->width = width;
+	map->height = height;
+	map->marginal = malloc(height * sizeof(float));
+	map->conditional = malloc(width * height * sizeof(float));
+	
+	float total = 0.0f;
+	for (int y = 0; y < height; ++y) {
+		float sinTheta = sinf(PI * (y + 0.5f) / height);
+		float *row = &map->conditional[y * width];
+		float rowTotal = 0.0f;
+		for (int x = 0; x < width; ++x) {
+			struct color pixel = textureGetPixel(hdr, x, y);
+			float luminance = 0.2126f * pixel.red + 0.7152f * pixel.green + 0.0722f * pixel.blue;
+			rowTotal += max(luminance, 0.0f) * sinTheta;
+			row[x] = rowTotal;
+		}
+		normalizeCdf(row, width);
+		total += rowTotal;
+		map->marginal[y] = total;
+	}
+	if (total <= 0.0f) {
+		destroyEnvironmentMap(map);
+		return NULL;
+	}
+	normalizeCdf(map->marginal, height);
+	return map;
+}
+
+//Density of a texel, over the whole map with an area of 1
+float texelPdf(const struct environmentMap *map, int x, int y) {
+	float probability = cdfProbability(map->marginal, y) * cdfProbability(&map->conditional[y * map->width], x);
+	return probability * map->width * map->height;
+}
+
+//The map covers 2 * PI * PI of theta and phi, and a patch of it covers sin(theta) times its area in solid angle
+float solidAnglePdf(float pdf, float u) {
+	float sinTheta = sinf(u * PI);
+	if (sinTheta <= 0.0f) return 0.0f;
+	return pdf / (2.0f * PI * PI * sinTheta);
+}
+
+//Where u fell between the running sum before index and at index, uniform in [0, 1)
+float cdfRemainder(const float *cdf, int index, float u) {
+	float start = index ? cdf[index - 1] : 0.0f;
+	return min(max((u - start) / cdfProbability(cdf, index), 0.0f), 0.99999994f);
+}
+
+bool sampleEnvironment(const struct environmentMap *map, struct coord point, struct lightSample *sample) {
+	int y = searchCdf(map->marginal, map->height, point.x);
+	const float *row = &map->conditional[y * map->width];
+	int x = searchCdf(row, map->width, point.y);
+	//Uniformly within the texel, reusing what's left of the point after picking it
+	float u = (y + cdfRemainder(map->marginal, y, point.x)) / map->height;
+	float v = (x + cdfRemainder(row, x, point.y)) / map->width;
+	sample->pdf = solidAnglePdf(texelPdf(map, x, y), u);
+	if (sample->pdf <= 0.0f) return false;
+	sample->direction = vecNormalize(environmentDirection(map->hdr, u, v));
+	sample->distance = RAY_MAX_DISTANCE;
+	sample->emission = octahedralLookup(map->background, sample->direction);
+	return true;
+}
+
+float environmentPdf(const struct environmentMap *map, struct vector direction) {
+	float u, v;
+	environmentCoordinates(map->hdr, direction, &u, &v);
+	int x = min((int)(v * map->width), map->width - 1);
+	int y = min((int)(u * map->height), map->height - 1);
+	return solidAnglePdf(texelPdf(map, x, y), u);
+}
+
+void destroyEnvironmentMap(struct environmentMap *map) {
+	if (map) {
+		free(map->marginal);
+		free(map->conditional);
+		free(map);
+	}
+}
@@ -0,0 +1,75 @@
+//
+//  environment.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include "vector.h"
+
+struct texture;
+struct lightSample;
+struct color;
+
+//Octahedral maps are resampled to at most this many texels across
+#define OCTAHEDRAL_MAX_SIZE 2048
+
+/// An HDR environment map resampled to an octahedral layout, with its offset baked in.
+/// The sphere of directions is projected onto an octahedron, and the lower half folded over the upper one into a square,
+/// so looking up a direction only takes a few adds and multiplies.
+struct octahedralMap {
+	float *data; //RGB, in rows of size texels
+	int size;
+};
+
+/// Distribution for sampling an HDR environment map in proportion to its brightness.
+/// Texels are weighted by luminance times sin(theta), to account for the rows shrinking towards the poles.
+struct environmentMap {
+	const struct texture *hdr;
+	const struct octahedralMap *background;
+	float *marginal; //Running sum over the rows, normalized to end at 1
+	float *conditional; //Running sum within each row, normalized to end at 1
+	int width;
+	int height;
+};
+
+/// Resample a latitude-longitude HDR map to an octahedral one, with about as many texels as the original
+/// @param hdr Map with its offset set
+struct octahedralMap *newOctahedralMap(const struct texture *hdr);
+
+/// Bilinearly filtered color of an octahedral map towards a direction
+/// @param map Map to look up
+/// @param direction Direction to look towards, doesn't need to be normalized
+struct color octahedralLookup(const struct octahedralMap *map, struct vector direction);
+
+void destroyOctahedralMap(struct octahedralMap *map);
+
+/// Build the sampling distribution for an HDR environment map
+/// @param hdr Map with its offset set
+/// @param background The same map resampled for lookups, to get the emission of sampled directions from
+/// @return NULL if the map is completely black
+struct environmentMap *newEnvironmentMap(const struct texture *hdr, const struct octahedralMap *background);
+
+/// Map a direction to the coordinates of an environment map, both wrapped to [0, 1]
+/// @param hdr Environment map
+/// @param direction Direction to look towards, doesn't need to be normalized
+/// @param u Vertical coordinate, from straight down to straight up
+/// @param v Horizontal coordinate
+void environmentCoordinates(const struct texture *hdr, struct vector direction, float *u, float *v);
+
+/// Sample a direction towards the environment
+/// @param map Distribution to sample
+/// @param point Uniform point in the unit square
+/// @param sample Set to the sampled direction, its density and the environment color there. distance is infinite.
+/// @return false if the sampled direction has no density
+bool sampleEnvironment(const struct environmentMap *map, struct coord point, struct lightSample *sample);
+
+/// Solid angle density of sampleEnvironment() picking a direction
+/// @param map Distribution that would have been sampled
+/// @param direction Normalized direction
+float environmentPdf(const struct environmentMap *map, struct vector direction);
+
+void destroyEnvironmentMap(struct environmentMap *map);
@@ -0,0 +1,48 @@
+//
+//  instance.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "instance.h"
+
+#include "material.h"
+
+struct instance newInstance(int meshIndex) {
+	return (struct instance){meshIndex, newTransform(), NULL};
+}
+
+void addInstanceTransform(struct instance *instance, struct transform transform) {
+	instance->transform.type = transformTypeMultiplication;
+	instance->transform.A = multiplyMatrices(transform.A, instance->transform.A);
+	//Undo the new transform first
+	instance->transform.Ainv = multiplyMatrices(instance->transform.Ainv, transform.Ainv);
+}
+
+struct lightRay rayToInstance(const struct instance *instance, const struct lightRay *ray) {
+	struct vector start = ray->start;
+	struct vector direction = ray->direction;
+	transformVector(&start, instance->transform.Ainv);
+	transformDirection(&direction, instance->transform.Ainv);
+	struct lightRay local = newRay(start, direction, ray->rayType);
+	local.tmin = ray->tmin;
+	local.tmax = ray->tmax;
+	return local;
+}
+
+void instanceToWorld(const struct instance *instance, struct vector *point, struct vector *normal) {
+	transformVector(point, instance->transform.A);
+	//Normals use the inverse transpose, like in transformMesh()
+	transformDirection(normal, transpose(instance->transform.Ainv));
+	*normal = vecNormalize(*normal);
+}
+
+void destroyInstance(struct instance *instance) {
+	if (instance->material) {
+		destroyMaterial(instance->material);
+		free(instance->material);
+	}
+}
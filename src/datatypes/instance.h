@@ -0,0 +1,45 @@
+//
+//  instance.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include "transforms.h"
+#include "lightRay.h"
+
+struct material;
+
+/// A placement of a mesh in the scene. Instances share the geometry and BVH of their mesh,
+/// rays are moved into the object space of the mesh instead.
+struct instance {
+	int meshIndex;
+	struct transform transform; //Object space to world space in A, world space to object space in Ainv
+	struct material *material; //Used for every polygon instead of the mesh materials, if set
+};
+
+/// Create an instance of a mesh, placed where the mesh itself is
+/// @param meshIndex Index of the mesh in world.meshes
+struct instance newInstance(int meshIndex);
+
+/// Apply a transform to an instance, on top of the ones already applied
+/// @param instance Instance to transform
+/// @param transform Transform to apply
+void addInstanceTransform(struct instance *instance, struct transform transform);
+
+/// Move a ray into the object space of an instance. The direction is not normalized,
+/// so distances along the new ray are the same as along the original one.
+/// @param instance Instance to move the ray into
+/// @param ray Ray in world space
+struct lightRay rayToInstance(const struct instance *instance, const struct lightRay *ray);
+
+/// Move a hit point and surface normal from the object space of an instance to world space
+/// @param instance Instance that was hit
+/// @param point Point to transform
+/// @param normal Normal to transform. Normalized afterwards.
+void instanceToWorld(const struct instance *instance, struct vector *point, struct vector *normal);
+
+void destroyInstance(struct instance *instance);
@@ -10,7 +10,17 @@
 #include "lightRay.h"
 
 struct lightRay newRay(struct vector start, struct vector direction, enum type rayType) {
-	return (struct lightRay){start, direction, rayType};
+	struct lightRay ray;
+	ray.start = start;
+	ray.direction = direction;
+	ray.rayType = rayType;
+	ray.tmin = 0.0f;
+	ray.tmax = RAY_MAX_DISTANCE;
+	ray.inverseDirection = vecWithPos(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	ray.sign[0] = ray.inverseDirection.x < 0.0f;
+	ray.sign[1] = ray.inverseDirection.y < 0.0f;
+	ray.sign[2] = ray.inverseDirection.z < 0.0f;
+	return ray;
 }
 
 struct vector alongRay(struct lightRay ray, float t) {
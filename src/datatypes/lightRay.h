@@ -15,16 +15,31 @@ enum type {
 	rayTypeIncident,
 	rayTypeScattered,
 	rayTypeReflected,
-	rayTypeRefracted
+	rayTypeRefracted,
+	rayTypeShadow
 };
 
+//Rays don't look for hits further than this
+#define RAY_MAX_DISTANCE 20000.0f
+
 //Simulated light ray
 struct lightRay {
 	struct vector start;
 	struct vector direction;
 	enum type rayType;
+	
+	//Valid distance range along the ray
+	float tmin, tmax;
+	
+	//Precomputed for box intersection tests, set by newRay()
+	struct vector inverseDirection;
+	int sign[3]; //1 if the direction component is negative
 };
 
+/// Create a new ray, and precompute what the acceleration structures need to traverse it
+/// @param start Origin of the ray
+/// @param direction Direction of the ray
+/// @param rayType Type of the ray
 struct lightRay newRay(struct vector start, struct vector direction, enum type rayType);
 
 struct vector alongRay(struct lightRay ray, float t);
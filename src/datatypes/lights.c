@@ -0,0 +1,243 @@
+//
+//  lights.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "lights.h"
+
+#include "scene.h"
+#include "mesh.h"
+#include "sphere.h"
+#include "instance.h"
+#include "poly.h"
+#include "vertexbuffer.h"
+#include "lightRay.h"
+#include "../renderer/pathtrace.h"
+#include "../acceleration/lightbvh.h"
+
+bool isEmissive(const struct material *material) {
+	return max(material->emission.red, max(material->emission.green, material->emission.blue)) > 0.0f;
+}
+
+float lightPower(const struct light *light) {
+	struct color emission = light->material->emission;
+	return light->area * (emission.red + emission.green + emission.blue) / 3.0f;
+}
+
+struct light triangleLight(struct vector v0, struct vector v1, struct vector v2, const struct material *material) {
+	struct light light = {0};
+	light.type = lightTypeTriangle;
+	light.material = material;
+	light.v0 = v0;
+	light.edge1 = vecSub(v1, v0);
+	light.edge2 = vecSub(v2, v0);
+	light.area = 0.5f * vecLength(vecCross(light.edge1, light.edge2));
+	return light;
+}
+
+//Lights are never skipped, even without any area, so the emissive polygons of a mesh map to consecutive lights
+void addLight(struct lightList *list, int *capacity, struct light light) {
+	if (list->count == *capacity) {
+		*capacity = max(*capacity * 2, 16);
+		list->lights = realloc(list->lights, *capacity * sizeof(struct light));
+	}
+	list->lights[list->count++] = light;
+}
+
+//Number the emissive polygons of a mesh, to find their lights when they're hit
+int *emissivePolygons(const struct mesh *mesh) {
+	int *polygons = NULL;
+	int count = 0;
+	for (int i = 0; i < mesh->polyCount; ++i) {
+		const struct poly *p = &polygonArray[mesh->firstPolyIndex + i];
+		bool emissive = isEmissive(&mesh->materials[p->materialIndex]);
+		if (emissive && !polygons) {
+			polygons = malloc(mesh->polyCount * sizeof(int));
+			for (int j = 0; j < i; ++j) polygons[j] = -1;
+		}
+		if (polygons) polygons[i] = emissive ? count++ : -1;
+	}
+	return polygons;
+}
+
+void addMeshLights(struct lightList *list, int *capacity, const struct mesh *mesh, const struct instance *instance, int object) {
+	int first = list->count;
+	for (int i = mesh->firstPolyIndex; i < mesh->firstPolyIndex + mesh->polyCount; ++i) {
+		const struct poly *p = &polygonArray[i];
+		const struct material *material = instance && instance->material ? instance->material : &mesh->materials[p->materialIndex];
+		if (!isEmissive(material)) continue;
+		struct vector v[3];
+		for (int j = 0; j < 3; ++j) {
+			v[j] = vertexArray[p->vertexIndex[j]];
+			if (instance) transformVector(&v[j], instance->transform.A);
+		}
+		addLight(list, capacity, triangleLight(v[0], v[1], v[2], material));
+	}
+	list->objectLights[object] = list->count > first ? first : -1;
+}
+
+struct lightList *buildLightList(const struct world *scene) {
+	struct lightList *list = calloc(1, sizeof(struct lightList));
+	int capacity = 0;
+	int objectCount = scene->meshCount + scene->sphereCount + scene->instanceCount;
+	list->objectLights = malloc(max(objectCount, 1) * sizeof(int));
+	list->polygonLights = calloc(max(scene->meshCount, 1), sizeof(int *));
+	list->meshCount = scene->meshCount;
+	for (int i = 0; i < scene->meshCount; ++i) {
+		list->polygonLights[i] = emissivePolygons(&scene->meshes[i]);
+		list->objectLights[i] = -1;
+		if (scene->meshes[i].instanced) continue;
+		addMeshLights(list, &capacity, &scene->meshes[i], NULL, i);
+	}
+	for (int i = 0; i < scene->sphereCount; ++i) {
+		const struct sphere *sphere = &scene->spheres[i];
+		int object = scene->meshCount + i;
+		list->objectLights[object] = -1;
+		if (!isEmissive(&sphere->material)) continue;
+		struct light light = {0};
+		light.type = lightTypeSphere;
+		light.material = &sphere->material;
+		light.center = sphere->pos;
+		light.radius = sphere->radius;
+		light.area = 4.0f * PI * sphere->radius * sphere->radius;
+		list->objectLights[object] = list->count;
+		addLight(list, &capacity, light);
+	}
+	for (int i = 0; i < scene->instanceCount; ++i) {
+		const struct instance *instance = &scene->instances[i];
+		addMeshLights(list, &capacity, &scene->meshes[instance->meshIndex], instance, scene->meshCount + scene->sphereCount + i);
+	}
+	
+	if (list->count) list->bvh = buildLightBvh(list->lights, list->count);
+	return list;
+}
+
+//Index of the light a path hit, -1 if it isn't one
+int lightForHit(const struct world *scene, const struct hitRecord *isect) {
+	const struct lightList *list = scene->lights;
+	int first = list->objectLights[isect->object];
+	if (first < 0 || isect->type == hitTypeSphere) return first;
+	int meshIndex = isect->object;
+	const struct instance *instance = NULL;
+	if (isect->object >= scene->meshCount) {
+		instance = &scene->instances[isect->object - scene->meshCount - scene->sphereCount];
+		meshIndex = instance->meshIndex;
+	}
+	int polygon = isect->polyIndex - scene->meshes[meshIndex].firstPolyIndex;
+	//Every polygon of an instance with its own emissive material is a light
+	if (instance && instance->material) return first + polygon;
+	int index = list->polygonLights[meshIndex] ? list->polygonLights[meshIndex][polygon] : -1;
+	return index < 0 ? -1 : first + index;
+}
+
+//Cosine of the half angle of the cone a sphere covers, as seen from point. 1 from inside the sphere
+float sphereConeCosine(struct vector center, float radius, struct vector point) {
+	struct vector toCenter = vecSub(center, point);
+	float distanceSquared = vecDot(toCenter, toCenter);
+	float radiusSquared = radius * radius;
+	if (distanceSquared <= radiusSquared) return 1.0f;
+	return sqrtf(max(0.0f, 1.0f - radiusSquared / distanceSquared));
+}
+
+//Uniformly sample the cone of directions the sphere covers, as seen from point
+bool sampleSphereLight(const struct light *light, struct vector point, struct coord uniform, struct lightSample *sample) {
+	struct vector toCenter = vecSub(light->center, point);
+	float distanceSquared = vecDot(toCenter, toCenter);
+	float radiusSquared = light->radius * light->radius;
+	if (distanceSquared <= radiusSquared) return false;
+	
+	float cosThetaMax = sqrtf(max(0.0f, 1.0f - radiusSquared / distanceSquared));
+	float cosTheta = 1.0f - uniform.x * (1.0f - cosThetaMax);
+	float sinTheta = sqrtf(max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2.0f * PI * uniform.y;
+	
+	//Orthonormal basis around the direction to the center
+	struct vector w = vecScale(toCenter, 1.0f / sqrtf(distanceSquared));
+	struct vector a = fabsf(w.x) > 0.9f ? (struct vector){0.0f, 1.0f, 0.0f} : (struct vector){1.0f, 0.0f, 0.0f};
+	struct vector u = vecNormalize(vecCross(a, w));
+	struct vector v = vecCross(w, u);
+	sample->direction = vecNormalize(vecAdd(vecScale(w, cosTheta), vecAdd(vecScale(u, sinTheta * cosf(phi)), vecScale(v, sinTheta * sinf(phi)))));
+	
+	//Distance to the near side of the sphere along the sampled direction
+	float b = vecDot(sample->direction, toCenter);
+	float c = distanceSquared - radiusSquared;
+	float discriminant = max(0.0f, b * b - c);
+	sample->distance = b - sqrtf(discriminant);
+	sample->pdf = 1.0f / (2.0f * PI * (1.0f - cosThetaMax));
+	return sample->distance > 0.0f && cosThetaMax < 1.0f;
+}
+
+//Uniformly sample the area of the triangle, and convert the density to solid angle
+bool sampleTriangleLight(const struct light *light, struct vector point, struct coord uniform, struct lightSample *sample) {
+	float root = sqrtf(uniform.x);
+	float u = 1.0f - root;
+	float v = uniform.y * root;
+	struct vector onLight = vecAdd(light->v0, vecAdd(vecScale(light->edge1, u), vecScale(light->edge2, v)));
+	struct vector toLight = vecSub(onLight, point);
+	float distanceSquared = vecDot(toLight, toLight);
+	if (distanceSquared <= 0.0f) return false;
+	sample->distance = sqrtf(distanceSquared);
+	sample->direction = vecScale(toLight, 1.0f / sample->distance);
+	//Emissive polygons light both of their sides, just like when a path hits them
+	struct vector normal = vecNormalize(vecCross(light->edge1, light->edge2));
+	float cosine = fabsf(vecDot(normal, sample->direction));
+	if (cosine < 0.00001f) return false;
+	sample->pdf = distanceSquared / (cosine * light->area);
+	return true;
+}
+
+bool sampleLight(const struct lightList *list, struct vector point, float pick, struct coord onLight, struct lightSample *sample) {
+	if (!list || !list->count) return false;
+	float probability;
+	int index = pickLightFromBvh(list->bvh, point, pick, &probability);
+	if (index < 0 || probability <= 0.0f) return false;
+	const struct light *light = &list->lights[index];
+	if (light->area <= 0.0f) return false;
+	bool sampled = light->type == lightTypeSphere ? sampleSphereLight(light, point, onLight, sample) : sampleTriangleLight(light, point, onLight, sample);
+	if (!sampled) return false;
+	sample->pdf *= probability;
+	sample->emission = light->material->emission;
+	return true;
+}
+
+float lightPdf(const struct world *scene, const struct hitRecord *isect) {
+	const struct lightList *list = scene->lights;
+	if (!list || !list->count) return 0.0f;
+	int index = lightForHit(scene, isect);
+	if (index < 0) return 0.0f;
+	const struct light *light = &list->lights[index];
+	struct vector origin = isect->incident.start;
+	float probability = lightBvhProbability(list->bvh, index, origin);
+	if (probability <= 0.0f) return 0.0f;
+	if (light->type == lightTypeSphere) {
+		float cosThetaMax = sphereConeCosine(light->center, light->radius, origin);
+		if (cosThetaMax >= 1.0f) return 0.0f;
+		return probability / (2.0f * PI * (1.0f - cosThetaMax));
+	}
+	
+	if (light->area <= 0.0f) return 0.0f;
+	//The hit distance is in units of the incident direction, so don't assume it's normalized
+	float length = vecLength(isect->incident.direction);
+	float distance = isect->distance * length;
+	struct vector normal = vecNormalize(vecCross(light->edge1, light->edge2));
+	float cosine = fabsf(vecDot(normal, isect->incident.direction)) / length;
+	if (cosine < 0.00001f) return 0.0f;
+	return probability * distance * distance / (cosine * light->area);
+}
+
+void destroyLightList(struct lightList *list) {
+	if (list) {
+		for (int i = 0; i < list->meshCount; ++i) {
+			free(list->polygonLights[i]);
+		}
+		free(list->polygonLights);
+		free(list->objectLights);
+		destroyLightBvh(list->bvh);
+		free(list->lights);
+		free(list);
+	}
+}
@@ -0,0 +1,81 @@
+//
+//  lights.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include "vector.h"
+#include "color.h"
+
+struct world;
+struct material;
+struct hitRecord;
+struct lightBvh;
+
+enum lightType {
+	lightTypeSphere,
+	lightTypeTriangle
+};
+
+/// Something emissive in the scene, that can be sampled directly: an emissive sphere,
+/// or one emissive triangle of a mesh or instance, in world space.
+struct light {
+	enum lightType type;
+	const struct material *material;
+	struct vector v0, edge1, edge2; //Triangle
+	struct vector center; //Sphere
+	float radius;
+	float area;
+};
+
+/// Every light of a scene, picked through a light BVH in proportion to how much they could light a point
+struct lightList {
+	struct light *lights;
+	int count;
+	struct lightBvh *bvh;
+	
+	//To find the light a path hit
+	int *objectLights; //First light of each object of the top level BVH, -1 if it has none
+	int **polygonLights; //For each mesh with emissive materials, which of its emissive polygons each polygon is. -1 if it isn't.
+	int meshCount;
+};
+
+/// A point sampled on a light, as seen from a point being shaded
+struct lightSample {
+	struct vector direction; //Normalized, from the shaded point to the light
+	float distance; //Along direction, to the sampled point
+	float pdf; //Solid angle density of direction, including the probability of picking the light
+	struct color emission;
+};
+
+/// Collect the emissive spheres and triangles of a scene, and build a light BVH over them. Emissive meshes are collected
+/// through the objects of the top level BVH, so instanced meshes are collected once for each instance.
+/// @param scene Scene with its meshes transformed into place
+struct lightList *buildLightList(const struct world *scene);
+
+/// Pick a light that could light a given point, and a point on it that can be seen from there
+/// @param list Lights to pick from
+/// @param point Point being shaded
+/// @param pick Uniform value to pick the light with
+/// @param onLight Uniform point in the unit square, to pick the point on the light with
+/// @param sample Set to the sampled direction and its density
+/// @return false if nothing could be sampled, like when the point is inside a spherical light
+bool sampleLight(const struct lightList *list, struct vector point, float pick, struct coord onLight, struct lightSample *sample);
+
+/// Density sampleLight() would have picked the point a ray hit an emissive surface at with, from the start of the ray
+/// @param scene Scene with its lights collected
+/// @param isect Hit on an emissive surface, with its surface computed
+/// @return Solid angle density, including the probability of picking the light. 0 if sampleLight() can't reach the point.
+float lightPdf(const struct world *scene, const struct hitRecord *isect);
+
+/// Rough power of a light, only used to pick lights
+float lightPower(const struct light *light);
+
+/// @return true if a material emits any light
+bool isEmissive(const struct material *material);
+
+void destroyLightList(struct lightList *list);
@@ -10,6 +10,7 @@
 #include "material.h"
 
 #include "../renderer/pathtrace.h"
+#include "../renderer/sampler.h"
 #include "vertexbuffer.h"
 #include "texture.h"
 #include "poly.h"
@@ -84,21 +85,33 @@ void assignBSDF(struct material *mat) {
 	switch (mat->type) {
 		case lambertian:
 			mat->bsdf = lambertianBSDF;
+			mat->evalBSDF = lambertianEval;
+			mat->pdfBSDF = lambertianPdf;
 			break;
 		case metal:
 			mat->bsdf = metallicBSDF;
+			mat->evalBSDF = metallicEval;
+			mat->pdfBSDF = metallicPdf;
 			break;
 		case emission:
 			mat->bsdf = emissiveBSDF;
+			mat->evalBSDF = specularEval;
+			mat->pdfBSDF = specularPdf;
 			break;
 		case glass:
 			mat->bsdf = dielectricBSDF;
+			mat->evalBSDF = specularEval;
+			mat->pdfBSDF = specularPdf;
 			break;
 		case plastic:
 			mat->bsdf = plasticBSDF;
+			mat->evalBSDF = plasticEval;
+			mat->pdfBSDF = plasticPdf;
 			break;
 		default:
 			mat->bsdf = lambertianBSDF;
+			mat->evalBSDF = lambertianEval;
+			mat->pdfBSDF = lambertianPdf;
 			break;
 	}
 }
@@ -107,12 +120,12 @@ void assignBSDF(struct material *mat) {
 //And grab the color at that point. Texture mapping.
 struct color colorForUV(struct hitRecord *isect) {
 	struct color output;
-	struct material mtl = isect->end;
+	const struct material *mtl = isect->material;
 	struct poly p = polygonArray[isect->polyIndex];
 	
 	//Texture width and height for this material
-	float width = mtl.texture->width;
-	float heigh = mtl.texture->height;
+	float width = mtl->texture->width;
+	float heigh = mtl->texture->height;
 
 	//barycentric coordinates for this polygon
 	float u = isect->uv.x;
@@ -131,7 +144,7 @@ struct color colorForUV(struct hitRecord *isect) {
 	float y = (textureXY.y*(heigh));
 	
 	//Get the color value at these XY coordinates
-	output = textureGetPixelFiltered(mtl.texture, x, y);
+	output = textureGetPixelFiltered(mtl->texture, x, y);
 	
 	//Since the texture is probably srgb, transform it back to linear colorspace for rendering
 	//FIXME: Maybe ask lodepng if we actually need to do this transform
@@ -153,7 +166,7 @@ struct color gradient(struct hitRecord *isect) {
 //This is a checkerboard pattern mapped to the surface coordinate space
 //Caveat: This only works for meshes that have texture coordinates (i.e. were UV-unwrapped).
 struct color mappedCheckerBoard(struct hitRecord *isect, float coef) {
-	ASSERT(isect->end.hasTexture);
+	ASSERT(isect->material->hasTexture);
 	struct poly p = polygonArray[isect->polyIndex];
 	
 	//barycentric coordinates for this polygon
@@ -190,7 +203,7 @@ struct color unmappedCheckerBoard(struct hitRecord *isect, float coef) {
 }
 
 struct color checkerBoard(struct hitRecord *isect, float coef) {
-	return isect->end.hasTexture ? mappedCheckerBoard(isect, coef) : unmappedCheckerBoard(isect, coef);
+	return isect->material->hasTexture ? mappedCheckerBoard(isect, coef) : unmappedCheckerBoard(isect, coef);
 }
 
 /**
@@ -205,37 +218,31 @@ struct vector reflectVec(const struct vector *incident, const struct vector *nor
 	return vecSub(*incident, vecScale(*normal, reflect));
 }
 
-struct vector randomInUnitSphere(pcg32_random_t *rng) {
-	struct vector vec;
-	do {
-		vec = vecScale(vecWithPos(rndFloat(rng), rndFloat(rng), rndFloat(rng)), 2.0f);
-		vec = vecSub(vec, (vector){1.0f, 1.0f, 1.0f});
-	} while (vecLengthSquared(vec) >= 1.0f);
-	return vec;
+//Mapped directly instead of rejection sampled, so every sample takes the same dimensions
+struct vector randomOnUnitSphere(struct sampler *sampler) {
+	struct coord point = getDimension2D(sampler);
+	float z = 1.0f - 2.0f * point.x;
+	float r = sqrtf(max(0.0f, 1.0f - z * z));
+	float phi = 2.0f * PI * point.y;
+	return (struct vector){r * cosf(phi), r * sinf(phi), z};
 }
 
-struct vector randomOnUnitSphere(pcg32_random_t *rng) {
-	struct vector vec;
-	do {
-		vec = vecScale(vecWithPos(rndFloat(rng), rndFloat(rng), rndFloat(rng)), 2.0f);
-		vec = vecSub(vec, (vector){1.0f, 1.0f, 1.0f});
-	} while (vecLengthSquared(vec) >= 1.0f);
-	return vecNormalize(vec);
+struct vector randomInUnitSphere(struct sampler *sampler) {
+	struct vector direction = randomOnUnitSphere(sampler);
+	return vecScale(direction, cbrtf(getDimension(sampler)));
 }
 
-bool emissiveBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng) {
+bool emissiveBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample) {
 	(void)isect;
-	(void)attenuation;
-	(void)scattered;
-	(void)rng;
+	(void)sampler;
+	(void)sample;
 	return false;
 }
 
-bool weightedBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng) {
+bool weightedBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample) {
 	(void)isect;
-	(void)attenuation;
-	(void)scattered;
-	(void)rng;
+	(void)sampler;
+	(void)sample;
 	/*
 	 This will be the internal shader weighting solver that runs a random distribution and chooses from the available
 	 discrete shaders.
@@ -244,32 +251,94 @@ bool weightedBSDF(struct hitRecord *isect, struct color *attenuation, struct lig
 	return false;
 }
 
+//Purely specular BSDFs only scatter in discrete directions, which eval and pdf leave out
+struct color specularEval(struct hitRecord *isect, struct vector direction) {
+	(void)isect;
+	(void)direction;
+	return (struct color){0.0f, 0.0f, 0.0f, 0.0f};
+}
+
+float specularPdf(struct hitRecord *isect, struct vector direction) {
+	(void)isect;
+	(void)direction;
+	return 0.0f;
+}
+
 //TODO: Make this a function ptr in the material?
 struct color diffuseColor(struct hitRecord *isect) {
-	return isect->end.hasTexture ? colorForUV(isect) : isect->end.diffuse;
+	return isect->material->hasTexture ? colorForUV(isect) : isect->material->diffuse;
 }
 
-bool lambertianBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng) {
-	struct vector temp = vecAdd(isect->hitPoint, isect->surfaceNormal);
-	struct vector rand = randomInUnitSphere(rng);
-	struct vector scatterDir = vecSub(vecAdd(temp, rand), isect->hitPoint); //Randomized scatter direction
-	*scattered = ((struct lightRay){isect->hitPoint, scatterDir, rayTypeScattered});
-	*attenuation = diffuseColor(isect);
-	return true;
+float lambertianPdf(struct hitRecord *isect, struct vector direction) {
+	return max(vecDot(isect->surfaceNormal, direction), 0.0f) / PI;
 }
 
-bool metallicBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng) {
+struct color lambertianEval(struct hitRecord *isect, struct vector direction) {
+	return colorCoef(lambertianPdf(isect, direction), diffuseColor(isect));
+}
+
+bool lambertianBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample) {
+	//A point on the unit sphere touching the surface gives a cosine weighted direction
+	struct vector scatterDir = vecNormalize(vecAdd(isect->surfaceNormal, randomOnUnitSphere(sampler)));
+	sample->scattered = newRay(isect->hitPoint, scatterDir, rayTypeScattered);
+	//The cosine and 1 / PI of the BRDF cancel out with the density
+	sample->weight = diffuseColor(isect);
+	sample->pdf = lambertianPdf(isect, scatterDir);
+	return sample->pdf > 0.0f;
+}
+
+struct vector reflectIncident(struct hitRecord *isect) {
 	struct vector normalizedDir = vecNormalize(isect->incident.direction);
-	struct vector reflected = reflectVec(&normalizedDir, &isect->surfaceNormal);
-	//Roughness
-	if (isect->end.roughness > 0.0f) {
-		struct vector fuzz = vecScale(randomInUnitSphere(rng), isect->end.roughness);
+	return reflectVec(&normalizedDir, &isect->surfaceNormal);
+}
+
+/**
+ Solid angle density of the direction of reflected + roughness * u, with u uniform in the unit ball.
+ Integrates the ball along the direction, between where it enters and leaves it.
+ 
+ @param reflected Normalized mirror direction
+ @param roughness Radius of the ball
+ @param direction Normalized direction to find the density for
+ @return Density, 0 if the ball doesn't cover the direction
+ */
+float fuzzPdf(struct vector reflected, float roughness, struct vector direction) {
+	float b = vecDot(direction, reflected);
+	float discriminant = b * b - (1.0f - roughness * roughness);
+	if (discriminant <= 0.0f) return 0.0f;
+	float root = sqrtf(discriminant);
+	float far = b + root;
+	if (far <= 0.0f) return 0.0f;
+	//Starts inside the ball if roughness is over 1
+	float near = max(b - root, 0.0f);
+	return (far * far * far - near * near * near) / (4.0f * PI * roughness * roughness * roughness);
+}
+
+//Reflection with the mirror direction fuzzed by roughness. Zero roughness is a perfect mirror.
+struct vector fuzzedReflection(struct hitRecord *isect, struct sampler *sampler) {
+	struct vector reflected = reflectIncident(isect);
+	if (isect->material->roughness > 0.0f) {
+		struct vector fuzz = vecScale(randomInUnitSphere(sampler), isect->material->roughness);
 		reflected = vecAdd(reflected, fuzz);
 	}
-	
-	*scattered = newRay(isect->hitPoint, reflected, rayTypeReflected);
-	*attenuation = diffuseColor(isect);
-	return (vecDot(scattered->direction, isect->surfaceNormal) > 0.0f);
+	return vecNormalize(reflected);
+}
+
+float metallicPdf(struct hitRecord *isect, struct vector direction) {
+	if (isect->material->roughness <= 0.0f || vecDot(direction, isect->surfaceNormal) <= 0.0f) return 0.0f;
+	return fuzzPdf(reflectIncident(isect), isect->material->roughness, direction);
+}
+
+//Fuzzed directions that end up below the surface are absorbed, so the metal reflects its color times the density
+struct color metallicEval(struct hitRecord *isect, struct vector direction) {
+	return colorCoef(metallicPdf(isect, direction), diffuseColor(isect));
+}
+
+bool metallicBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample) {
+	struct vector reflected = fuzzedReflection(isect, sampler);
+	sample->scattered = newRay(isect->hitPoint, reflected, rayTypeReflected);
+	sample->weight = diffuseColor(isect);
+	sample->pdf = metallicPdf(isect, reflected);
+	return (vecDot(reflected, isect->surfaceNormal) > 0.0f);
 }
 
 bool refract(struct vector in, struct vector normal, float niOverNt, struct vector *refracted) {
@@ -294,93 +363,115 @@ float shlick(float cosine, float IOR) {
 	return r0 + (1.0f - r0) * powf((1.0f - cosine), 5.0f);
 }
 
-bool shinyBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng) {
-	struct vector reflected = reflectVec(&isect->incident.direction, &isect->surfaceNormal);
-	*attenuation = whiteColor;
-	//Roughness
-	if (isect->end.roughness > 0.0f) {
-		struct vector fuzz = vecScale(randomInUnitSphere(rng), isect->end.roughness);
-		reflected = vecAdd(reflected, fuzz);
-	}
-	*scattered = newRay(isect->hitPoint, reflected, rayTypeReflected);
-	return true;
-}
-
-// Glossy plastic
-bool plasticBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng) {
+//Probability of the glossy coat of plastic reflecting, instead of the diffuse base underneath
+float plasticReflectance(struct hitRecord *isect) {
 	struct vector outwardNormal;
-	struct vector reflected = reflectVec(&isect->incident.direction, &isect->surfaceNormal);
-	float niOverNt;
-	*attenuation = diffuseColor(isect);
 	struct vector refracted;
-	float reflectionProbability;
+	float niOverNt;
 	float cosine;
 	
 	//TODO: Maybe don't hard code it like this.
-	isect->end.IOR = 1.45f; // Car paint
+	float IOR = 1.45f; // Car paint
 	if (vecDot(isect->incident.direction, isect->surfaceNormal) > 0.0f) {
 		outwardNormal = vecNegate(isect->surfaceNormal);
-		niOverNt = isect->end.IOR;
-		cosine = isect->end.IOR * vecDot(isect->incident.direction, isect->surfaceNormal) / vecLength(isect->incident.direction);
+		niOverNt = IOR;
+		cosine = IOR * vecDot(isect->incident.direction, isect->surfaceNormal) / vecLength(isect->incident.direction);
 	} else {
 		outwardNormal = isect->surfaceNormal;
-		niOverNt = 1.0f / isect->end.IOR;
+		niOverNt = 1.0f / IOR;
 		cosine = -(vecDot(isect->incident.direction, isect->surfaceNormal) / vecLength(isect->incident.direction));
 	}
 	
 	if (refract(isect->incident.direction, outwardNormal, niOverNt, &refracted)) {
-		reflectionProbability = shlick(cosine, isect->end.IOR);
+		return shlick(cosine, IOR);
 	} else {
-		*scattered = newRay(isect->hitPoint, reflected, rayTypeReflected);
-		reflectionProbability = 1.0f;
+		return 1.0f;
 	}
-	
-	if (rndFloat(rng) < reflectionProbability) {
-		return shinyBSDF(isect, attenuation, scattered, rng);
+}
+
+//Density of the coat, only when it's rough. A smooth coat is a specular lobe.
+float glossyPdf(struct hitRecord *isect, struct vector direction) {
+	if (isect->material->roughness <= 0.0f || vecDot(direction, isect->surfaceNormal) <= 0.0f) return 0.0f;
+	return fuzzPdf(reflectIncident(isect), isect->material->roughness, direction);
+}
+
+float plasticPdf(struct hitRecord *isect, struct vector direction) {
+	float reflectance = plasticReflectance(isect);
+	return reflectance * glossyPdf(isect, direction) + (1.0f - reflectance) * lambertianPdf(isect, direction);
+}
+
+//The coat reflects white, the base its diffuse color
+struct color plasticEval(struct hitRecord *isect, struct vector direction) {
+	float reflectance = plasticReflectance(isect);
+	struct color glossy = colorCoef(reflectance * glossyPdf(isect, direction), whiteColor);
+	return addColors(glossy, colorCoef(1.0f - reflectance, lambertianEval(isect, direction)));
+}
+
+// Glossy plastic
+bool plasticBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample) {
+	struct vector direction;
+	bool coat = getDimension(sampler) < plasticReflectance(isect);
+	if (coat) {
+		direction = fuzzedReflection(isect, sampler);
+		sample->scattered = newRay(isect->hitPoint, direction, rayTypeReflected);
 	} else {
-		return lambertianBSDF(isect, attenuation, scattered, rng);
+		direction = vecNormalize(vecAdd(isect->surfaceNormal, randomOnUnitSphere(sampler)));
+		sample->scattered = newRay(isect->hitPoint, direction, rayTypeScattered);
+	}
+	
+	//Like metal, fuzzed coat reflections that end up below the surface are absorbed
+	if (coat && vecDot(direction, isect->surfaceNormal) <= 0.0f) return false;
+	if (coat && isect->material->roughness <= 0.0f) {
+		//Mirror reflection off a smooth coat
+		sample->weight = whiteColor;
+		sample->pdf = 0.0f;
+		return true;
 	}
+	//Either lobe could have scattered towards a rough direction, so weight it by both
+	sample->pdf = plasticPdf(isect, direction);
+	if (sample->pdf <= 0.0f) return false;
+	sample->weight = colorCoef(1.0f / sample->pdf, plasticEval(isect, direction));
 	return true;
 }
 
 // Only works on spheres for now. Reflections work but refractions don't
-bool dielectricBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng) {
+bool dielectricBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample) {
 	struct vector outwardNormal;
 	struct vector reflected = reflectVec(&isect->incident.direction, &isect->surfaceNormal);
 	float niOverNt;
-	*attenuation = diffuseColor(isect);
+	sample->weight = diffuseColor(isect);
+	sample->pdf = 0.0f;
 	struct vector refracted;
 	float reflectionProbability;
 	float cosine;
 	
 	if (vecDot(isect->incident.direction, isect->surfaceNormal) > 0.0f) {
 		outwardNormal = vecNegate(isect->surfaceNormal);
-		niOverNt = isect->end.IOR;
-		cosine = isect->end.IOR * vecDot(isect->incident.direction, isect->surfaceNormal) / vecLength(isect->incident.direction);
+		niOverNt = isect->material->IOR;
+		cosine = isect->material->IOR * vecDot(isect->incident.direction, isect->surfaceNormal) / vecLength(isect->incident.direction);
 	} else {
 		outwardNormal = isect->surfaceNormal;
-		niOverNt = 1.0f / isect->end.IOR;
+		niOverNt = 1.0f / isect->material->IOR;
 		cosine = -(vecDot(isect->incident.direction, isect->surfaceNormal) / vecLength(isect->incident.direction));
 	}
 	
 	if (refract(isect->incident.direction, outwardNormal, niOverNt, &refracted)) {
-		reflectionProbability = shlick(cosine, isect->end.IOR);
+		reflectionProbability = shlick(cosine, isect->material->IOR);
 	} else {
-		*scattered = newRay(isect->hitPoint, reflected, rayTypeReflected);
 		reflectionProbability = 1.0f;
 	}
 	
 	//Roughness
-	if (isect->end.roughness > 0.0f) {
-		struct vector fuzz = vecScale(randomInUnitSphere(rng), isect->end.roughness);
+	if (isect->material->roughness > 0.0f) {
+		struct vector fuzz = vecScale(randomInUnitSphere(sampler), isect->material->roughness);
 		reflected = vecAdd(reflected, fuzz);
 		refracted = vecAdd(refracted, fuzz);
 	}
 	
-	if (rndFloat(rng) < reflectionProbability) {
-		*scattered = newRay(isect->hitPoint, reflected, rayTypeReflected);
+	if (getDimension(sampler) < reflectionProbability) {
+		sample->scattered = newRay(isect->hitPoint, vecNormalize(reflected), rayTypeReflected);
 	} else {
-		*scattered = newRay(isect->hitPoint, refracted, rayTypeRefracted);
+		sample->scattered = newRay(isect->hitPoint, vecNormalize(refracted), rayTypeRefracted);
 	}
 	return true;
 }
@@ -9,6 +9,7 @@
 #pragma once
 
 #include "color.h"
+#include "vector.h"
 
 /*
  From: https://blenderartists.org/forum/showthread.php?71202-Material-IOR-Value-reference
@@ -46,6 +47,8 @@
 
 struct lightRay;
 struct hitRecord;
+struct bsdfSample;
+struct sampler;
 
 enum bsdfType {
 	emission = 0,
@@ -60,7 +63,7 @@ enum bsdfType {
 struct bsdf {
 	enum bsdfType type;
 	float weights;
-	bool (*bsdf)(struct hitRecord*, struct color*, struct lightRay*, pcg32_random_t*);
+	bool (*bsdf)(struct hitRecord*, struct sampler*, struct bsdfSample*);
 };
 
 struct material {
@@ -91,8 +94,12 @@ struct material {
 	// - Normalize probabilities
 	
 	enum bsdfType type;
-	//isect record, ray, attenuation color, scattered ray, rng
-	bool (*bsdf)(struct hitRecord*, struct color*, struct lightRay*, pcg32_random_t*);
+	//isect record, sampler, scattered ray with its weight and density. false if the path is absorbed
+	bool (*bsdf)(struct hitRecord*, struct sampler*, struct bsdfSample*);
+	//isect record, normalized direction. BSDF times cosine towards the direction, without specular lobes
+	struct color (*evalBSDF)(struct hitRecord*, struct vector);
+	//isect record, normalized direction. Solid angle density of bsdf() scattering towards the direction, without specular lobes
+	float (*pdfBSDF)(struct hitRecord*, struct vector);
 };
 
 //temporary newMaterial func
@@ -114,11 +121,21 @@ struct material emptyMaterial(void);
 struct material defaultMaterial(void);
 struct material warningMaterial(void);
 
-bool   emissiveBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng);
-bool lambertianBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng);
-bool   metallicBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng);
-bool    plasticBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng);
-bool dielectricBSDF(struct hitRecord *isect, struct color *attenuation, struct lightRay *scattered, pcg32_random_t *rng);
+bool   emissiveBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample);
+bool lambertianBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample);
+bool   metallicBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample);
+bool    plasticBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample);
+bool dielectricBSDF(struct hitRecord *isect, struct sampler *sampler, struct bsdfSample *sample);
+
+struct color  specularEval(struct hitRecord *isect, struct vector direction);
+struct color lambertianEval(struct hitRecord *isect, struct vector direction);
+struct color  metallicEval(struct hitRecord *isect, struct vector direction);
+struct color   plasticEval(struct hitRecord *isect, struct vector direction);
+
+float  specularPdf(struct hitRecord *isect, struct vector direction);
+float lambertianPdf(struct hitRecord *isect, struct vector direction);
+float  metallicPdf(struct hitRecord *isect, struct vector direction);
+float   plasticPdf(struct hitRecord *isect, struct vector direction);
 
 void assignBSDF(struct material *mat);
 
@@ -9,7 +9,7 @@
 #include "../includes.h"
 #include "mesh.h"
 
-#include "../acceleration/kdtree.h"
+#include "../acceleration/bvh.h"
 #include "vertexbuffer.h"
 #include "transforms.h"
 #include "poly.h"
@@ -26,30 +26,34 @@ void addTransform(struct mesh *mesh, struct transform transform) {
 	mesh->transformCount++;
 }
 
+void applyTransform(struct mesh *mesh, const struct transform *transform, bool *tformed, bool *ntformed) {
+	for (int p = mesh->firstPolyIndex; p < (mesh->firstPolyIndex + mesh->polyCount); ++p) {
+		for (int v = 0; v < polygonArray[p].vertexCount; ++v) {
+			//vec
+			if (!tformed[polygonArray[p].vertexIndex[v] - mesh->firstVectorIndex]) {
+				transformVector(&vertexArray[polygonArray[p].vertexIndex[v]], transform->A);
+				tformed[polygonArray[p].vertexIndex[v] - mesh->firstVectorIndex] = true;
+			}
+		}
+	}
+	for (int n = mesh->firstNormalIndex; n < (mesh->firstNormalIndex + mesh->normalCount); ++n) {
+		//normal, skip translates and do inverse transpose
+		if (!ntformed[n - mesh->firstNormalIndex]) {
+			if (transform->type != transformTypeTranslate) {
+				transformVector(&normalArray[n], transpose(transform->Ainv));
+				ntformed[n - mesh->firstNormalIndex] = true;
+			}
+		}
+	}
+}
+
 void transformMesh(struct mesh *mesh) {
 	//Bit of a hack here, using way more memory than needed. Should also work on 32-bit now
 	bool *tformed = (bool *)calloc(mesh->vertexCount, sizeof(bool));
 	bool *ntformed = (bool *)calloc(mesh->normalCount, sizeof(bool));
 	for (int tf = 0; tf < mesh->transformCount; ++tf) {
 		//Perform transforms
-		for (int p = mesh->firstPolyIndex; p < (mesh->firstPolyIndex + mesh->polyCount); ++p) {
-			for (int v = 0; v < polygonArray[p].vertexCount; ++v) {
-				//vec
-				if (!tformed[polygonArray[p].vertexIndex[v] - mesh->firstVectorIndex]) {
-					transformVector(&vertexArray[polygonArray[p].vertexIndex[v]], mesh->transforms[tf].A);
-					tformed[polygonArray[p].vertexIndex[v] - mesh->firstVectorIndex] = true;
-				}
-			}
-		}
-		for (int n = mesh->firstNormalIndex; n < (mesh->firstNormalIndex + mesh->normalCount); ++n) {
-			//normal, skip translates and do inverse transpose
-			if (!ntformed[n - mesh->firstNormalIndex]) {
-				if (mesh->transforms[tf].type != transformTypeTranslate) {
-					transformVector(&normalArray[n], transpose(mesh->transforms[tf].Ainv));
-					ntformed[n - mesh->firstNormalIndex] = true;
-				}
-			}
-		}
+		applyTransform(mesh, &mesh->transforms[tf], tformed, ntformed);
 		//Clear isTransformed flags
 		memset(tformed, 0, mesh->vertexCount * sizeof(bool));
 		memset(ntformed, 0, mesh->normalCount * sizeof(bool));
@@ -58,6 +62,14 @@ void transformMesh(struct mesh *mesh) {
 	free(ntformed);
 }
 
+void transformMeshWith(struct mesh *mesh, const struct transform *transform) {
+	bool *tformed = (bool *)calloc(mesh->vertexCount, sizeof(bool));
+	bool *ntformed = (bool *)calloc(mesh->normalCount, sizeof(bool));
+	applyTransform(mesh, transform, tformed, ntformed);
+	free(tformed);
+	free(ntformed);
+}
+
 void destroyMesh(struct mesh *mesh) {
 	if (mesh->name) {
 		free(mesh->name);
@@ -67,8 +79,8 @@ void destroyMesh(struct mesh *mesh) {
 			free(mesh->transforms);
 		}
 	}
-	if (mesh->tree) {
-		destroyTree(mesh->tree);
+	if (mesh->bvh) {
+		destroyBvh(mesh->bvh);
 	}
 	if (mesh->materials) {
 		for (int i = 0; i < mesh->materialCount; ++i) {
@@ -42,8 +42,13 @@ struct mesh {
 	int materialCount;
 	struct material *materials;
 	
-	//Root node of the kd-tree for this mesh
-	struct kdTreeNode *tree;
+	//Only placed in the scene through instances in world.instances, not where the mesh itself is
+	bool instanced;
+	
+	//Acceleration structure for this mesh. All builders produce the same flat layout
+	enum accelerator accelerator;
+	struct bvh *bvh;
+	long buildTime; //Milliseconds it took to build bvh
 	
 	char *name;
 };
@@ -51,4 +56,9 @@ struct mesh {
 void addTransform(struct mesh *mesh, struct transform transform);
 void transformMesh(struct mesh *mesh);
 
+/// Apply a single transform to the vertices and normals of a mesh, without adding it to its transforms
+/// @param mesh Mesh to transform
+/// @param transform Transform to apply
+void transformMeshWith(struct mesh *mesh, const struct transform *transform);
+
 void destroyMesh(struct mesh *mesh);
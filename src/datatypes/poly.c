@@ -17,7 +17,7 @@
 struct poly *polygonArray;
 int polyCount;
 
-bool rayIntersectsWithPolygon(const struct lightRay *ray, const struct poly *poly, float *result, struct vector *normal, struct coord *uv) {
+bool rayIntersectsWithPolygon(const struct lightRay *ray, const struct poly *poly, float *result, struct coord *uv) {
 	float orientation, inverseOrientation;
 	struct vector edge1 = vecSub(vertexArray[poly->vertexIndex[2]], vertexArray[poly->vertexIndex[0]]);
 	struct vector edge2 = vecSub(vertexArray[poly->vertexIndex[1]], vertexArray[poly->vertexIndex[0]]);
@@ -47,7 +47,7 @@ bool rayIntersectsWithPolygon(const struct lightRay *ray, const struct poly *pol
 	
 	float temp = vecDot(edge2, s3) * inverseOrientation;
 	
-	if ((temp < 0.0f) || (temp > *result)) {
+	if ((temp < ray->tmin) || (temp > *result)) {
 		return false;
 	}
 	
@@ -55,6 +55,5 @@ bool rayIntersectsWithPolygon(const struct lightRay *ray, const struct poly *pol
 	//Used for texturing and smooth shading
 	*uv = (struct coord){u, v};
 	*result = temp;
-	*normal = vecNormalize(vecCross(edge2, edge1));
 	return true;
 }
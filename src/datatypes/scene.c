@@ -13,12 +13,25 @@
 #include "../utils/loaders/sceneloader.h"
 #include "../utils/logging.h"
 #include "../renderer/renderer.h"
+#include "../renderer/adaptive.h"
 #include "texture.h"
 #include "camera.h"
 #include "vertexbuffer.h"
 #include "../acceleration/kdtree.h"
+#include "../acceleration/bvh.h"
+#include "../acceleration/sbvh.h"
+#include "../acceleration/lbvh.h"
+#include "../acceleration/tlas.h"
+#include "../acceleration/bvhcache.h"
+#include "../acceleration/widebvh.h"
+#include "../acceleration/packedtris.h"
+#include "../acceleration/bvhreport.h"
+#include "../libraries/cJSON.h"
 #include "tile.h"
 #include "mesh.h"
+#include "instance.h"
+#include "lights.h"
+#include "environment.h"
 #include "poly.h"
 #include "../utils/multiplatform.h"
 
@@ -33,39 +46,275 @@ void transformMeshes(struct world *scene) {
 	printf("\n");
 }
 
-//TODO: Parallelize this task
-void computeKDTrees(struct mesh *meshes, int meshCount) {
-	logr(info, "Computing KD-trees: ");
+struct meshBuildQueue {
+	struct mesh **meshes; //Largest first, so the big ones don't end up starting last
+	int meshCount;
+	int nextMesh;
+	struct crMutex *lock;
+	const struct prefs *prefs;
+	struct bvhThreadBudget *budget;
+	int cacheHits;
+};
+
+void buildMeshAccelerator(struct mesh *mesh, const struct prefs *prefs, struct bvhThreadBudget *budget) {
+	int *indices = calloc(mesh->polyCount, sizeof(int));
+	for (int j = 0; j < mesh->polyCount; ++j) {
+		indices[j] = mesh->firstPolyIndex + j;
+	}
+	switch (mesh->accelerator) {
+		case acceleratorBvh:
+			mesh->bvh = buildBvh(indices, mesh->polyCount, budget);
+			break;
+		case acceleratorSbvh:
+			mesh->bvh = buildSpatialBvh(indices, mesh->polyCount, prefs->spatialSplitBudget);
+			break;
+		case acceleratorLbvh:
+			mesh->bvh = buildLinearBvh(indices, mesh->polyCount, prefs->treeletOptimization, budget);
+			break;
+		case acceleratorKdTree:
+			//The tree takes ownership of indices
+			mesh->bvh = buildTree(indices, mesh->polyCount);
+			return;
+	}
+	free(indices);
+}
+
+//Derived data that's only used for traversal. Neither of these are cached, they're quick to compute from the binary nodes.
+void prepareMeshTraversal(struct mesh *mesh, const struct prefs *prefs) {
+	packBvhTriangles(mesh->bvh);
+	if (prefs->wideBvh || prefs->quantizedBvh) buildWideBvh(mesh->bvh);
+	if (prefs->quantizedBvh && !quantizeWideBvh(mesh->bvh)) {
+		logr(warning, "%s has leaves too large to quantize, keeping full precision nodes\n", mesh->name);
+	}
+}
+
+//Returns true if the structure was loaded from the cache
+bool loadMeshAccelerator(struct mesh *mesh, struct meshBuildQueue *queue) {
+	const struct prefs *prefs = queue->prefs;
+	bool cached = false;
+	if (prefs->bvhCachePath && mesh->polyCount) {
+		uint64_t key = bvhCacheKey(mesh, prefs);
+		mesh->bvh = loadCachedBvh(prefs->bvhCachePath, key, mesh);
+		cached = mesh->bvh;
+		if (!cached) {
+			buildMeshAccelerator(mesh, prefs, queue->budget);
+			saveCachedBvh(prefs->bvhCachePath, key, mesh->bvh);
+		}
+	} else {
+		buildMeshAccelerator(mesh, prefs, queue->budget);
+	}
+	prepareMeshTraversal(mesh, prefs);
+	return cached;
+}
+
+void *buildMeshThread(void *arg) {
+	struct crThread *thread = (struct crThread *)arg;
+	struct meshBuildQueue *queue = (struct meshBuildQueue *)thread->userData;
+	while (true) {
+		lockMutex(queue->lock);
+		int next = queue->nextMesh++;
+		releaseMutex(queue->lock);
+		if (next >= queue->meshCount) break;
+		
+		struct timeval timer = {0};
+		startTimer(&timer);
+		bool cached = loadMeshAccelerator(queue->meshes[next], queue);
+		queue->meshes[next]->buildTime = getMs(timer);
+		if (cached) {
+			lockMutex(queue->lock);
+			queue->cacheHits++;
+			releaseMutex(queue->lock);
+		}
+	}
+	//Out of meshes, so let the builds still running split their work onto this thread
+	returnBuildThread(queue->budget);
+	thread->threadComplete = true;
+	return NULL;
+}
+
+int compareMeshSize(const void *a, const void *b) {
+	const struct mesh *meshA = *(struct mesh * const *)a;
+	const struct mesh *meshB = *(struct mesh * const *)b;
+	return meshB->polyCount - meshA->polyCount;
+}
+
+const char *acceleratorName(enum accelerator accelerator) {
+	switch (accelerator) {
+		case acceleratorKdTree: return "KD-tree";
+		case acceleratorBvh: return "BVH";
+		case acceleratorSbvh: return "spatial split BVH";
+		case acceleratorLbvh: return "linear BVH";
+	}
+	return "unknown";
+}
+
+float megabytes(size_t bytes) {
+	return bytes / 1000000.0f;
+}
+
+void logBvhMemory(const struct bvhMemory *memory) {
+	size_t geometry = vertexCount * sizeof(struct vector) + normalCount * sizeof(struct vector) +
+		textureCount * sizeof(struct coord) + polyCount * sizeof(struct poly);
+	size_t wide = memory->wideNodes + memory->quantizedNodes;
+	size_t total = memory->nodes + wide + memory->primIndices + memory->triangles;
+	logr(info, "Acceleration memory: %.1fMB for %.1fMB of geometry (nodes %.1fMB, wide nodes %.1fMB, indices %.1fMB, triangles %.1fMB)\n",
+		 megabytes(total), megabytes(geometry), megabytes(memory->nodes), megabytes(wide), megabytes(memory->primIndices), megabytes(memory->triangles));
+	if (memory->quantizedNodes) {
+		//Quantized nodes replace the float wide nodes one for one
+		size_t fullSize = memory->quantizedNodes / sizeof(struct quantizedBvhNode) * sizeof(struct wideBvhNode);
+		logr(info, "Quantized wide nodes take %.1fMB, down from %.1fMB\n", megabytes(memory->quantizedNodes), megabytes(fullSize));
+	}
+}
+
+void computeKDTrees(struct mesh *meshes, int meshCount, const struct prefs *prefs) {
+	const char *width = prefs->quantizedBvh ? "quantized wide " : prefs->wideBvh ? "wide " : "";
+	logr(info, "Computing %s%ss: ", width, acceleratorName(prefs->accelerator));
 	struct timeval timer = {0};
 	startTimer(&timer);
+	
+	struct mesh **sorted = calloc(meshCount, sizeof(struct mesh *));
 	for (int i = 0; i < meshCount; ++i) {
-		int *indices = calloc(meshes[i].polyCount, sizeof(int));
-		for (int j = 0; j < meshes[i].polyCount; ++j) {
-			indices[j] = meshes[i].firstPolyIndex + j;
+		sorted[i] = &meshes[i];
+	}
+	qsort(sorted, meshCount, sizeof(struct mesh *), compareMeshSize);
+	
+	//Meshes are built in parallel, and threads without a mesh to build help out with subtrees of large ones
+	int workerCount = max(min(prefs->threadCount, meshCount), 1);
+	struct bvhThreadBudget budget = {createMutex(), max(prefs->threadCount - workerCount, 0)};
+	struct meshBuildQueue queue = {sorted, meshCount, 0, createMutex(), prefs, &budget, 0};
+	struct crThread *workers = calloc(workerCount, sizeof(struct crThread));
+	for (int t = 0; t < workerCount; ++t) {
+		workers[t] = (struct crThread){.thread_num = t, .threadFunc = buildMeshThread, .userData = &queue};
+		if (spawnThread(&workers[t])) {
+			logr(error, "Failed to create a crThread.\n");
 		}
-		meshes[i].tree = buildTree(indices, meshes[i].polyCount);
-		
-		// Optional tree checking
-		/*int orphans = checkTree(meshes[i].tree);
-		if (orphans > 0) {
-			int total = countNodes(meshes[i].tree);
-			logr(warning, "Found %i/%i orphan nodes in %s kdtree\n", orphans, total, meshes[i].name);
-		}*/
 	}
+	for (int t = 0; t < workerCount; ++t) {
+		checkThread(&workers[t]);
+	}
+	free(workers);
+	free(sorted);
+	free(queue.lock);
+	free(budget.lock);
 	printSmartTime(getMs(timer));
 	printf("\n");
+	if (prefs->bvhCachePath) {
+		logr(info, "Loaded %i/%i from cache in %s\n", queue.cacheHits, meshCount, prefs->bvhCachePath);
+	}
+	
+	float totalCost = 0.0f;
+	struct bvhMemory memory = {0};
+	int splitPolys = 0;
+	int splitRefs = 0;
+	for (int i = 0; i < meshCount; ++i) {
+		char buf[64];
+		smartTime(meshes[i].buildTime, buf);
+		logr(debug, "Mesh %i (%s): %s, %i polygons, %i references in %s\n", i, meshes[i].name, acceleratorName(meshes[i].accelerator),
+			 meshes[i].polyCount, meshes[i].bvh->primCount, buf);
+		totalCost += meshes[i].bvh->buildCost;
+		addBvhMemory(meshes[i].bvh, &memory);
+		if (meshes[i].accelerator == acceleratorSbvh) {
+			splitPolys += meshes[i].polyCount;
+			splitRefs += meshes[i].bvh->primCount;
+		}
+	}
+	logr(info, "Total SAH cost: %.2f\n", totalCost);
+	if (splitPolys) {
+		logr(info, "Spatial splits: %i references to %i polygons (%.2fx duplication)\n", splitRefs, splitPolys, (float)splitRefs / splitPolys);
+	}
+	logBvhMemory(&memory);
+}
+
+int reportAccelerators(const struct world *scene, const char *jsonPath) {
+	cJSON *json = cJSON_CreateObject();
+	cJSON *meshes = cJSON_CreateArray();
+	for (int i = 0; i < scene->meshCount; ++i) {
+		const struct mesh *mesh = &scene->meshes[i];
+		struct bvhReport report = reportBvh(mesh->bvh);
+		char name[256];
+		snprintf(name, sizeof(name), "Mesh %i (%s)", i, mesh->name);
+		logBvhReport(&report, name, acceleratorName(mesh->accelerator));
+		cJSON *meshReport = bvhReportToJSON(&report, mesh->name, acceleratorName(mesh->accelerator));
+		cJSON_AddNumberToObject(meshReport, "polygons", mesh->polyCount);
+		cJSON_AddItemToArray(meshes, meshReport);
+	}
+	cJSON_AddItemToObject(json, "meshes", meshes);
+	struct bvhReport report = reportBvh(scene->topLevel);
+	logBvhReport(&report, "Top level", acceleratorName(acceleratorBvh));
+	cJSON_AddItemToObject(json, "topLevel", bvhReportToJSON(&report, "Top level", acceleratorName(acceleratorBvh)));
+	
+	int result = 0;
+	if (jsonPath) {
+		char *string = cJSON_Print(json);
+		FILE *file = fopen(jsonPath, "w");
+		if (file && fputs(string, file) >= 0) {
+			logr(info, "Wrote acceleration structure report to %s\n", jsonPath);
+		} else {
+			logr(warning, "Failed to write acceleration structure report to %s\n", jsonPath);
+			result = -1;
+		}
+		if (file) fclose(file);
+		free(string);
+	}
+	cJSON_Delete(json);
+	return result;
+}
+
+//Whether any lights move along with a mesh, either its own emissive polygons or ones of an emissive instance of it
+bool meshHasLights(const struct world *scene, int meshIndex) {
+	if (scene->lights->polygonLights[meshIndex]) return true;
+	for (int i = 0; i < scene->instanceCount; ++i) {
+		const struct instance *instance = &scene->instances[i];
+		if (instance->meshIndex == meshIndex && instance->material && isEmissive(instance->material)) return true;
+	}
+	return false;
+}
+
+void transformSceneMesh(struct renderer *r, int meshIndex, const struct transform *transform) {
+	struct timeval timer = {0};
+	startTimer(&timer);
+	struct mesh *mesh = &r->scene->meshes[meshIndex];
+	transformMeshWith(mesh, transform);
+	refitBvh(mesh->bvh);
+	
+	//Refitting keeps the old topology, so rebuild if that has degraded too much for the new vertex positions
+	float cost = bvhSAHCost(mesh->bvh);
+	float threshold = r->prefs.bvhRebuildThreshold;
+	bool rebuild = threshold > 0.0f && cost > mesh->bvh->buildCost * (1.0f + threshold);
+	if (rebuild) {
+		destroyBvh(mesh->bvh);
+		struct bvhThreadBudget budget = {createMutex(), max(r->prefs.threadCount - 1, 0)};
+		buildMeshAccelerator(mesh, &r->prefs, &budget);
+		free(budget.lock);
+		prepareMeshTraversal(mesh, &r->prefs);
+	}
+	
+	//The top-level BVH only has a node per object, so just build it again
+	destroyBvh(r->scene->topLevel);
+	r->scene->topLevel = buildTopLevelBvh(r->scene);
+	//Emissive polygons of the mesh may have moved
+	if (r->scene->lights && meshHasLights(r->scene, meshIndex)) {
+		destroyLightList(r->scene->lights);
+		r->scene->lights = buildLightList(r->scene);
+	}
+	
+	logr(info, "%s %s in ", rebuild ? "Rebuilt" : "Refitted", mesh->name);
+	printSmartTime(getMs(timer));
+	printf(" (SAH cost %.2f after refit, %.2f when built)\n", cost, mesh->bvh->buildCost);
 }
 
 void printSceneStats(struct world *scene, unsigned long long ms) {
 	logr(info, "Scene construction completed in ");
 	printSmartTime(ms);
 	printf("\n");
-	logr(info, "Totals: %iV, %iN, %iT, %iP, %iS\n",
+	logr(info, "Totals: %iV, %iN, %iT, %iP, %iS, %iI, %iL\n",
 		   vertexCount,
 		   normalCount,
 		   textureCount,
 		   polyCount,
-		   scene->sphereCount);
+		   scene->sphereCount,
+		   scene->instanceCount,
+		   scene->lights ? scene->lights->count : 0);
 }
 
 //Split scene loading and prefs?
@@ -96,7 +345,12 @@ int loadScene(struct renderer *r, char *input) {
 	
 	transformCameraIntoView(r->scene->camera);
 	transformMeshes(r->scene);
-	computeKDTrees(r->scene->meshes, r->scene->meshCount);
+	computeKDTrees(r->scene->meshes, r->scene->meshCount, &r->prefs);
+	r->scene->topLevel = buildTopLevelBvh(r->scene);
+	if (r->prefs.nextEventEstimation) {
+		r->scene->lights = buildLightList(r->scene);
+		if (r->scene->hdr) r->scene->environment = newEnvironmentMap(r->scene->hdr, r->scene->background);
+	}
 	printSceneStats(r->scene, getMs(timer));
 	
 	//Quantize image into renderTiles
@@ -113,6 +367,9 @@ int loadScene(struct renderer *r, char *input) {
 	//Allocate memory for render buffer
 	//Render buffer is used to store accurate color values for the renderers' internal use
 	r->state.renderBuffer = newTexture(float_p, r->prefs.imageWidth, r->prefs.imageHeight, 3);
+	if (r->prefs.adaptiveThreshold > 0.0f) {
+		r->state.adaptive = newAdaptiveSampler(r->prefs.imageWidth, r->prefs.imageHeight, r->prefs.adaptiveThreshold, r->prefs.adaptiveMinSamples);
+	}
 	
 	//Allocate memory for render UI buffer
 	//This buffer is used for storing UI stuff like currently rendering tile highlights
@@ -137,6 +394,8 @@ int loadScene(struct renderer *r, char *input) {
 //Free scene data
 void destroyScene(struct world *scene) {
 	if (scene) {
+		destroyEnvironmentMap(scene->environment);
+		destroyOctahedralMap(scene->background);
 		destroyTexture(scene->hdr);
 		if (scene->meshes) {
 			for (int i = 0; i < scene->meshCount; ++i) {
@@ -147,6 +406,14 @@ void destroyScene(struct world *scene) {
 		if (scene->spheres) {
 			free(scene->spheres);
 		}
+		if (scene->instances) {
+			for (int i = 0; i < scene->instanceCount; ++i) {
+				destroyInstance(&scene->instances[i]);
+			}
+			free(scene->instances);
+		}
+		destroyBvh(scene->topLevel);
+		destroyLightList(scene->lights);
 		if (scene->camera) {
 			destroyCamera(scene->camera);
 		}
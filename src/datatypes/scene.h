@@ -11,6 +11,7 @@
 #include "color.h"
 
 struct renderer;
+struct transform;
 
 /// World
 struct world {
@@ -20,6 +21,12 @@ struct world {
 	//Optional environment map
 	struct texture *hdr;
 	
+	//hdr resampled for looking up directions, with its offset baked in
+	struct octahedralMap *background;
+	
+	//Distribution for sampling the environment map directly. NULL if next event estimation is off
+	struct environmentMap *environment;
+	
 	//3D models
 	struct mesh *meshes;
 	int meshCount;
@@ -28,6 +35,16 @@ struct world {
 	struct sphere *spheres;
 	int sphereCount;
 	
+	//Placements of meshes that share their geometry
+	struct instance *instances;
+	int instanceCount;
+	
+	//Top-level BVH over all meshes, spheres and instances
+	struct bvh *topLevel;
+	
+	//Emissive spheres and triangles to sample directly. NULL if next event estimation is off
+	struct lightList *lights;
+	
 	//Currently only one camera supported
 	struct camera *camera;
 	int cameraCount;
@@ -35,4 +52,17 @@ struct world {
 
 int loadScene(struct renderer *r, char *input);
 
+/// Transform a mesh that has already been loaded, and update the acceleration structures to match.
+/// The mesh BVH is refitted, and only rebuilt if that degrades it more than prefs.bvhRebuildThreshold allows.
+/// @param r Renderer with the loaded scene
+/// @param meshIndex Index of the mesh to transform
+/// @param transform Transform to apply
+void transformSceneMesh(struct renderer *r, int meshIndex, const struct transform *transform);
+
+/// Log the shape and health of every acceleration structure in a loaded scene, and optionally write it out as JSON
+/// @param scene Scene to report on
+/// @param jsonPath File to write the report to, or NULL to only log it
+/// @return 0 on success, -1 if the file couldn't be written
+int reportAccelerators(const struct world *scene, const char *jsonPath);
+
 void destroyScene(struct world *scene);
@@ -74,21 +74,12 @@ bool intersect(const struct lightRay *ray, const struct sphere *sphere, float *t
 
 bool rayIntersectsWithSphere(const struct lightRay *ray, const struct sphere *sphere, struct hitRecord *isect) {
 	//Pass the distance value to rayIntersectsWithSphere, where it's set
+	//The hit point and normal are computed later, if this turns out to be the closest hit
 	if (intersect(ray, sphere, &isect->distance)) {
 		isect->type = hitTypeSphere;
-		//Compute normal and store it to isect
-		struct vector scaled = vecScale(ray->direction, isect->distance);
-		struct vector hitpoint = vecAdd(ray->start, scaled);
-		struct vector surfaceNormal = vecSub(hitpoint, sphere->pos);
-		float temp = vecDot(surfaceNormal, surfaceNormal);
-		if (temp == 0.0) return false; //FIXME: Check this later
-		temp = invsqrt(temp);
-		isect->surfaceNormal = vecScale(surfaceNormal, temp);
-		//Also store hitpoint
-		isect->hitPoint = hitpoint;
 		return true;
 	} else {
-		isect->type = hitTypeNone;
+		//Leave isect alone, it may already describe a closer hit
 		return false;
 	}
 }
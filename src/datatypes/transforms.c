@@ -239,6 +239,19 @@ struct matrix4x4 inverse(struct matrix4x4 mtx) {
 	return transpose(inverse);
 }
 
+//Applying the result is the same as applying B first, then A
+struct matrix4x4 multiplyMatrices(struct matrix4x4 A, struct matrix4x4 B) {
+	struct matrix4x4 result = {{{0}}};
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			for (int k = 0; k < 4; ++k) {
+				result.mtx[i][j] += A.mtx[i][k] * B.mtx[k][j];
+			}
+		}
+	}
+	return result;
+}
+
 struct matrix4x4 transpose(struct matrix4x4 tf) {
 	return fromParams(tf.mtx[0][0], tf.mtx[1][0], tf.mtx[2][0], tf.mtx[3][0],
 					  tf.mtx[0][1], tf.mtx[1][1], tf.mtx[2][1], tf.mtx[3][1],
@@ -48,6 +48,7 @@ struct transform newTransform(void);
 
 struct matrix4x4 inverse(struct matrix4x4 mtx);
 struct matrix4x4 transpose(struct matrix4x4 tf);
+struct matrix4x4 multiplyMatrices(struct matrix4x4 A, struct matrix4x4 B);
 
 void transformVector(struct vector *vec, struct matrix4x4 mtx);
 void transformDirection(struct vector *vec, struct matrix4x4 mtx);
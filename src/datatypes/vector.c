@@ -226,9 +226,9 @@ struct vector getRandomVecOnPlane(struct vector center, float radius, pcg32_rand
 						 center.z);
 }
 
-struct coord randomCoordOnUnitDisc(pcg32_random_t *rng) {
-	float r = sqrtf(rndFloat(rng));
-	float theta = rndFloatRange(0.0f, 2.0f * PI, rng);
+struct coord randomCoordOnUnitDisc(struct coord point) {
+	float r = sqrtf(point.x);
+	float theta = 2.0f * PI * point.y;
 	return (struct coord){r * cosf(theta), r * sinf(theta)};
 }
 
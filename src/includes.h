@@ -54,6 +54,24 @@ enum fileType {
 	buffer
 };
 
+enum accelerator {
+	acceleratorKdTree = 0,
+	acceleratorBvh,
+	acceleratorSbvh,
+	acceleratorLbvh
+};
+
+enum integrator {
+	integratorPathTrace = 0,
+	integratorWavefront
+};
+
+enum samplerType {
+	samplerRandom = 0,
+	samplerSobol,
+	samplerBlueNoise
+};
+
 enum renderOrder {
 	renderOrderTopToBottom = 0,
 	renderOrderFromMiddle,
@@ -8,6 +8,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include "main.h"
 
 #include "c-ray.h"
@@ -17,10 +18,26 @@ int main(int argc, char *argv[]) {
 	crInitTerminal();
 	logr(info, "C-ray v%s [%.8s], © 2015-2020 Valtteri Koskivuori\n", crGetVersion(), crGitHash());
 	crInitRenderer();
+	
+	//--bvh-report[=file.json] checks the acceleration structures and exits without rendering
+	char *inputPath = NULL;
+	bool bvhReport = false;
+	char *bvhReportPath = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--bvh-report") == 0) {
+			bvhReport = true;
+		} else if (strncmp(argv[i], "--bvh-report=", 13) == 0) {
+			bvhReport = true;
+			bvhReportPath = argv[i] + 13;
+		} else {
+			inputPath = argv[i];
+		}
+	}
+	
 	size_t bytes = 0;
-	char *input = argc == 2 ? crLoadFile(argv[1], &bytes) : crReadStdin(&bytes);
-	crSetAssetPath(argc == 2 ? crGetFilePath(argv[1]) : "./");
-	logr(info, "%zi bytes of input JSON loaded from %s, parsing.\n", bytes, argc == 2 ? "file" : "stdin");
+	char *input = inputPath ? crLoadFile(inputPath, &bytes) : crReadStdin(&bytes);
+	crSetAssetPath(inputPath ? crGetFilePath(inputPath) : "./");
+	logr(info, "%zi bytes of input JSON loaded from %s, parsing.\n", bytes, inputPath ? "file" : "stdin");
 	if (!input || crLoadSceneFromBuf(input)) {
 		if (input) free(input);
 		crDestroyRenderer();
@@ -28,6 +45,12 @@ int main(int argc, char *argv[]) {
 		return -1;
 	}
 	free(input);
+	if (bvhReport) {
+		int result = crReportAccelerators(bvhReportPath);
+		crDestroyRenderer();
+		crRestoreTerminal();
+		return result;
+	}
 	crRenderSingleFrame();
 	crWriteImage();
 	crDestroyRenderer();
@@ -0,0 +1,112 @@
+//
+//  adaptive.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "adaptive.h"
+
+#include "../datatypes/color.h"
+#include "../datatypes/tile.h"
+#include "../datatypes/texture.h"
+
+struct adaptiveSampler *newAdaptiveSampler(int width, int height, float threshold, int minSamples) {
+	struct adaptiveSampler *sampler = calloc(1, sizeof(struct adaptiveSampler));
+	sampler->mean = calloc(width * height, sizeof(float));
+	sampler->deviation = calloc(width * height, sizeof(float));
+	sampler->samples = calloc(width * height, sizeof(int));
+	sampler->converged = calloc(width * height, sizeof(bool));
+	sampler->threshold = threshold;
+	//The variance can't be estimated from less than two
+	sampler->minSamples = max(minSamples, 2);
+	sampler->width = width;
+	sampler->height = height;
+	return sampler;
+}
+
+void addAdaptiveSample(struct adaptiveSampler *sampler, int x, int y, struct color sample) {
+	int pixel = y * sampler->width + x;
+	//Channels weighted evenly, so noise in any of them keeps the pixel going
+	float value = grayscale(sample).red;
+	int n = ++sampler->samples[pixel];
+	//Welford's running variance
+	float delta = value - sampler->mean[pixel];
+	sampler->mean[pixel] += delta / n;
+	sampler->deviation[pixel] += delta * (value - sampler->mean[pixel]);
+}
+
+//Squared standard error of the mean of a pixel, relative to the square root of its brightness.
+//That roughly evens out the error as displayed after gamma, so dark pixels don't need to converge further than bright ones.
+float relativeError(const struct adaptiveSampler *sampler, int pixel) {
+	int n = sampler->samples[pixel];
+	float variance = sampler->deviation[pixel] / (n - 1);
+	return variance / (n * (max(sampler->mean[pixel], 0.0f) + 0.0001f));
+}
+
+bool pixelConverged(const struct adaptiveSampler *sampler, int x, int y) {
+	return sampler->converged[y * sampler->width + x];
+}
+
+bool updateConvergence(struct adaptiveSampler *sampler, const struct renderTile *tile) {
+	bool tileDone = true;
+	for (int blockY = tile->begin.y; blockY < tile->end.y; blockY += ADAPTIVE_BLOCK_SIZE) {
+		for (int blockX = tile->begin.x; blockX < tile->end.x; blockX += ADAPTIVE_BLOCK_SIZE) {
+			int endX = min(blockX + ADAPTIVE_BLOCK_SIZE, tile->end.x);
+			int endY = min(blockY + ADAPTIVE_BLOCK_SIZE, tile->end.y);
+			if (pixelConverged(sampler, blockX, blockY)) continue;
+			if (sampler->samples[blockY * sampler->width + blockX] < sampler->minSamples) {
+				tileDone = false;
+				continue;
+			}
+			float error = 0.0f;
+			for (int y = blockY; y < endY; ++y) {
+				for (int x = blockX; x < endX; ++x) {
+					error += relativeError(sampler, y * sampler->width + x);
+				}
+			}
+			error = sqrtf(error / ((endX - blockX) * (endY - blockY)));
+			if (error >= sampler->threshold) {
+				tileDone = false;
+				continue;
+			}
+			for (int y = blockY; y < endY; ++y) {
+				for (int x = blockX; x < endX; ++x) {
+					sampler->converged[y * sampler->width + x] = true;
+				}
+			}
+		}
+	}
+	return tileDone;
+}
+
+float averageSampleCount(const struct adaptiveSampler *sampler) {
+	uint64_t total = 0;
+	for (int i = 0; i < sampler->width * sampler->height; ++i) {
+		total += sampler->samples[i];
+	}
+	return (float)total / (sampler->width * sampler->height);
+}
+
+struct texture *sampleCountImage(const struct adaptiveSampler *sampler, int maxSamples) {
+	struct texture *image = newTexture(char_p, sampler->width, sampler->height, 3);
+	for (int y = 0; y < sampler->height; ++y) {
+		for (int x = 0; x < sampler->width; ++x) {
+			float value = (float)sampler->samples[y * sampler->width + x] / max(maxSamples, 1);
+			blit(image, colorWithValues(value, value, value, 1.0f), x, y);
+		}
+	}
+	return image;
+}
+
+void destroyAdaptiveSampler(struct adaptiveSampler *sampler) {
+	if (sampler) {
+		free(sampler->mean);
+		free(sampler->deviation);
+		free(sampler->samples);
+		free(sampler->converged);
+		free(sampler);
+	}
+}
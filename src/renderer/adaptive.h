@@ -0,0 +1,59 @@
+//
+//  adaptive.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+struct color;
+struct renderTile;
+struct texture;
+
+//Pixels stop in blocks of this many across, so stopping doesn't depend on the samples of any single pixel
+#define ADAPTIVE_BLOCK_SIZE 4
+//Unless prefs.adaptiveMaxSamples says otherwise, blocks that haven't converged may take this many times the sample count
+#define ADAPTIVE_MAX_SAMPLES_FACTOR 4
+
+/// Running statistics of every pixel, to stop sampling the ones that have converged.
+/// Blocks of pixels keep getting samples until the estimated error of their means drops below the threshold.
+/// Converged blocks stop early, and noisy ones go on past the sample count, up to prefs.adaptiveMaxSamples.
+struct adaptiveSampler {
+	float *mean; //Running mean of the luminance of each pixel
+	float *deviation; //Running sum of squared differences from the mean
+	int *samples; //Samples taken for each pixel so far
+	bool *converged;
+	float threshold;
+	int minSamples;
+	int width;
+	int height;
+};
+
+/// Set up statistics for an image
+/// @param width Image width
+/// @param height Image height
+/// @param threshold Error to stop a block at, relative to the square root of its brightness
+/// @param minSamples Samples every pixel gets before it may stop
+struct adaptiveSampler *newAdaptiveSampler(int width, int height, float threshold, int minSamples);
+
+/// Add a finished sample to the statistics of pixel x, y
+void addAdaptiveSample(struct adaptiveSampler *sampler, int x, int y, struct color sample);
+
+/// Has pixel x, y stopped taking samples
+bool pixelConverged(const struct adaptiveSampler *sampler, int x, int y);
+
+/// Stop the blocks of a tile that have converged. Call after each sample of the tile.
+/// @return true if all the pixels of the tile have stopped
+bool updateConvergence(struct adaptiveSampler *sampler, const struct renderTile *tile);
+
+/// Average amount of samples taken per pixel
+float averageSampleCount(const struct adaptiveSampler *sampler);
+
+/// Grayscale image of the samples taken for each pixel, white being maxSamples
+/// @param sampler Statistics of a finished render
+/// @param maxSamples Sample count to map to white
+struct texture *sampleCountImage(const struct adaptiveSampler *sampler, int maxSamples);
+
+void destroyAdaptiveSampler(struct adaptiveSampler *sampler);
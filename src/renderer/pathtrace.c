@@ -8,41 +8,151 @@
 
 #include "../includes.h"
 #include "pathtrace.h"
+#include "sampler.h"
 
 #include "../datatypes/scene.h"
 #include "../datatypes/camera.h"
 #include "../acceleration/bbox.h"
-#include "../acceleration/kdtree.h"
+#include "../acceleration/tlas.h"
 #include "../datatypes/texture.h"
 #include "../datatypes/vertexbuffer.h"
 #include "../datatypes/sphere.h"
 #include "../datatypes/poly.h"
 #include "../datatypes/mesh.h"
+#include "../datatypes/instance.h"
+#include "../datatypes/lights.h"
+#include "../datatypes/environment.h"
 
-struct hitRecord getClosestIsect(const struct lightRay *incidentRay, const struct world *scene);
-struct color getBackground(const struct lightRay *incidentRay, const struct world *scene);
-
-struct color pathTrace(const struct lightRay *incidentRay, const struct world *scene, int depth, int maxDepth, pcg32_random_t *rng) {
+struct color pathTrace(const struct lightRay *incidentRay, const struct world *scene, int maxDepth, int rouletteDepth, struct sampler *sampler, struct pathStats *stats) {
 	struct hitRecord isect = getClosestIsect(incidentRay, scene);
-	if (isect.didIntersect) {
-		struct lightRay scattered;
-		struct color attenuation;
-		struct color emitted = isect.end.emission;
-		if (depth < maxDepth && isect.end.bsdf(&isect, &attenuation, &scattered, rng)) {
-			float probability = 1.0f;
-			if (depth >= 4) {
-				probability = max(attenuation.red, max(attenuation.green, attenuation.blue));
-				if (rndFloat(rng) > probability) {
-					return emitted;
-				}
-			}
-			struct color newColor = pathTrace(&scattered, scene, depth + 1, maxDepth, rng);
-			return colorCoef(1.0f / probability, addColors(emitted, multiplyColors(attenuation, newColor)));
-		} else {
-			return emitted;
-		}
+	return pathTraceHit(&isect, scene, maxDepth, rouletteDepth, sampler, stats);
+}
+
+struct color pathTraceHit(struct hitRecord *isect, const struct world *scene, int maxDepth, int rouletteDepth, struct sampler *sampler, struct pathStats *stats) {
+	struct pathState path = newPathState();
+	struct lightRay next;
+	while (continuePath(&path, isect, scene, maxDepth, rouletteDepth, sampler, &next, stats)) {
+		*isect = getClosestIsect(&next, scene);
+	}
+	return path.radiance;
+}
+
+//Weight of one of two sampling strategies, with the power heuristic
+float powerHeuristic(float pdf, float otherPdf) {
+	return (pdf * pdf) / (pdf * pdf + otherPdf * otherPdf);
+}
+
+//Light arriving from a sampled direction, weighted against the BSDF scattering the same way
+struct color directLight(const struct world *scene, struct hitRecord *isect, const struct lightSample *sample) {
+	struct color black = {0.0f, 0.0f, 0.0f, 0.0f};
+	struct color reflectance = isect->material->evalBSDF(isect, sample->direction);
+	if (max(reflectance.red, max(reflectance.green, reflectance.blue)) <= 0.0f) return black;
+	struct lightRay shadow = newRay(isect->hitPoint, sample->direction, rayTypeShadow);
+	//Stop just short of the light, so it doesn't shadow itself
+	if (rayOccludedInScene(scene, &shadow, sample->distance * 0.999f)) return black;
+	float weight = powerHeuristic(sample->pdf, isect->material->pdfBSDF(isect, sample->direction));
+	return colorCoef(weight / sample->pdf, multiplyColors(reflectance, sample->emission));
+}
+
+struct color sampleDirectLight(const struct world *scene, struct hitRecord *isect, struct sampler *sampler) {
+	struct color light = {0.0f, 0.0f, 0.0f, 0.0f};
+	//Drawn up front, so the BSDF gets the same dimensions whether or not a light could be sampled
+	float pick = getDimension(sampler);
+	struct coord onLight = getDimension2D(sampler);
+	struct coord onEnvironment = getDimension2D(sampler);
+	struct lightSample sample;
+	if (sampleLight(scene->lights, isect->hitPoint, pick, onLight, &sample)) {
+		light = addColors(light, directLight(scene, isect, &sample));
+	}
+	if (scene->environment && sampleEnvironment(scene->environment, onEnvironment, &sample)) {
+		light = addColors(light, directLight(scene, isect, &sample));
+	}
+	return light;
+}
+
+//Lights and the environment the BSDF scattered into were also sampled directly from the last bounce, so they're weighted against that
+float emissionWeight(const struct pathState *path, const struct world *scene, const struct hitRecord *isect) {
+	if (path->bsdfPdf <= 0.0f) return 1.0f;
+	if (!isect->didIntersect) {
+		if (!scene->environment) return 1.0f;
+		return powerHeuristic(path->bsdfPdf, environmentPdf(scene->environment, vecNormalize(isect->incident.direction)));
+	}
+	if (!scene->lights || !scene->lights->count || !isEmissive(isect->material)) return 1.0f;
+	return powerHeuristic(path->bsdfPdf, lightPdf(scene, isect));
+}
+
+struct pathState newPathState() {
+	return (struct pathState){
+		.throughput = (struct color){1.0f, 1.0f, 1.0f, 1.0f},
+		.radiance = (struct color){0.0f, 0.0f, 0.0f, 0.0f},
+		.depth = 0,
+		.bsdfPdf = 0.0f
+	};
+}
+
+void endPath(const struct pathState *path, struct pathStats *stats, bool roulette) {
+	if (!stats) return;
+	stats->paths++;
+	stats->bounces += path->depth;
+	stats->longest = max(stats->longest, path->depth);
+	if (roulette) stats->roulette++;
+	if (path->depth < PATH_LENGTH_BINS) {
+		stats->lengths[path->depth]++;
 	} else {
-		return getBackground(incidentRay, scene);
+		stats->lengths[PATH_LENGTH_BINS - 1]++;
+	}
+}
+
+bool continuePath(struct pathState *path, struct hitRecord *isect, const struct world *scene, int maxDepth, int rouletteDepth, struct sampler *sampler, struct lightRay *next, struct pathStats *stats) {
+	if (!isect->didIntersect) {
+		struct color background = colorCoef(emissionWeight(path, scene, isect), getBackground(&isect->incident, scene));
+		path->radiance = addColors(path->radiance, multiplyColors(path->throughput, background));
+		endPath(path, stats, false);
+		return false;
+	}
+	struct color emission = colorCoef(emissionWeight(path, scene, isect), isect->material->emission);
+	path->radiance = addColors(path->radiance, multiplyColors(path->throughput, emission));
+	if (path->depth >= maxDepth) {
+		endPath(path, stats, false);
+		return false;
+	}
+	
+	startBounce(sampler, path->depth);
+	float roulette = getDimension(sampler);
+	
+	//Lights are sampled directly at every bounce, with only the part of the BSDF that isn't specular
+	if ((scene->lights && scene->lights->count) || scene->environment) {
+		path->radiance = addColors(path->radiance, multiplyColors(path->throughput, sampleDirectLight(scene, isect, sampler)));
+	}
+	struct bsdfSample sample;
+	if (!isect->material->bsdf(isect, sampler, &sample)) {
+		endPath(path, stats, false);
+		return false;
+	}
+	*next = sample.scattered;
+	path->bsdfPdf = sample.pdf;
+	path->throughput = multiplyColors(path->throughput, sample.weight);
+	path->depth++;
+	
+	//Paths that can't carry much light anymore are ended at random, and the survivors weighted up to compensate
+	if (path->depth > rouletteDepth) {
+		float probability = min(max(path->throughput.red, max(path->throughput.green, path->throughput.blue)), 1.0f);
+		if (roulette >= probability) {
+			endPath(path, stats, true);
+			return false;
+		}
+		path->throughput = colorCoef(1.0f / probability, path->throughput);
+	}
+	return true;
+}
+
+void addPathStats(struct pathStats *stats, const struct pathStats *other) {
+	stats->paths += other->paths;
+	stats->bounces += other->bounces;
+	stats->longest = max(stats->longest, other->longest);
+	stats->roulette += other->roulette;
+	for (int i = 0; i < PATH_LENGTH_BINS; ++i) {
+		stats->lengths[i] += other->lengths[i];
 	}
 }
 
@@ -63,15 +173,13 @@ void computeSurfaceProps(struct poly p, struct coord uv, struct vector *hitPoint
 		
 		*normal = vecNormalize(vecAdd(vecAdd(upcomp, vpcomp), wpcomp));
 	}
-	
-	*hitPoint = vecAdd(*hitPoint, vecScale(*normal, 0.0001f));
 }
 
 vector bumpmap(const struct hitRecord *isect) {
-	struct material mtl = isect->end;
+	const struct material *mtl = isect->material;
 	struct poly p = polygonArray[isect->polyIndex];
-	float width = mtl.normalMap->width;
-	float heigh = mtl.normalMap->height;
+	float width = mtl->normalMap->width;
+	float heigh = mtl->normalMap->height;
 	float u = isect->uv.x;
 	float v = isect->uv.y;
 	float w = 1.0 - u - v;
@@ -81,73 +189,78 @@ vector bumpmap(const struct hitRecord *isect) {
 	struct coord textureXY = addCoords(addCoords(ucomponent, vcomponent), wcomponent);
 	float x = (textureXY.x*(width));
 	float y = (textureXY.y*(heigh));
-	struct color pixel = textureGetPixelFiltered(mtl.normalMap, x, y);
+	struct color pixel = textureGetPixelFiltered(mtl->normalMap, x, y);
 	return vecNormalize((vector){(pixel.red * 2.0f) - 1.0f, (pixel.green * 2.0f) - 1.0f, pixel.blue * 0.5f});
 }
 
-/**
- Calculate the closest intersection point, and other relevant information based on a given lightRay and scene
- See the intersection struct for documentation of what this function calculates.
-
- @param incidentRay Given light ray (set up in renderThread())
- @param scene  Given scene to cast that ray into
- @return intersection struct with the appropriate values set
- */
-struct hitRecord getClosestIsect(const struct lightRay *incidentRay, const struct world *scene) {
+struct hitRecord newHitRecord(const struct lightRay *incidentRay) {
 	struct hitRecord isect;
-	isect.distance = 20000.0;
+	isect.distance = incidentRay->tmax;
 	isect.incident = *incidentRay;
 	isect.didIntersect = false;
-	for (int i = 0; i < scene->sphereCount; ++i) {
-		if (rayIntersectsWithSphere(incidentRay, &scene->spheres[i], &isect)) {
-			isect.end = scene->spheres[i].material;
-			isect.didIntersect = true;
-		}
-	}
-	for (int o = 0; o < scene->meshCount; ++o) {
-		if (rayIntersectsWithNode(scene->meshes[o].tree, incidentRay, &isect)) {
-			isect.end = scene->meshes[o].materials[polygonArray[isect.polyIndex].materialIndex];
-			computeSurfaceProps(polygonArray[isect.polyIndex], isect.uv, &isect.hitPoint, &isect.surfaceNormal);
-			
-			if (isect.end.hasNormalMap) {
-				isect.surfaceNormal = bumpmap(&isect);
-			}
-			
-			isect.didIntersect = true;
-		}
-	}
+	isect.type = hitTypeNone;
+	isect.material = NULL;
+	isect.object = -1;
+	isect.instance = NULL;
 	return isect;
 }
 
-float wrapMax(float x, float max) {
-	return fmod(max + fmod(x, max), max);
+void computePolygonSurface(struct hitRecord *isect) {
+	struct poly p = polygonArray[isect->polyIndex];
+	if (!p.hasNormals) {
+		//Flat shaded, use the geometric normal
+		struct vector edge1 = vecSub(vertexArray[p.vertexIndex[2]], vertexArray[p.vertexIndex[0]]);
+		struct vector edge2 = vecSub(vertexArray[p.vertexIndex[1]], vertexArray[p.vertexIndex[0]]);
+		isect->surfaceNormal = vecNormalize(vecCross(edge2, edge1));
+	}
+	computeSurfaceProps(p, isect->uv, &isect->hitPoint, &isect->surfaceNormal);
+	if (isect->instance) {
+		instanceToWorld(isect->instance, &isect->hitPoint, &isect->surfaceNormal);
+	}
+	//Offset in world space, so it doesn't scale with the instance
+	isect->hitPoint = vecAdd(isect->hitPoint, vecScale(isect->surfaceNormal, 0.0001f));
+	
+	if (isect->material->hasNormalMap) {
+		isect->surfaceNormal = bumpmap(isect);
+	}
 }
 
-float wrapMinMax(float x, float min, float max) {
-	return min + wrapMax(x - min, max - min);
+void computeHitSurface(const struct world *scene, struct hitRecord *isect) {
+	if (!isect->didIntersect) return;
+	int object = isect->object;
+	if (object < scene->meshCount) {
+		const struct mesh *mesh = &scene->meshes[object];
+		isect->material = &mesh->materials[polygonArray[isect->polyIndex].materialIndex];
+		isect->instance = NULL;
+		computePolygonSurface(isect);
+	} else if (object < scene->meshCount + scene->sphereCount) {
+		const struct sphere *sphere = &scene->spheres[object - scene->meshCount];
+		isect->material = &sphere->material;
+		isect->instance = NULL;
+		isect->hitPoint = vecAdd(isect->incident.start, vecScale(isect->incident.direction, isect->distance));
+		isect->surfaceNormal = vecNormalize(vecSub(isect->hitPoint, sphere->pos));
+	} else {
+		const struct instance *instance = &scene->instances[object - scene->meshCount - scene->sphereCount];
+		const struct mesh *mesh = &scene->meshes[instance->meshIndex];
+		isect->material = instance->material ? instance->material : &mesh->materials[polygonArray[isect->polyIndex].materialIndex];
+		isect->instance = instance;
+		computePolygonSurface(isect);
+	}
 }
 
-struct color getHDRI(const struct lightRay *incidentRay, const struct texture *hdr) {
-	//Unit direction vector
-	struct vector ud = vecNormalize(incidentRay->direction);
-	
-	//To polar from cartesian
-	float r = 1.0f; //Normalized above
-	float phi = (atan2f(ud.z, ud.x)/4) + hdr->offset;
-	float theta = acosf((-ud.y/r));
-	
-	float u = theta / PI;
-	float v = (phi / (PI/2));
-	
-	u = wrapMinMax(u, 0, 1);
-	v = wrapMinMax(v, 0, 1);
-	
-	float x = (v * hdr->width);
-	float y = (u * hdr->height);
-	
-	struct color newColor = textureGetPixelFiltered(hdr, x, y);
-	
-	return newColor;
+/**
+ Calculate the closest intersection point, and other relevant information based on a given lightRay and scene
+ See the intersection struct for documentation of what this function calculates.
+
+ @param incidentRay Given light ray (set up in renderThread())
+ @param scene  Given scene to cast that ray into
+ @return intersection struct with the appropriate values set
+ */
+struct hitRecord getClosestIsect(const struct lightRay *incidentRay, const struct world *scene) {
+	struct hitRecord isect = newHitRecord(incidentRay);
+	rayIntersectsWithTopLevelBvh(scene, incidentRay, &isect);
+	computeHitSurface(scene, &isect);
+	return isect;
 }
 
 //Linearly interpolate based on the Y component
@@ -158,5 +271,5 @@ struct color getAmbientColor(const struct lightRay *incidentRay, struct gradient
 }
 
 struct color getBackground(const struct lightRay *incidentRay, const struct world *scene) {
-	return scene->hdr ? getHDRI(incidentRay, scene->hdr) : getAmbientColor(incidentRay, scene->ambientColor);
+	return scene->background ? octahedralLookup(scene->background, incidentRay->direction) : getAmbientColor(incidentRay, scene->ambientColor);
 }
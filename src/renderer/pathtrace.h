@@ -8,11 +8,15 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include "../datatypes/vector.h"
 #include "../datatypes/lightRay.h"
 #include "../datatypes/material.h"
 
 struct world;
+struct instance;
+struct sampler;
 
 /**
  Ray intersection type enum
@@ -25,12 +29,13 @@ enum currentType {
 
 /**
  Shading/intersection information, used to perform shading and rendering logic.
- @note uv, mtlIndex and polyIndex are only set if the ray hits a polygon (mesh)
- @todo Consider moving start, end materials to lightRay instead
+ Traversal only records what identifies the closest hit: object, polygon, distance and barycentrics.
+ The rest is evaluated once for the final hit, by computeHitSurface().
+ @note uv and polyIndex are only set if the ray hits a polygon (mesh)
  */
 struct hitRecord {
 	struct lightRay incident;		//Light ray that encountered this intersection
-	struct material end;			//Material of the intersected object
+	const struct material *material;	//Material of the intersected object
 	struct vector hitPoint;			//Hit point vector in 3D space
 	struct vector surfaceNormal;	//Surface normal at that point of intersection
 	struct coord uv;				//UV barycentric coordinates for intersection point
@@ -38,13 +43,100 @@ struct hitRecord {
 	bool didIntersect;				//True if ray intersected
 	float distance;					//Distance to intersection point
 	int polyIndex;					//mesh polygon index
+	int object;						//Object of the top level BVH that was hit
+	const struct instance *instance;	//Instance the polygon was hit through, NULL if the mesh isn't instanced
+};
+
+/// A direction scattered by the BSDF of a material
+struct bsdfSample {
+	struct lightRay scattered; //Normalized direction, from the hit point
+	struct color weight; //BSDF times cosine, divided by pdf
+	float pdf; //Solid angle density of the direction, 0 if a specular lobe scattered it
+};
+
+
+//Path lengths from this on are counted together
+#define PATH_LENGTH_BINS 16
+
+/// Light carried along a path, from one bounce to the next
+struct pathState {
+	struct color throughput; //Product of the attenuations so far, weighted for russian roulette
+	struct color radiance; //Light gathered so far
+	int depth; //Bounces so far
+	float bsdfPdf; //Density the last bounce scattered with, 0 for camera rays and specular bounces
 };
 
+/// Statistics of finished paths, kept per render thread
+struct pathStats {
+	uint64_t paths;
+	uint64_t bounces; //Sum of the path lengths
+	int longest;
+	uint64_t roulette; //Paths ended by russian roulette
+	uint64_t lengths[PATH_LENGTH_BINS]; //Histogram of path lengths
+};
 
-/// Recursive path tracer.
+/// Path tracer. Follows one path from the camera until it escapes, gets absorbed or ends by russian roulette.
 /// @param incidentRay View ray to be casted into the scene
 /// @param scene Scene to cast the ray into
-/// @param depth Current depth for recursive calls
-/// @param maxDepth Maximum depth of recursion
-/// @param rng A random number generator. One per execution thread.
-struct color pathTrace(const struct lightRay *incidentRay, const struct world *scene, int depth, int maxDepth, pcg32_random_t *rng);
+/// @param maxDepth Maximum amount of bounces
+/// @param rouletteDepth Bounces before paths may be ended by russian roulette
+/// @param sampler Random numbers for the pixel sample the path belongs to
+/// @param stats Statistics to record the path in, can be NULL
+struct color pathTrace(const struct lightRay *incidentRay, const struct world *scene, int maxDepth, int rouletteDepth, struct sampler *sampler, struct pathStats *stats);
+
+/// Continue a path from a hit that has already been found, with getClosestIsect() or a ray packet.
+/// Same as pathTrace() with the ray of the hit.
+/// @param isect Closest hit of the incident ray, with its surface computed. Used for the hits further along the path.
+/// @param scene Scene to cast the ray into
+/// @param maxDepth Maximum amount of bounces
+/// @param rouletteDepth Bounces before paths may be ended by russian roulette
+/// @param sampler Random numbers for the pixel sample the path belongs to
+/// @param stats Statistics to record the path in, can be NULL
+struct color pathTraceHit(struct hitRecord *isect, const struct world *scene, int maxDepth, int rouletteDepth, struct sampler *sampler, struct pathStats *stats);
+
+/// State for a path that has just left the camera
+struct pathState newPathState(void);
+
+/// Gather the light at a hit and scatter the path further, one bounce of pathTrace()
+/// @param path Path the hit is on
+/// @param isect Closest hit of the last ray of the path
+/// @param scene Scene the path is traced in
+/// @param maxDepth Maximum amount of bounces
+/// @param rouletteDepth Bounces before the path may be ended by russian roulette
+/// @param sampler Random numbers for the pixel sample the path belongs to
+/// @param next Set to the next ray to trace, if the path continues
+/// @param stats Statistics to record the path in when it ends, can be NULL
+/// @return true if the path continues with next
+bool continuePath(struct pathState *path, struct hitRecord *isect, const struct world *scene, int maxDepth, int rouletteDepth, struct sampler *sampler, struct lightRay *next, struct pathStats *stats);
+
+/// Sample the lights and the HDR environment of a scene directly from a hit, and trace shadow rays to the sampled points.
+/// Weighted against the BSDF scattering towards the same light with the power heuristic.
+/// @param scene Scene with its lights and environment distribution collected
+/// @param isect Hit to gather light at, with its surface computed
+/// @param sampler Random numbers for the pixel sample the path belongs to
+/// @return Light reflected towards the incident ray, or black if the sampled point was blocked or the BSDF is specular
+struct color sampleDirectLight(const struct world *scene, struct hitRecord *isect, struct sampler *sampler);
+
+/// Add up statistics of two sets of paths
+/// @param stats Statistics to add to
+/// @param other Statistics to add
+void addPathStats(struct pathStats *stats, const struct pathStats *other);
+
+/// Find the closest hit of a ray in a scene, and compute the surface properties there
+/// @param incidentRay Ray to cast
+/// @param scene Scene to cast the ray into
+struct hitRecord getClosestIsect(const struct lightRay *incidentRay, const struct world *scene);
+
+/// Color seen by a ray that escapes the scene, from the HDR environment or the ambient gradient
+/// @param incidentRay Ray that missed everything
+/// @param scene Scene the ray was cast into
+struct color getBackground(const struct lightRay *incidentRay, const struct world *scene);
+
+/// A hit record with no hit yet, for a ray about to be traced
+/// @param incidentRay Ray that will be traced
+struct hitRecord newHitRecord(const struct lightRay *incidentRay);
+
+/// Look up the material, and compute the hit point and normal, once the closest hit has been found. Does nothing for misses.
+/// @param scene Scene the hit is in
+/// @param isect Hit to finish
+void computeHitSurface(const struct world *scene, struct hitRecord *isect);
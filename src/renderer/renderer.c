@@ -24,12 +24,23 @@
 #include "../datatypes/mesh.h"
 #include "../datatypes/sphere.h"
 #include "../datatypes/vertexbuffer.h"
+#include "../acceleration/packet.h"
+#include "wavefront.h"
+#include "adaptive.h"
+#include "sampler.h"
 
 //Main thread loop speeds
 #define paused_msec 100
 #define active_msec  16
 
 void *renderThread(void *arg);
+void logPathStats(const struct pathStats *stats);
+
+int maxSampleCount(const struct prefs *prefs) {
+	if (prefs->adaptiveThreshold <= 0.0f) return prefs->sampleCount;
+	if (prefs->adaptiveMaxSamples <= 0) return prefs->sampleCount * ADAPTIVE_MAX_SAMPLES_FACTOR;
+	return max(prefs->sampleCount, prefs->adaptiveMaxSamples);
+}
 
 /// @todo Use defaultSettings state struct for this.
 /// @todo Clean this up, it's ugly.
@@ -62,6 +73,8 @@ struct texture *renderFrame(struct renderer *r) {
 	int pauser = 0;
 	int ctr = 1;
 	
+	r->state.pathStats = calloc(r->prefs.threadCount, sizeof(struct pathStats));
+	
 	//Create render threads (Nonblocking)
 	for (int t = 0; t < r->prefs.threadCount; ++t) {
 		r->state.threads[t] = (struct crThread){.thread_num = t, .threadComplete = false, .r = r, .output = output, .threadFunc = renderThread};
@@ -90,7 +103,7 @@ struct texture *renderFrame(struct renderer *r) {
 		//Run the sample printing about 4x/s
 		if (pauser == 280 / active_msec) {
 			float timePerSingleTileSample = finalAvg;
-			uint64_t totalTileSamples = r->state.tileCount * r->prefs.sampleCount;
+			uint64_t totalTileSamples = r->state.tileCount * maxSampleCount(&r->prefs);
 			uint64_t completedSamples = 0;
 			for (int t = 0; t < r->prefs.threadCount; ++t) {
 				completedSamples += r->state.threads[t].totalSamples;
@@ -130,9 +143,34 @@ struct texture *renderFrame(struct renderer *r) {
 	for (int t = 0; t < r->prefs.threadCount; ++t) {
 		checkThread(&r->state.threads[t]);
 	}
+	
+	struct pathStats stats = {0};
+	for (int t = 0; t < r->prefs.threadCount; ++t) {
+		addPathStats(&stats, &r->state.pathStats[t]);
+	}
+	logPathStats(&stats);
+	if (r->state.adaptive) {
+		float average = averageSampleCount(r->state.adaptive);
+		logr(info, "Adaptive sampling took %.1f samples per pixel on average, %.0f%% of the maximum\n", average, 100.0f * average / maxSampleCount(&r->prefs));
+	}
+	free(r->state.pathStats);
+	r->state.pathStats = NULL;
 	return output;
 }
 
+void logPathStats(const struct pathStats *stats) {
+	if (!stats->paths) return;
+	logr(info, "Path length: %.2f bounces on average, longest %i, %.1f%% ended by russian roulette\n",
+		 (double)stats->bounces / stats->paths, stats->longest, 100.0 * stats->roulette / stats->paths);
+	char histogram[PATH_LENGTH_BINS * 8] = "";
+	for (int i = 0; i < PATH_LENGTH_BINS; ++i) {
+		char bin[16];
+		snprintf(bin, sizeof(bin), "%s%.1f", i ? " " : "", 100.0 * stats->lengths[i] / stats->paths);
+		strcat(histogram, bin);
+	}
+	logr(debug, "Path lengths 0-%i+ (%%): %s\n", PATH_LENGTH_BINS - 1, histogram);
+}
+
 uint64_t hash(uint64_t x) {
 	x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
 	x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
@@ -140,6 +178,106 @@ uint64_t hash(uint64_t x) {
 	return x;
 }
 
+//Set up the ray to be cast through pixel x, y for one sample
+struct lightRay newCameraRay(const struct renderer *r, int x, int y, struct sampler *sampler) {
+	struct camera *camera = r->scene->camera;
+	float fracX = (float)x;
+	float fracY = (float)y;
+	
+	//A cheap 'antialiasing' of sorts. The more samples, the better this works
+	float jitter = 0.25f;
+	struct coord pixelPoint = getDimension2D(sampler);
+	if (r->prefs.antialiasing) {
+		fracX += (2.0f * pixelPoint.x - 1.0f) * jitter;
+		fracY += (2.0f * pixelPoint.y - 1.0f) * jitter;
+	}
+	
+	//Set up the light ray to be casted. direction is pointing towards the X,Y coordinate on the
+	//imaginary plane in front of the origin. startPos is just the camera position.
+	struct vector direction = vecNormalize((struct vector){
+								(fracX - 0.5f * r->prefs.imageWidth) / camera->focalLength,
+								(fracY - 0.5f * r->prefs.imageHeight) / camera->focalLength,
+								1.0f
+							});
+	struct vector startPos = camera->pos;
+	struct vector left = camera->left;
+	struct vector up = camera->up;
+	
+	//Run camera tranforms on direction vector
+	transformCameraView(camera, &direction);
+	
+	struct lightRay incidentRay = newRay(startPos, direction, rayTypeIncident);
+	
+	//Now handle aperture
+	if (camera->aperture > 0.0f) {
+		float ft = camera->focalDistance / direction.z;
+		struct vector focusPoint = alongRay(incidentRay, ft);
+		
+		struct coord lensPoint = coordScale(camera->aperture, randomCoordOnUnitDisc(getDimension2D(sampler)));
+		struct vector lensPos = vecAdd(vecAdd(startPos, vecScale(up, lensPoint.y)), vecScale(left, lensPoint.x));
+		incidentRay = newRay(lensPos, vecNormalize(vecSub(focusPoint, lensPos)), rayTypeIncident);
+	}
+	return incidentRay;
+}
+
+//For multi-sample rendering, we keep a running average of color values for each pixel
+void accumulateSample(struct renderer *r, struct texture *image, const struct renderTile *tile, int x, int y, struct color sample) {
+	//Get previous color value from render buffer
+	struct color output = textureGetPixel(r->state.renderBuffer, x, y);
+	
+	//And process the running average
+	output = colorCoef((float)(tile->completedSamples - 1), output);
+	
+	output = addColors(output, sample);
+	
+	output.red = output.red / tile->completedSamples;
+	output.green = output.green / tile->completedSamples;
+	output.blue = output.blue / tile->completedSamples;
+	
+	//Store internal render buffer (float precision)
+	blit(r->state.renderBuffer, output, x, y);
+	
+	//Gamma correction
+	output = toSRGB(output);
+	
+	//And store the image data
+	blit(image, output, x, y);
+	
+	if (r->state.adaptive) addAdaptiveSample(r->state.adaptive, x, y, sample);
+}
+
+//Trace one sample for a block of pixels, with the camera rays traversing the scene together as a packet.
+//Each pixel keeps its own sampler, so samples come out the same as when traced one by one.
+//Pixels that have converged with adaptive sampling are left out.
+void renderPacket(struct renderer *r, struct texture *image, const struct renderTile *tile, int beginX, int beginY, int endX, int endY, struct pathStats *stats) {
+	struct rayPacket packet;
+	struct hitRecord isects[RAY_PACKET_SIZE];
+	struct sampler samplers[RAY_PACKET_SIZE];
+	packet.count = 0;
+	for (int y = beginY; y < endY; ++y) {
+		for (int x = beginX; x < endX; ++x) {
+			if (r->state.adaptive && pixelConverged(r->state.adaptive, x, y)) continue;
+			initSampler(&samplers[packet.count], &r->prefs, x, y, tile->completedSamples - 1);
+			packet.rays[packet.count] = newCameraRay(r, x, y, &samplers[packet.count]);
+			isects[packet.count] = newHitRecord(&packet.rays[packet.count]);
+			packet.count++;
+		}
+	}
+	if (!packet.count) return;
+	finishRayPacket(&packet);
+	rayPacketIntersectsWithScene(r->scene, &packet, isects);
+	
+	int i = 0;
+	for (int y = beginY; y < endY; ++y) {
+		for (int x = beginX; x < endX; ++x) {
+			if (r->state.adaptive && pixelConverged(r->state.adaptive, x, y)) continue;
+			struct color sample = pathTraceHit(&isects[i], r->scene, r->prefs.bounces, r->prefs.rouletteDepth, &samplers[i], stats);
+			accumulateSample(r, image, tile, x, y, sample);
+			i++;
+		}
+	}
+}
+
 /**
  A render thread
  
@@ -147,11 +285,10 @@ uint64_t hash(uint64_t x) {
  @return Exits when thread is done
  */
 void *renderThread(void *arg) {
-	struct lightRay incidentRay;
 	struct crThread *thread = (struct crThread*)arg;
 	struct renderer *r = thread->r;
 	struct texture *image = thread->output;
-	pcg32_random_t rng;
+	struct sampler sampler;
 	
 	//First time setup for each thread
 	struct renderTile tile = nextTile(r);
@@ -159,89 +296,40 @@ void *renderThread(void *arg) {
 	
 	struct timeval timer = {0};
 	
-	float aperture = r->scene->camera->aperture;
-	float focalDistance = r->scene->camera->focalDistance;
+	struct pathStats *stats = &r->state.pathStats[thread->thread_num];
+	struct wavefront *wavefront = r->prefs.integrator == integratorWavefront ? newWavefront() : NULL;
 	
 	while (tile.tileNum != -1 && r->state.isRendering) {
 		long totalUsec = 0;
 		long samples = 0;
 		
-		while (tile.completedSamples < r->prefs.sampleCount+1 && r->state.isRendering) {
+		while (tile.completedSamples < maxSampleCount(&r->prefs) + 1 && r->state.isRendering) {
 			startTimer(&timer);
-			for (int y = tile.end.y - 1; y > tile.begin.y - 1; --y) {
-				for (int x = tile.begin.x; x < tile.end.x; ++x) {
-					if (r->state.renderAborted) return 0;
-					uint64_t pixIdx = y * image->width + x;
-					uint64_t uniqueIdx = pixIdx * r->prefs.sampleCount + tile.completedSamples;
-					pcg32_srandom_r(&rng, hash(uniqueIdx), 0);
-					
-					float fracX = (float)x;
-					float fracY = (float)y;
-					
-					//A cheap 'antialiasing' of sorts. The more samples, the better this works
-					float jitter = 0.25f;
-					if (r->prefs.antialiasing) {
-						fracX = rndFloatRange(fracX - jitter, fracX + jitter, &rng);
-						fracY = rndFloatRange(fracY - jitter, fracY + jitter, &rng);
+			if (wavefront) {
+				if (!renderTileWavefront(wavefront, r, image, &tile, stats)) {
+					destroyWavefront(wavefront);
+					return 0;
+				}
+			} else if (r->prefs.rayPackets) {
+				for (int y = tile.begin.y; y < tile.end.y; y += RAY_PACKET_WIDTH) {
+					for (int x = tile.begin.x; x < tile.end.x; x += RAY_PACKET_WIDTH) {
+						if (r->state.renderAborted) return 0;
+						renderPacket(r, image, &tile, x, y, min(x + RAY_PACKET_WIDTH, tile.end.x), min(y + RAY_PACKET_WIDTH, tile.end.y), stats);
 					}
-					
-					//Set up the light ray to be casted. direction is pointing towards the X,Y coordinate on the
-					//imaginary plane in front of the origin. startPos is just the camera position.
-					struct vector direction = vecNormalize((struct vector){
-												(fracX - 0.5f * image->width) / r->scene->camera->focalLength,
-												(fracY - 0.5f * image->height) / r->scene->camera->focalLength,
-												1.0f
-											});
-					struct vector startPos = r->scene->camera->pos;
-					struct vector left = r->scene->camera->left;
-					struct vector up = r->scene->camera->up;
-					
-					//Run camera tranforms on direction vector
-					transformCameraView(r->scene->camera, &direction);
-					
-					incidentRay.start = startPos;
-					incidentRay.direction = direction;
-					incidentRay.rayType = rayTypeIncident;
-					
-					//Now handle aperture
-					if (aperture <= 0.0f) {
-						incidentRay.start = startPos;
-					} else {
-						float ft = focalDistance / direction.z;
-						struct vector focusPoint = alongRay(incidentRay, ft);
+				}
+			} else {
+				for (int y = tile.end.y - 1; y > tile.begin.y - 1; --y) {
+					for (int x = tile.begin.x; x < tile.end.x; ++x) {
+						if (r->state.renderAborted) return 0;
+						if (r->state.adaptive && pixelConverged(r->state.adaptive, x, y)) continue;
+						initSampler(&sampler, &r->prefs, x, y, tile.completedSamples - 1);
 						
-						struct coord lensPoint = coordScale(aperture, randomCoordOnUnitDisc(&rng));
-						incidentRay.start = vecAdd(vecAdd(startPos, vecScale(up, lensPoint.y)), vecScale(left, lensPoint.x));
-						incidentRay.direction = vecNormalize(vecSub(focusPoint, incidentRay.start));
+						struct lightRay incidentRay = newCameraRay(r, x, y, &sampler);
 						
+						//Get new sample (path tracing is initiated here)
+						struct color sample = pathTrace(&incidentRay, r->scene, r->prefs.bounces, r->prefs.rouletteDepth, &sampler, stats);
+						accumulateSample(r, image, &tile, x, y, sample);
 					}
-					
-					//For multi-sample rendering, we keep a running average of color values for each pixel
-					//The next block of code does this
-					
-					//Get previous color value from render buffer
-					struct color output = textureGetPixel(r->state.renderBuffer, x, y);
-					
-					//Get new sample (path tracing is initiated here)
-					struct color sample = pathTrace(&incidentRay, r->scene, 0, r->prefs.bounces, &rng);
-					
-					//And process the running average
-					output = colorCoef((float)(tile.completedSamples - 1), output);
-					
-					output = addColors(output, sample);
-					
-					output.red = output.red / tile.completedSamples;
-					output.green = output.green / tile.completedSamples;
-					output.blue = output.blue / tile.completedSamples;
-					
-					//Store internal render buffer (float precision)
-					blit(r->state.renderBuffer, output, x, y);
-					
-					//Gamma correction
-					output = toSRGB(output);
-					
-					//And store the image data
-					blit(image, output, x, y);
 				}
 			}
 			//For performance metrics
@@ -255,6 +343,11 @@ void *renderThread(void *arg) {
 				sleepMSec(100);
 			}
 			thread->avgSampleTime = totalUsec / samples;
+			//With adaptive sampling, the tile is done once all of its pixels have converged
+			if (r->state.adaptive && updateConvergence(r->state.adaptive, &tile)) {
+				thread->totalSamples += maxSampleCount(&r->prefs) + 1 - tile.completedSamples;
+				break;
+			}
 		}
 		//Tile has finished rendering, get a new one and start rendering it.
 		r->state.renderTiles[tile.tileNum].isRendering = false;
@@ -264,6 +357,7 @@ void *renderThread(void *arg) {
 		tile = nextTile(r);
 		thread->currentTileNum = tile.tileNum;
 	}
+	destroyWavefront(wavefront);
 	//No more tiles to render, exit thread. (render done)
 	thread->threadComplete = true;
 	thread->currentTileNum = -1;
@@ -314,6 +408,7 @@ void destroyRenderer(struct renderer *r) {
 	
 	destroyTexture(r->state.renderBuffer);
 	destroyTexture(r->state.uiBuffer);
+	destroyAdaptiveSampler(r->state.adaptive);
 	
 	if (r->state.threads) {
 		free(r->state.threads);
@@ -321,6 +416,9 @@ void destroyRenderer(struct renderer *r) {
 	if (r->prefs.imgFileName) {
 		free(r->prefs.imgFileName);
 	}
+	if (r->prefs.bvhCachePath) {
+		free(r->prefs.bvhCachePath);
+	}
 	if (r->prefs.imgFilePath) {
 		free(r->prefs.imgFilePath);
 	}
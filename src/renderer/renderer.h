@@ -8,6 +8,13 @@
 
 #pragma once
 
+struct lightRay;
+struct renderTile;
+struct texture;
+struct color;
+struct pathStats;
+struct sampler;
+
 /// Renderer state data
 struct state {
 	struct renderTile *renderTiles; //Array of renderTiles to render
@@ -23,6 +30,8 @@ struct state {
 	float avgSampleRate; //In raw single pixel samples per second. (Used for benchmarking)
 	int timeSampleCount;//Used for render duration estimation, amount of time samples captured
 	struct crThread *threads; //Render threads
+	struct pathStats *pathStats; //Finished paths of each render thread
+	struct adaptiveSampler *adaptive; //Per-pixel statistics for adaptive sampling, NULL if every pixel gets sampleCount samples
 	struct timeval *timer;
 	
 	struct crMutex *tileMutex;
@@ -31,11 +40,26 @@ struct state {
 /// Preferences data (Set by user)
 struct prefs {
 	enum renderOrder tileOrder;
+	enum accelerator accelerator; //Acceleration structure to build for meshes that don't pick their own
+	float spatialSplitBudget; //Extra polygon references spatial splits may create, as a fraction of the polygon count
+	bool treeletOptimization; //Restructure linear BVHs to lower their SAH cost
+	char *bvhCachePath; //Directory to cache built acceleration structures in, NULL to always build them
+	bool wideBvh; //Collapse mesh BVHs into 4-wide nodes for traversal
+	bool quantizedBvh; //Store the wide nodes with 8-bit child bounds. Implies wideBvh
+	bool rayPackets; //Trace camera rays through the scene in 8x8 packets
+	enum integrator integrator; //Trace each path to the end, or all paths of a tile one bounce at a time
+	enum samplerType sampler; //Where the random numbers of each pixel sample come from
+	float bvhRebuildThreshold; //Rebuild refitted BVHs when their SAH cost grows by more than this fraction. 0 to always refit
 	
 	int threadCount; //Amount of threads to render with
 	bool fromSystem; //Did we ask the system for thread count
-	int sampleCount;
+	int sampleCount; //Samples per pixel. With adaptive sampling, converged pixels may stop before this, and noisy ones go past it
+	float adaptiveThreshold; //Stop sampling pixels once their estimated error drops below this. 0 to disable
+	int adaptiveMinSamples; //Samples every pixel takes before adaptive sampling may stop it
+	int adaptiveMaxSamples; //Most samples pixels that haven't converged may take with adaptive sampling. 0 for ADAPTIVE_MAX_SAMPLES_FACTOR * sampleCount
 	int bounces;
+	int rouletteDepth; //Bounces before paths may be ended by russian roulette
+	bool nextEventEstimation; //Sample lights directly at diffuse bounces
 	int tileWidth;
 	int tileHeight;
 	
@@ -72,5 +96,17 @@ struct renderer *newRenderer(void);
 //Start main render loop
 struct texture *renderFrame(struct renderer *r);
 
+//Most samples any pixel may take. With adaptive sampling, pixels that haven't converged may go past sampleCount.
+int maxSampleCount(const struct prefs *prefs);
+
+//Scramble a pixel sample index into an rng seed
+uint64_t hash(uint64_t x);
+
+//Set up the camera ray for one sample of pixel x, y
+struct lightRay newCameraRay(const struct renderer *r, int x, int y, struct sampler *sampler);
+
+//Add a finished sample of pixel x, y to the running average of the tile
+void accumulateSample(struct renderer *r, struct texture *image, const struct renderTile *tile, int x, int y, struct color sample);
+
 //Free renderer allocations
 void destroyRenderer(struct renderer *r);
@@ -0,0 +1,160 @@
+//
+//  sampler.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "sampler.h"
+
+#include "renderer.h"
+
+//Largest float below 1
+#define ONE_MINUS_EPSILON 0.99999994f
+
+uint32_t reverseBits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+	x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+	x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+	x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+	return x;
+}
+
+//Hash based permutation of Burley 2020, "Practical Hash-based Owen Scrambling".
+//Each bit is only flipped depending on the seed and the bits below it, so applied to bit reversed values, it's an Owen scramble.
+uint32_t laineKarras(uint32_t x, uint32_t seed) {
+	x += seed;
+	x ^= x * 0x6c50b47c;
+	x ^= x * 0xb82f1e52;
+	x ^= x * 0xc7afe638;
+	x ^= x * 0x8d22f6e6;
+	return x;
+}
+
+//Seed for a dimension, a cheaper hash than hash() since it's done for every draw
+uint32_t mixSeed(uint32_t seed, uint32_t value) {
+	uint32_t x = seed ^ (value * 0x9e3779b9);
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+//Second dimension of the Sobol sequence, in reversed bit order. The first is just the index.
+//Its direction numbers are Pascal's triangle mod 2, so bit j is the parity of the index bits i that have the bits of j set.
+uint32_t pascalTransform(uint32_t x) {
+	x ^= (x >> 1) & 0x55555555;
+	x ^= (x >> 2) & 0x33333333;
+	x ^= (x >> 4) & 0x0f0f0f0f;
+	x ^= (x >> 8) & 0x00ff00ff;
+	x ^= (x >> 16) & 0x0000ffff;
+	return x;
+}
+
+//Permute the base 4 digits of the Z curve index of a pixel sample, each depending on the digits above it, like Ahmed and Wonka 2020,
+//"Screen-space blue-noise diffusion of Monte Carlo sampling error via hierarchical ordering of pixels".
+//Neighboring pixels share their upper digits, so they split the points of the sequence between them.
+uint64_t blueNoiseIndex(const struct sampler *sampler, int dimension) {
+	static const uint8_t permutations[24][4] = {
+		{0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+		{1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+		{2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+		{3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}
+	};
+	uint64_t index = 0;
+	//An odd amount of sample bits leaves one base 2 digit at the bottom
+	int odd = sampler->sampleBits & 1;
+	for (int i = sampler->digits - 1; i >= odd; --i) {
+		int shift = 2 * i - odd;
+		int digit = (sampler->index >> shift) & 3;
+		uint64_t higher = sampler->index >> (shift + 2);
+		int permutation = mixSeed((uint32_t)(higher ^ (higher >> 32)), dimension) % 24;
+		index |= (uint64_t)permutations[permutation][digit] << shift;
+	}
+	if (odd) {
+		uint64_t higher = sampler->index >> 1;
+		index |= (sampler->index & 1) ^ (mixSeed((uint32_t)(higher ^ (higher >> 32)), dimension) & 1);
+	}
+	return index;
+}
+
+//Index of the point a dimension is drawn from. Index bits past 32 only change the result below float precision, so they're dropped.
+uint32_t sequenceIndex(const struct sampler *sampler, int dimension) {
+	//Shuffled with an Owen scramble of the index, so the first samples of a pixel stay stratified
+	if (sampler->type == samplerSobol) return reverseBits(laineKarras((uint32_t)sampler->index, mixSeed(sampler->seed, dimension)));
+	return (uint32_t)blueNoiseIndex(sampler, dimension);
+}
+
+float sequenceValue(const struct sampler *sampler, uint32_t index, int dimension, int component) {
+	uint32_t bits = component ? pascalTransform(index) : index;
+	//Owen scrambled, then reversed to a fraction
+	bits = reverseBits(laineKarras(bits, mixSeed(sampler->seed, 2 * dimension + component + 1)));
+	return min(bits * (1.0f / (1ull << 32)), ONE_MINUS_EPSILON);
+}
+
+int ceilLog2(uint32_t x) {
+	int log = 0;
+	while ((1u << log) < x) log++;
+	return log;
+}
+
+//Interleave the bits of x and y
+uint64_t mortonCode2D(uint32_t x, uint32_t y) {
+	uint64_t code = 0;
+	for (int i = 0; i < 32; ++i) {
+		code |= (uint64_t)((x >> i) & 1) << (2 * i);
+		code |= (uint64_t)((y >> i) & 1) << (2 * i + 1);
+	}
+	return code;
+}
+
+void initSampler(struct sampler *sampler, const struct prefs *prefs, int x, int y, int sample) {
+	sampler->type = prefs->sampler;
+	sampler->dimension = 0;
+	uint64_t pixIdx = (uint64_t)y * prefs->imageWidth + x;
+	switch (sampler->type) {
+		case samplerRandom:
+			pcg32_srandom_r(&sampler->rng, hash(pixIdx * maxSampleCount(prefs) + sample), 0);
+			break;
+		case samplerSobol:
+			sampler->index = reverseBits(sample);
+			sampler->seed = (uint32_t)hash(pixIdx);
+			break;
+		case samplerBlueNoise:
+			sampler->sampleBits = ceilLog2(maxSampleCount(prefs));
+			sampler->digits = ceilLog2(max(prefs->imageWidth, prefs->imageHeight)) + (sampler->sampleBits + 1) / 2;
+			sampler->index = mortonCode2D(x, y) << sampler->sampleBits | sample;
+			//The same scrambles for every pixel, so they keep sharing one sequence
+			sampler->seed = 0;
+			break;
+	}
+}
+
+void startBounce(struct sampler *sampler, int depth) {
+	sampler->dimension = SAMPLER_CAMERA_DIMENSIONS + depth * SAMPLER_BOUNCE_DIMENSIONS;
+}
+
+float getDimension(struct sampler *sampler) {
+	int dimension = sampler->dimension++;
+	if (sampler->type == samplerRandom) return rndFloat(&sampler->rng);
+	return sequenceValue(sampler, sequenceIndex(sampler, dimension), dimension, 0);
+}
+
+struct coord getDimension2D(struct sampler *sampler) {
+	int dimension = sampler->dimension++;
+	struct coord point;
+	if (sampler->type == samplerRandom) {
+		point.x = rndFloat(&sampler->rng);
+		point.y = rndFloat(&sampler->rng);
+	} else {
+		uint32_t index = sequenceIndex(sampler, dimension);
+		point.x = sequenceValue(sampler, index, dimension, 0);
+		point.y = sequenceValue(sampler, index, dimension, 1);
+	}
+	return point;
+}
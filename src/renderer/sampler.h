@@ -0,0 +1,54 @@
+//
+//  sampler.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+#include "../datatypes/vector.h"
+
+struct prefs;
+
+//Camera rays take the first dimensions, for the position in the pixel and on the lens
+#define SAMPLER_CAMERA_DIMENSIONS 2
+//Each bounce starts at a fixed dimension, so the same decisions line up across the samples of a pixel
+#define SAMPLER_BOUNCE_DIMENSIONS 8
+
+/// Random numbers for one sample of one pixel, indexed by pixel, sample and dimension.
+/// Every draw takes the next dimension, a 1D value or a 2D point.
+/// samplerRandom draws white noise from PCG, seeded per pixel sample.
+/// samplerSobol draws from a (0, 2) Sobol sequence for each dimension, Owen scrambled and shuffled per pixel and dimension,
+/// so each pixel gets well stratified samples in every dimension.
+/// samplerBlueNoise orders the samples of all pixels along a Z curve before drawing them from the same sequence,
+/// so neighboring pixels get samples that complement each other, and what error remains is spread out as blue noise.
+struct sampler {
+	enum samplerType type;
+	pcg32_random_t rng; //samplerRandom
+	uint64_t index; //samplerSobol: Sample within the pixel, bit reversed. samplerBlueNoise: Morton code of the pixel, followed by the sample
+	uint32_t seed; //Scrambles, per pixel for samplerSobol
+	int sampleBits; //samplerBlueNoise: Bits of index taken by the sample
+	int digits; //samplerBlueNoise: Base 4 digits in index
+	int dimension; //Next dimension to draw
+};
+
+/// Start drawing the dimensions of a sample
+/// @param sampler Sampler to set up
+/// @param prefs Sampler type, image size and sample count of the render
+/// @param x Pixel x
+/// @param y Pixel y
+/// @param sample Index of the sample in the pixel, from 0
+void initSampler(struct sampler *sampler, const struct prefs *prefs, int x, int y, int sample);
+
+/// Skip to the dimensions of a bounce, so they don't depend on what earlier bounces drew
+/// @param sampler Sampler of the path
+/// @param depth Bounces so far
+void startBounce(struct sampler *sampler, int depth);
+
+/// Draw the next dimension, uniform in [0, 1)
+float getDimension(struct sampler *sampler);
+
+/// Draw the next dimension as a point, uniform in [0, 1) on both axes, and stratified together for the sequences
+struct coord getDimension2D(struct sampler *sampler);
@@ -0,0 +1,206 @@
+//
+//  wavefront.c
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#include "../includes.h"
+#include "wavefront.h"
+
+#include "renderer.h"
+#include "pathtrace.h"
+#include "adaptive.h"
+#include "sampler.h"
+#include "../datatypes/scene.h"
+#include "../datatypes/tile.h"
+#include "../datatypes/texture.h"
+#include "../acceleration/bvh.h"
+#include "../acceleration/lbvh.h"
+#include "../acceleration/packet.h"
+
+struct wavefrontPath {
+	struct lightRay ray;
+	struct hitRecord isect;
+	struct pathState state;
+	struct sampler sampler;
+	int x, y;
+};
+
+struct pathKey {
+	uint16_t key;
+	int path;
+};
+
+struct wavefront {
+	struct wavefrontPath *paths;
+	struct pathKey *keys;
+	struct pathKey *sorted;
+	int *active; //Paths still being traced, in the order of the current stage
+	int capacity;
+};
+
+struct wavefront *newWavefront() {
+	return calloc(1, sizeof(struct wavefront));
+}
+
+void reserveWavefront(struct wavefront *wavefront, int count) {
+	if (count <= wavefront->capacity) return;
+	wavefront->paths = realloc(wavefront->paths, count * sizeof(struct wavefrontPath));
+	wavefront->keys = realloc(wavefront->keys, count * sizeof(struct pathKey));
+	wavefront->sorted = realloc(wavefront->sorted, count * sizeof(struct pathKey));
+	wavefront->active = realloc(wavefront->active, count * sizeof(int));
+	wavefront->capacity = count;
+}
+
+//Stable radix sort of the keys, one byte at a time, then order the active paths by them.
+//A tile only has around a thousand paths, so this is much cheaper than a comparison sort.
+void sortActivePaths(struct wavefront *wavefront, int count) {
+	struct pathKey *src = wavefront->keys;
+	struct pathKey *dst = wavefront->sorted;
+	for (int shift = 0; shift < 16; shift += 8) {
+		int offsets[256] = {0};
+		for (int i = 0; i < count; ++i) {
+			offsets[(src[i].key >> shift) & 0xff]++;
+		}
+		int sum = 0;
+		for (int b = 0; b < 256; ++b) {
+			int bucketCount = offsets[b];
+			offsets[b] = sum;
+			sum += bucketCount;
+		}
+		for (int i = 0; i < count; ++i) {
+			dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+		struct pathKey *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	for (int i = 0; i < count; ++i) {
+		wavefront->active[i] = src[i].path;
+	}
+}
+
+//Direction octant in the top bits, then the origin along a coarse Morton curve within the scene bounds
+uint16_t rayKey(const struct lightRay *ray, struct vector sceneMin, struct vector sceneExtent) {
+	struct vector position = {
+		(ray->start.x - sceneMin.x) / sceneExtent.x,
+		(ray->start.y - sceneMin.y) / sceneExtent.y,
+		(ray->start.z - sceneMin.z) / sceneExtent.z
+	};
+	int octant = ray->sign[0] << 2 | ray->sign[1] << 1 | ray->sign[2];
+	return (uint16_t)(octant << 13 | mortonCode(position) >> 50);
+}
+
+//Misses first, then hits grouped by the BSDF of their material
+uint16_t materialKey(const struct hitRecord *isect) {
+	return isect->didIntersect ? (uint16_t)isect->material->type + 1 : 0;
+}
+
+//Camera rays are generated in packet sized blocks, so they can be intersected as packets as they are
+int generateCameraPaths(struct wavefront *wavefront, struct renderer *r, const struct renderTile *tile) {
+	int count = 0;
+	for (int blockY = tile->begin.y; blockY < tile->end.y; blockY += RAY_PACKET_WIDTH) {
+		for (int blockX = tile->begin.x; blockX < tile->end.x; blockX += RAY_PACKET_WIDTH) {
+			for (int y = blockY; y < min(blockY + RAY_PACKET_WIDTH, tile->end.y); ++y) {
+				for (int x = blockX; x < min(blockX + RAY_PACKET_WIDTH, tile->end.x); ++x) {
+					if (r->state.adaptive && pixelConverged(r->state.adaptive, x, y)) continue;
+					struct wavefrontPath *path = &wavefront->paths[count];
+					initSampler(&path->sampler, &r->prefs, x, y, tile->completedSamples - 1);
+					path->ray = newCameraRay(r, x, y, &path->sampler);
+					path->state = newPathState();
+					path->x = x;
+					path->y = y;
+					wavefront->active[count] = count;
+					count++;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+void intersectCameraPaths(struct wavefront *wavefront, const struct world *scene, int count) {
+	struct rayPacket packet;
+	struct hitRecord isects[RAY_PACKET_SIZE];
+	for (int first = 0; first < count; first += RAY_PACKET_SIZE) {
+		packet.count = min(RAY_PACKET_SIZE, count - first);
+		for (int i = 0; i < packet.count; ++i) {
+			packet.rays[i] = wavefront->paths[wavefront->active[first + i]].ray;
+			isects[i] = newHitRecord(&packet.rays[i]);
+		}
+		finishRayPacket(&packet);
+		rayPacketIntersectsWithScene(scene, &packet, isects);
+		for (int i = 0; i < packet.count; ++i) {
+			wavefront->paths[wavefront->active[first + i]].isect = isects[i];
+		}
+	}
+}
+
+void intersectPaths(struct wavefront *wavefront, const struct world *scene, int count) {
+	struct vector sceneMin = {0.0f, 0.0f, 0.0f};
+	struct vector extent = {1.0f, 1.0f, 1.0f};
+	if (scene->topLevel->nodeCount) {
+		const struct bvhNode *root = &scene->topLevel->nodes[0];
+		sceneMin = root->start;
+		extent = vecSub(root->end, root->start);
+		//Avoid dividing by zero for flat scenes
+		extent = (struct vector){max(extent.x, 0.0001f), max(extent.y, 0.0001f), max(extent.z, 0.0001f)};
+	}
+	for (int i = 0; i < count; ++i) {
+		int path = wavefront->active[i];
+		wavefront->keys[i] = (struct pathKey){rayKey(&wavefront->paths[path].ray, sceneMin, extent), path};
+	}
+	sortActivePaths(wavefront, count);
+	for (int i = 0; i < count; ++i) {
+		struct wavefrontPath *path = &wavefront->paths[wavefront->active[i]];
+		path->isect = getClosestIsect(&path->ray, scene);
+	}
+}
+
+bool renderTileWavefront(struct wavefront *wavefront, struct renderer *r, struct texture *image, const struct renderTile *tile, struct pathStats *stats) {
+	reserveWavefront(wavefront, (tile->end.x - tile->begin.x) * (tile->end.y - tile->begin.y));
+	int count = generateCameraPaths(wavefront, r, tile);
+	bool cameraRays = true;
+	while (count > 0) {
+		if (r->state.renderAborted) return false;
+		
+		//Camera rays are coherent as generated, later bounces are sorted to regain some of that
+		if (cameraRays && r->prefs.rayPackets) {
+			intersectCameraPaths(wavefront, r->scene, count);
+		} else {
+			intersectPaths(wavefront, r->scene, count);
+		}
+		cameraRays = false;
+		
+		for (int i = 0; i < count; ++i) {
+			int path = wavefront->active[i];
+			wavefront->keys[i] = (struct pathKey){materialKey(&wavefront->paths[path].isect), path};
+		}
+		sortActivePaths(wavefront, count);
+		
+		//Shade, and compact the paths that continue to the front of the active list
+		int alive = 0;
+		for (int i = 0; i < count; ++i) {
+			struct wavefrontPath *path = &wavefront->paths[wavefront->active[i]];
+			if (continuePath(&path->state, &path->isect, r->scene, r->prefs.bounces, r->prefs.rouletteDepth, &path->sampler, &path->ray, stats)) {
+				wavefront->active[alive++] = wavefront->active[i];
+			} else {
+				accumulateSample(r, image, tile, path->x, path->y, path->state.radiance);
+			}
+		}
+		count = alive;
+	}
+	return true;
+}
+
+void destroyWavefront(struct wavefront *wavefront) {
+	if (wavefront) {
+		free(wavefront->paths);
+		free(wavefront->keys);
+		free(wavefront->sorted);
+		free(wavefront->active);
+		free(wavefront);
+	}
+}
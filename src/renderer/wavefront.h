@@ -0,0 +1,36 @@
+//
+//  wavefront.h
+//  C-ray
+//
+//  Created by Valtteri Koskivuori on 17/10/2026.
+//  Copyright © 2015-2020 Valtteri Koskivuori. All rights reserved.
+//
+
+#pragma once
+
+struct renderer;
+struct renderTile;
+struct texture;
+struct pathStats;
+
+/// Paths of a tile in flight, traced one bounce at a time for all of them.
+/// Each bounce is a set of stages: intersect all rays sorted by direction octant and origin,
+/// shade all hits grouped by material BSDF, then compact the paths that are still alive.
+/// Kept around by a render thread, so the path buffers are reused between tiles.
+struct wavefront;
+
+/// Create an empty wavefront, buffers are allocated for the first tile
+struct wavefront *newWavefront(void);
+
+/// Trace one sample for every pixel in a tile, and add them to the running averages, like pathTrace() does per pixel.
+/// Each path keeps its own sampler, so the samples match the depth first path tracer.
+/// @param wavefront Wavefront to trace with
+/// @param r Renderer with the scene and prefs
+/// @param image Image to write the averaged samples to
+/// @param tile Tile to render, completedSamples being the sample to trace
+/// @param stats Statistics to record the finished paths in
+/// @return false if the render was aborted before the sample was done
+bool renderTileWavefront(struct wavefront *wavefront, struct renderer *r, struct texture *image, const struct renderTile *tile, struct pathStats *stats);
+
+/// Free a wavefront and its buffers
+void destroyWavefront(struct wavefront *wavefront);
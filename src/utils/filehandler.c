@@ -18,11 +18,16 @@
 
 #include "../libraries/lodepng.h"
 #include "assert.h"
+#include "memory.h"
 
 #include <limits.h> //For SSIZE_MAX
 
 #ifndef WINDOWS
 #include <sys/utsname.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <libgen.h>
 #endif
 
@@ -160,6 +165,51 @@ char *loadFile(char *inputFileName, size_t *bytes) {
 	return buf;
 }
 
+#define MAP_FALLBACK_ALIGNMENT 4096
+
+void *mapFile(const char *fileName, size_t *bytes) {
+#ifdef WINDOWS
+	FILE *f = fopen(fileName, "rb");
+	if (!f) return NULL;
+	fseek(f, 0L, SEEK_END);
+	size_t size = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	void *data = size ? cray_aligned_malloc(MAP_FALLBACK_ALIGNMENT, size) : NULL;
+	if (!data || fread(data, 1, size, f) != size) {
+		if (data) cray_aligned_free(data);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*bytes = size;
+	return data;
+#else
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat info;
+	if (fstat(fd, &info) || info.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	//The mapping stays valid after the descriptor is closed
+	void *data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return NULL;
+	*bytes = info.st_size;
+	return data;
+#endif
+}
+
+void unmapFile(void *data, size_t bytes) {
+	if (!data) return;
+#ifdef WINDOWS
+	(void)bytes;
+	cray_aligned_free(data);
+#else
+	munmap(data, bytes);
+#endif
+}
+
 //Wait for 2 secs and abort if nothing is coming in from stdin
 void checkBuf() {
 #ifndef WINDOWS
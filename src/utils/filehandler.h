@@ -24,6 +24,18 @@ void writeImage(struct texture *image, struct renderInfo imginfo);
 
 char *loadFile(char *inputFileName, size_t *bytes);
 
+/// Map a file into memory. Writes to the mapping are private, and never end up in the file.
+/// On Windows the file is just read into a page aligned buffer instead.
+/// @param fileName File to map
+/// @param bytes Size of the file is stored here
+/// @return Page aligned contents of the file, or NULL if it couldn't be opened. Release with unmapFile()
+void *mapFile(const char *fileName, size_t *bytes);
+
+/// Release a file mapped with mapFile()
+/// @param data Mapping to release
+/// @param bytes Size of the mapping
+void unmapFile(void *data, size_t bytes);
+
 /**
  Extract the filename from a given file path
 
@@ -12,12 +12,14 @@
 #include "../../libraries/cJSON.h"
 #include "../../libraries/obj_parser.h"
 #include "../../datatypes/scene.h"
+#include "../../datatypes/environment.h"
 #include "../../datatypes/vertexbuffer.h"
 #include "../../datatypes/vector.h"
 #include "../../datatypes/camera.h"
 #include "../../datatypes/texture.h"
 #include "../../datatypes/mesh.h"
 #include "../../datatypes/sphere.h"
+#include "../../datatypes/instance.h"
 #include "../../datatypes/material.h"
 #include "../../datatypes/poly.h"
 #include "../../datatypes/transforms.h"
@@ -95,6 +97,7 @@ bool loadMeshNew(struct renderer *r, char *inputFilePath) {
 	struct mesh *newMesh = parseOBJFile(inputFilePath);
 	if (newMesh != NULL) {
 		r->scene->meshes[r->scene->meshCount] = *newMesh;
+		r->scene->meshes[r->scene->meshCount].accelerator = r->prefs.accelerator;
 		free(newMesh);
 		valid = true;
 		loadMeshTextures(r->prefs.assetPath, &r->scene->meshes[r->scene->meshCount]);
@@ -107,10 +110,14 @@ bool loadMeshNew(struct renderer *r, char *inputFilePath) {
 bool loadMesh(struct renderer *r, char *inputFilePath, int idx, int meshCount) {
 	logr(info, "Loading mesh %i/%i\r", idx, meshCount);
 	
+	//The OBJ parser cuts the file name off the path, so grab it first
+	char *name = NULL;
+	copyString(getFileName(inputFilePath), &name);
 	obj_scene_data data;
 	if (parse_obj_scene(&data, inputFilePath) == 0) {
 		printf("\n");
-		logr(warning, "Mesh \"%s\" not found!\n", getFileName(inputFilePath));
+		logr(warning, "Mesh \"%s\" not found!\n", name);
+		free(name);
 		return false;
 	}
 	
@@ -131,10 +138,13 @@ bool loadMesh(struct renderer *r, char *inputFilePath, int idx, int meshCount) {
 	newMesh->polyCount = data.face_count;
 	//Transforms init
 	newMesh->transformCount = 0;
+	//Acceleration structures are built later in computeKDTrees()
+	newMesh->accelerator = r->prefs.accelerator;
+	newMesh->bvh = NULL;
 	
 	newMesh->materialCount = 0;
-	//Set name
-	copyString(getFileName(inputFilePath), &newMesh->name);
+	newMesh->instanced = false;
+	newMesh->name = name;
 	
 	//Update vector and poly counts
 	vertexCount += data.vertex_count;
@@ -431,12 +441,67 @@ struct transform *parseTransforms(const cJSON *data) {
 	return transforms;
 }
 
+//Returns false if the name doesn't match any accelerator
+bool parseAccelerator(const char *name, enum accelerator *accelerator) {
+	if (strcmp(name, "bvh") == 0) {
+		*accelerator = acceleratorBvh;
+	} else if (strcmp(name, "kdtree") == 0) {
+		*accelerator = acceleratorKdTree;
+	} else if (strcmp(name, "sbvh") == 0) {
+		*accelerator = acceleratorSbvh;
+	} else if (strcmp(name, "lbvh") == 0) {
+		*accelerator = acceleratorLbvh;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+//Returns false if the name doesn't match any sampler
+bool parseSampler(const char *name, enum samplerType *sampler) {
+	if (strcmp(name, "random") == 0) {
+		*sampler = samplerRandom;
+	} else if (strcmp(name, "sobol") == 0) {
+		*sampler = samplerSobol;
+	} else if (strcmp(name, "blueNoise") == 0) {
+		*sampler = samplerBlueNoise;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+//Returns false if the name doesn't match any integrator
+bool parseIntegrator(const char *name, enum integrator *integrator) {
+	if (strcmp(name, "pathtrace") == 0) {
+		*integrator = integratorPathTrace;
+	} else if (strcmp(name, "wavefront") == 0) {
+		*integrator = integratorWavefront;
+	} else {
+		return false;
+	}
+	return true;
+}
+
 struct prefs defaultPrefs() {
 	return (struct prefs){
 		.tileOrder = renderOrderFromMiddle,
+		.accelerator = acceleratorBvh,
+		.spatialSplitBudget = 0.3f,
+		.treeletOptimization = false,
+		.wideBvh = true,
+		.quantizedBvh = false,
+		.rayPackets = true,
+		.integrator = integratorPathTrace,
+		.sampler = samplerRandom,
 		.threadCount = getSysCores(), //We run getSysCores() for this
 		.sampleCount = 25,
+		.adaptiveThreshold = 0.0f,
+		.adaptiveMinSamples = 16,
+		.adaptiveMaxSamples = 0,
 		.bounces = 20,
+		.rouletteDepth = 4,
+		.nextEventEstimation = true,
 		.tileWidth = 32,
 		.tileHeight = 32,
 		.antialiasing = true,
@@ -456,11 +521,26 @@ struct prefs parsePrefs(const cJSON *data) {
 	
 	const cJSON *threads = NULL;
 	const cJSON *samples = NULL;
+	const cJSON *adaptiveThreshold = NULL;
+	const cJSON *adaptiveMinSamples = NULL;
+	const cJSON *adaptiveMaxSamples = NULL;
 	const cJSON *antialiasing = NULL;
 	const cJSON *tileWidth = NULL;
 	const cJSON *tileHeight = NULL;
 	const cJSON *tileOrder = NULL;
+	const cJSON *accelerator = NULL;
+	const cJSON *bvhCachePath = NULL;
+	const cJSON *bvhRebuildThreshold = NULL;
+	const cJSON *wideBvh = NULL;
+	const cJSON *quantizedBvh = NULL;
+	const cJSON *rayPackets = NULL;
+	const cJSON *integrator = NULL;
+	const cJSON *sampler = NULL;
+	const cJSON *spatialSplitBudget = NULL;
+	const cJSON *treeletOptimization = NULL;
 	const cJSON *bounces = NULL;
+	const cJSON *rouletteDepth = NULL;
+	const cJSON *nextEventEstimation = NULL;
 	const cJSON *filePath = NULL;
 	const cJSON *fileName = NULL;
 	const cJSON *count = NULL;
@@ -501,6 +581,39 @@ struct prefs parsePrefs(const cJSON *data) {
 		p.sampleCount = defaultPrefs().sampleCount;
 	}
 	
+	adaptiveThreshold = cJSON_GetObjectItem(data, "adaptiveThreshold");
+	if (adaptiveThreshold) {
+		if (cJSON_IsNumber(adaptiveThreshold)) {
+			p.adaptiveThreshold = max(adaptiveThreshold->valuedouble, 0.0f);
+		} else {
+			logr(warning, "Invalid adaptiveThreshold while parsing renderer\n");
+		}
+	} else {
+		p.adaptiveThreshold = defaultPrefs().adaptiveThreshold;
+	}
+	
+	adaptiveMinSamples = cJSON_GetObjectItem(data, "adaptiveMinSamples");
+	if (adaptiveMinSamples) {
+		if (cJSON_IsNumber(adaptiveMinSamples) && adaptiveMinSamples->valueint >= 1) {
+			p.adaptiveMinSamples = adaptiveMinSamples->valueint;
+		} else {
+			logr(warning, "Invalid adaptiveMinSamples while parsing renderer\n");
+		}
+	} else {
+		p.adaptiveMinSamples = defaultPrefs().adaptiveMinSamples;
+	}
+	
+	adaptiveMaxSamples = cJSON_GetObjectItem(data, "adaptiveMaxSamples");
+	if (adaptiveMaxSamples) {
+		if (cJSON_IsNumber(adaptiveMaxSamples) && adaptiveMaxSamples->valueint >= 0) {
+			p.adaptiveMaxSamples = adaptiveMaxSamples->valueint;
+		} else {
+			logr(warning, "Invalid adaptiveMaxSamples while parsing renderer\n");
+		}
+	} else {
+		p.adaptiveMaxSamples = defaultPrefs().adaptiveMaxSamples;
+	}
+	
 	
 	bounces = cJSON_GetObjectItem(data, "bounces");
 	if (bounces) {
@@ -517,6 +630,28 @@ struct prefs parsePrefs(const cJSON *data) {
 		p.bounces = defaultPrefs().bounces;
 	}
 	
+	rouletteDepth = cJSON_GetObjectItem(data, "rouletteDepth");
+	if (rouletteDepth) {
+		if (cJSON_IsNumber(rouletteDepth) && rouletteDepth->valueint >= 0) {
+			p.rouletteDepth = rouletteDepth->valueint;
+		} else {
+			logr(warning, "Invalid rouletteDepth while parsing renderer\n");
+		}
+	} else {
+		p.rouletteDepth = defaultPrefs().rouletteDepth;
+	}
+	
+	nextEventEstimation = cJSON_GetObjectItem(data, "nextEventEstimation");
+	if (nextEventEstimation) {
+		if (cJSON_IsBool(nextEventEstimation)) {
+			p.nextEventEstimation = cJSON_IsTrue(nextEventEstimation);
+		} else {
+			logr(warning, "Invalid nextEventEstimation bool while parsing renderer\n");
+		}
+	} else {
+		p.nextEventEstimation = defaultPrefs().nextEventEstimation;
+	}
+	
 	antialiasing = cJSON_GetObjectItem(data, "antialiasing");
 	if (antialiasing) {
 		if (cJSON_IsBool(antialiasing)) {
@@ -581,6 +716,121 @@ struct prefs parsePrefs(const cJSON *data) {
 		p.tileOrder = defaultPrefs().tileOrder;
 	}
 	
+	accelerator = cJSON_GetObjectItem(data, "accelerator");
+	if (accelerator) {
+		if (cJSON_IsString(accelerator)) {
+			if (!parseAccelerator(accelerator->valuestring, &p.accelerator)) {
+				logr(warning, "Unknown accelerator \"%s\", defaulting to BVH\n", accelerator->valuestring);
+				p.accelerator = acceleratorBvh;
+			}
+		} else {
+			logr(warning, "Invalid accelerator while parsing renderer\n");
+		}
+	} else {
+		p.accelerator = defaultPrefs().accelerator;
+	}
+	
+	spatialSplitBudget = cJSON_GetObjectItem(data, "spatialSplitBudget");
+	if (spatialSplitBudget) {
+		if (cJSON_IsNumber(spatialSplitBudget)) {
+			p.spatialSplitBudget = max(spatialSplitBudget->valuedouble, 0.0f);
+		} else {
+			logr(warning, "Invalid spatialSplitBudget while parsing renderer\n");
+		}
+	} else {
+		p.spatialSplitBudget = defaultPrefs().spatialSplitBudget;
+	}
+	
+	treeletOptimization = cJSON_GetObjectItem(data, "treeletOptimization");
+	if (treeletOptimization) {
+		if (cJSON_IsBool(treeletOptimization)) {
+			p.treeletOptimization = cJSON_IsTrue(treeletOptimization);
+		} else {
+			logr(warning, "Invalid treeletOptimization bool while parsing renderer\n");
+		}
+	} else {
+		p.treeletOptimization = defaultPrefs().treeletOptimization;
+	}
+	
+	bvhCachePath = cJSON_GetObjectItem(data, "bvhCachePath");
+	if (bvhCachePath) {
+		if (cJSON_IsString(bvhCachePath)) {
+			copyString(bvhCachePath->valuestring, &p.bvhCachePath);
+		} else {
+			logr(warning, "Invalid bvhCachePath while parsing renderer\n");
+		}
+	}
+	
+	bvhRebuildThreshold = cJSON_GetObjectItem(data, "bvhRebuildThreshold");
+	if (bvhRebuildThreshold) {
+		if (cJSON_IsNumber(bvhRebuildThreshold)) {
+			p.bvhRebuildThreshold = max(bvhRebuildThreshold->valuedouble, 0.0f);
+		} else {
+			logr(warning, "Invalid bvhRebuildThreshold while parsing renderer\n");
+		}
+	}
+	
+	wideBvh = cJSON_GetObjectItem(data, "wideBvh");
+	if (wideBvh) {
+		if (cJSON_IsBool(wideBvh)) {
+			p.wideBvh = cJSON_IsTrue(wideBvh);
+		} else {
+			logr(warning, "Invalid wideBvh bool while parsing renderer\n");
+		}
+	} else {
+		p.wideBvh = defaultPrefs().wideBvh;
+	}
+	
+	quantizedBvh = cJSON_GetObjectItem(data, "quantizedBvh");
+	if (quantizedBvh) {
+		if (cJSON_IsBool(quantizedBvh)) {
+			p.quantizedBvh = cJSON_IsTrue(quantizedBvh);
+		} else {
+			logr(warning, "Invalid quantizedBvh bool while parsing renderer\n");
+		}
+	} else {
+		p.quantizedBvh = defaultPrefs().quantizedBvh;
+	}
+	
+	rayPackets = cJSON_GetObjectItem(data, "rayPackets");
+	if (rayPackets) {
+		if (cJSON_IsBool(rayPackets)) {
+			p.rayPackets = cJSON_IsTrue(rayPackets);
+		} else {
+			logr(warning, "Invalid rayPackets bool while parsing renderer\n");
+		}
+	} else {
+		p.rayPackets = defaultPrefs().rayPackets;
+	}
+	
+	integrator = cJSON_GetObjectItem(data, "integrator");
+	if (integrator) {
+		if (cJSON_IsString(integrator)) {
+			if (!parseIntegrator(integrator->valuestring, &p.integrator)) {
+				logr(warning, "Unknown integrator \"%s\", defaulting to pathtrace\n", integrator->valuestring);
+				p.integrator = integratorPathTrace;
+			}
+		} else {
+			logr(warning, "Invalid integrator while parsing renderer\n");
+		}
+	} else {
+		p.integrator = defaultPrefs().integrator;
+	}
+	
+	sampler = cJSON_GetObjectItem(data, "sampler");
+	if (sampler) {
+		if (cJSON_IsString(sampler)) {
+			if (!parseSampler(sampler->valuestring, &p.sampler)) {
+				logr(warning, "Unknown sampler \"%s\", defaulting to random\n", sampler->valuestring);
+				p.sampler = samplerRandom;
+			}
+		} else {
+			logr(warning, "Invalid sampler while parsing renderer\n");
+		}
+	} else {
+		p.sampler = defaultPrefs().sampler;
+	}
+	
 	filePath = cJSON_GetObjectItem(data, "outputFilePath");
 	if (filePath) {
 		if (cJSON_IsString(filePath)) {
@@ -892,9 +1142,34 @@ int parseAmbientColor(struct renderer *r, const cJSON *data) {
 		}
 	}
 	
+	if (r->scene->hdr) {
+		r->scene->background = newOctahedralMap(r->scene->hdr);
+	}
+	
 	return 0;
 }
 
+struct instance parseInstance(const cJSON *data, int meshIndex, char *meshName) {
+	struct instance instance = newInstance(meshIndex);
+	const cJSON *transforms = cJSON_GetObjectItem(data, "transforms");
+	const cJSON *transform = NULL;
+	if (transforms != NULL && cJSON_IsArray(transforms)) {
+		cJSON_ArrayForEach(transform, transforms) {
+			addInstanceTransform(&instance, parseTransform(transform, meshName));
+		}
+	}
+	
+	const cJSON *material = cJSON_GetObjectItem(data, "material");
+	if (material) {
+		if (cJSON_IsObject(material)) {
+			instance.material = parseMaterial(material);
+		} else {
+			logr(warning, "Invalid material for an instance of %s, using the mesh materials\n", meshName);
+		}
+	}
+	return instance;
+}
+
 //FIXME: Only parse everything else if the mesh is found and is valid
 void parseMesh(struct renderer *r, const cJSON *data, int idx, int meshCount) {
 	const cJSON *fileName = cJSON_GetObjectItem(data, "fileName");
@@ -935,6 +1210,14 @@ void parseMesh(struct renderer *r, const cJSON *data, int idx, int meshCount) {
 		}
 	}
 	if (meshValid) {
+		//Meshes can pick their own acceleration structure, to trade build time for trace speed
+		const cJSON *accelerator = cJSON_GetObjectItem(data, "accelerator");
+		if (accelerator) {
+			if (!cJSON_IsString(accelerator) || !parseAccelerator(accelerator->valuestring, &lastMesh(r)->accelerator)) {
+				logr(warning, "Invalid accelerator for mesh %s, using the renderer default\n", lastMesh(r)->name);
+			}
+		}
+		
 		const cJSON *transforms = cJSON_GetObjectItem(data, "transforms");
 		const cJSON *transform = NULL;
 		//TODO: Use parseTransforms for this
@@ -953,6 +1236,19 @@ void parseMesh(struct renderer *r, const cJSON *data, int idx, int meshCount) {
 			if (cJSON_IsNumber(roughness)) lastMesh(r)->materials[i].roughness = roughness->valuedouble;
 			assignBSDF(&lastMesh(r)->materials[i]);
 		}
+		
+		//Instances place copies of the mesh on top of its own transforms, sharing its geometry and BVH
+		const cJSON *instances = cJSON_GetObjectItem(data, "instances");
+		if (instances != NULL && cJSON_IsArray(instances)) {
+			int count = cJSON_GetArraySize(instances);
+			struct world *scene = r->scene;
+			scene->instances = realloc(scene->instances, (scene->instanceCount + count) * sizeof(struct instance));
+			const cJSON *instance = NULL;
+			cJSON_ArrayForEach(instance, instances) {
+				scene->instances[scene->instanceCount++] = parseInstance(instance, scene->meshCount - 1, lastMesh(r)->name);
+			}
+			lastMesh(r)->instanced = true;
+		}
 	}
 }
 
@@ -8,6 +8,9 @@
 
 #include "memory.h"
 #include <stdlib.h>
+#ifdef WINDOWS
+#include <malloc.h>
+#endif
 
 #include "statistics.h"
 
@@ -28,3 +31,21 @@ void cray_free(void *ptr) {
 	//increment(calls_to_free, 1);
 	free(ptr);
 }
+
+void *cray_aligned_malloc(size_t alignment, size_t size) {
+#ifdef WINDOWS
+	return _aligned_malloc(size, alignment);
+#else
+	void *ptr = NULL;
+	if (posix_memalign(&ptr, alignment, size)) return NULL;
+	return ptr;
+#endif
+}
+
+void cray_aligned_free(void *ptr) {
+#ifdef WINDOWS
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
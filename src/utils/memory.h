@@ -15,3 +15,11 @@ void *cray_malloc(size_t size);
 void *cray_calloc(size_t count, size_t size);
 
 void cray_free(void *ptr);
+
+/// Allocate memory aligned to a given boundary, for data that should line up with cache lines
+/// @remarks Memory allocated with this must be released with cray_aligned_free()
+/// @param alignment Alignment in bytes, must be a power of two
+/// @param size Amount of bytes to allocate
+void *cray_aligned_malloc(size_t alignment, size_t size);
+
+void cray_aligned_free(void *ptr);
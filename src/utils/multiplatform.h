@@ -65,6 +65,8 @@ struct crThread {
 	struct renderer *r;
 	struct texture *output;
 	
+	void *userData; //Anything else threadFunc needs
+	
 	void *(*threadFunc)(void *);
 };
 
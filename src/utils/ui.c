@@ -177,7 +177,7 @@ void drawProgressBars(struct renderer *r) {
 		if (r->state.threads[t].currentTileNum != -1) {
 			struct renderTile temp = r->state.renderTiles[r->state.threads[t].currentTileNum];
 			int completedSamples = r->state.threads[t].completedSamples;
-			int totalSamples = r->prefs.sampleCount;
+			int totalSamples = maxSampleCount(&r->prefs);
 			
 			float prc = ((float)completedSamples / (float)totalSamples);
 			int pixels2draw = (int)((float)temp.width*(float)prc);